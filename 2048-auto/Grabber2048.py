@@ -1,7 +1,14 @@
 from WindowGrabber import WindowGrabber;
 import cv2;
+import ctypes;
 import numpy as np;
 
+# Thresholding and template matching run natively, see recognize_board()
+lib2048 = ctypes.CDLL('./lib2048.so');
+lib2048.set_templates.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int];
+lib2048.recognize_board.argtypes = [ctypes.c_char_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int,
+    ctypes.POINTER(ctypes.c_uint64)];
+
 class Grabber2048(WindowGrabber):
     def __init__(self, templatePath = 'numbers.png', winTitle = r'Neko Project'):
         WindowGrabber.__init__(self, winTitle);
@@ -26,6 +33,8 @@ class Grabber2048(WindowGrabber):
             '32768':  template[15*16:16*16,0:40],
             '65536':  template[16*16:17*16,0:40],
         };
+        lib2048.set_templates(template.tobytes(), template.shape[1], template.shape[0],
+            template.shape[1]*template.shape[2], template.shape[2]);
 
     def __capture(self):
         pixbuf = self.capture();
@@ -60,28 +69,6 @@ class Grabber2048(WindowGrabber):
             x, y = 0, y+1;
         return True;
 
-    def __getNum(self, src):
-        for n in self.__numberTemplate:
-            dest = self.__numberTemplate[n];
-            if (self.__matchTemplateExact(src,dest)):
-                return int(n);
-        return None;
-
-    def __processImg(self, image):
-        w, h = image.shape[1], image.shape[0];
-        x = y = 0;
-        while y < h:
-            while x < w:
-                r = image[y, x, 0];
-                g = image[y, x, 1];
-                b = image[y, x, 2];
-                if (r > 1 and r < 254) or (g > 1 and g < 254) or (b > 1 and b < 254):
-                    image[y, x, 0] = 0;
-                    image[y, x, 1] = 0;
-                    image[y, x, 2] = 0;
-                x += 1;
-            x, y = 0, y+1;
-
     def testTemplate(self, x, y, num):
         cvimg = self.__capture();
         if(None==cvimg):
@@ -92,18 +79,12 @@ class Grabber2048(WindowGrabber):
         print(self.__matchTemplateExact(img, template));
 
     def getBoard(self):
-        cvimg = self.__capture();
-        if(cvimg is None):
+        pixbuf = self.capture();
+        if(None==pixbuf):
             return None;
-        result = [];
-        for y in range(4):
-            for x in range(4):
-                imgx, imgy = (28+6*x)*8, (9+(y<<1))*16;
-                img = cvimg[imgy:imgy+16, imgx:imgx+40];
-                self.__processImg(img);
-                num = self.__getNum(img);
-                if (None == num):
-                    return None;
-                result.append(num);
-        return result;
-
+        board = ctypes.c_uint64();
+        if not lib2048.recognize_board(pixbuf.get_pixels(), pixbuf.get_width(), pixbuf.get_height(),
+                pixbuf.get_rowstride(), pixbuf.get_n_channels(), ctypes.byref(board)):
+            return None;
+        ranks = [(board.value >> (i*4)) & 0xf for i in range(16)];
+        return [(1 << n) if n else 0 for n in ranks];
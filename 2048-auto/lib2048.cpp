@@ -19,9 +19,15 @@
 #include <fcntl.h>
 #include <time.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 extern "C" {
 	int nprocs();
 }
@@ -305,7 +311,8 @@ struct eval_state {
     int cachehits;
     unsigned long moves_evaled;
     int depth_limit;
-    eval_state() : maxdepth(0), curdepth(0), cachehits(0), moves_evaled(0), depth_limit(0) {
+    const std::atomic<bool> *cancel; // abandons the search when set, the result is then meaningless
+    eval_state() : maxdepth(0), curdepth(0), cachehits(0), moves_evaled(0), depth_limit(0), cancel(NULL) {
     }
 };
 
@@ -339,6 +346,9 @@ static const float CPROB_THRESH_BASE = 0.0001f;
 static const int CACHE_DEPTH_LIMIT  = 15;
 
 static float score_tilechoose_node(table_data_t *table, eval_state &state, board_t board, float cprob) {
+    if (state.cancel != NULL && state.cancel->load(std::memory_order_relaxed)) {
+        return 0.0f;
+    }
     if (cprob < CPROB_THRESH_BASE || state.curdepth >= state.depth_limit) {
         state.maxdepth = std::max(state.curdepth, state.maxdepth);
         return score_heur_board(table, board);
@@ -407,11 +417,12 @@ static float _score_toplevel_move(table_data_t *table, eval_state &state, board_
 	}
     return score_tilechoose_node(table, state, newboard, 1.0f) + 1e-6;
 }
-float score_toplevel_move(table_data_t *table, board_t board, int move) {
+float score_toplevel_move(table_data_t *table, board_t board, int move, const std::atomic<bool> *cancel = NULL) {
     float res;
     //struct timeval start, finish;
     //double elapsed;
     eval_state state;
+    state.cancel = cancel;
     state.depth_limit = std::max(3, count_distinct_tiles(board) - 2);
 
     //gettimeofday(&start, NULL);
@@ -428,35 +439,288 @@ float score_toplevel_move(table_data_t *table, board_t board, int move) {
     return res;
 }
 
-/* Find the best move for a given board. */
+/* Opening book built by the daemon's 2048book, in the format of its book.h:
+ * a header followed by entries sorted by board. The file is mapped read-only,
+ * so the daemon and every library using the same book share its pages. */
+static const uint64_t BOOK_MAGIC = 0x4b4f4f4238343032ULL;
+static const uint32_t BOOK_VERSION = 1;
+struct book_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+    uint64_t reserved;
+};
+struct book_entry_t {
+    board_t board;
+    uint8_t move;
+    uint8_t depth;
+    uint8_t reserved[6];
+};
+static void *book_map = NULL;
+static size_t book_size = 0;
+static const book_entry_t *book_entries = NULL;
+static uint64_t book_count = 0;
+
+static int book_lookup(board_t board) {
+    const book_entry_t *end = book_entries + book_count;
+    const book_entry_t *i = std::lower_bound(book_entries, end, board,
+        [](const book_entry_t &entry, board_t key) { return entry.board < key; });
+    return (i != end && i->board == board) ? i->move : -1;
+}
+
+static table_data_t *get_tables() {
+    static table_data_t table;
+    static std::once_flag once;
+    //Init table when called at the first time
+    std::call_once(once, []() { init_tables(&table); });
+    return &table;
+}
+
+static int search_best_move(table_data_t *table, board_t board, const std::atomic<bool> *cancel) {
+    int move = book_lookup(board);
+    if (move >= 0 && execute_move(table, move, board) != board) {
+        return move;
+    }
+    float best = 0;
+    int bestmove = -1;
+
+    //print_board(board);
+    //printf("Current scores: heur %.0f, actual %.0f\n", score_heur_board(board), score_board(board));
+
+    for(move=0; move<4; move++) {
+        float res = score_toplevel_move(table, board, move, cancel);
+        if(res > best) {
+            best = res;
+            bestmove = move;
+        }
+    }
+    return bestmove;
+}
+
+/* Pondering: while the game spawns the next tile, the boards it may spawn are
+ * searched in the background, most probable first. The next find_best_move is
+ * then answered from the results, or waits for the search of its board if that
+ * one is in progress. Any other board cancels the pondering. */
+struct ponder_state {
+    std::mutex mutex;
+    std::condition_variable updated;
+    std::thread thread;
+    std::atomic<bool> cancel;
+    std::unordered_map<board_t, int> results;
+    board_t searching;   // board being searched, 0 when none
+    bool running;
+    unsigned long hits;
+    unsigned long misses;
+    ponder_state() : cancel(false), searching(0), running(false), hits(0), misses(0) {
+    }
+};
+static ponder_state ponder;
+
+static void ponder_main(board_t board) {
+    table_data_t *table = get_tables();
+    // Every 2 is nine times as probable as any 4
+    for (board_t tile = 1; tile <= 2 && !ponder.cancel; tile++) {
+        board_t tmp = board;
+        board_t shift = 0;
+        for (; shift < 64 && !ponder.cancel; shift += 4, tmp >>= 4) {
+            if ((tmp & 0xf) != 0) {
+                continue;
+            }
+            board_t spawned = board | (tile << shift);
+            {
+                std::lock_guard<std::mutex> lock(ponder.mutex);
+                ponder.searching = spawned;
+            }
+            int move = search_best_move(table, spawned, &ponder.cancel);
+            std::lock_guard<std::mutex> lock(ponder.mutex);
+            if (!ponder.cancel) {
+                ponder.results[spawned] = move;
+            }
+            ponder.searching = 0;
+            ponder.updated.notify_all();
+        }
+    }
+    std::lock_guard<std::mutex> lock(ponder.mutex);
+    ponder.running = false;
+    ponder.updated.notify_all();
+}
+
+/* Board recognition for Grabber2048, on the window as captured. A cell is
+ * the 40x16 crop of the number at GRAB_X0 + x * GRAB_STEP_X, GRAB_Y0 + y *
+ * GRAB_STEP_Y. A pixel of a cell is lit when it is not black and none of its
+ * channels is a mid tone (2 to 253), which leaves the glyph; a pixel of a
+ * template is lit when it is not black. Each row of lit pixels is packed into
+ * one 64-bit word, so a row is compared with a template row in one compare,
+ * and a cell stops being read as soon as no template matches it. */
+static const int GRAB_CELL_W = 40;
+static const int GRAB_CELL_H = 16;
+static const int GRAB_X0 = 28 * 8;
+static const int GRAB_Y0 = 9 * 16;
+static const int GRAB_STEP_X = 6 * 8;
+static const int GRAB_STEP_Y = 2 * 16;
+static const int GRAB_TEMPLATES = 17;   // 0, 2, 4, ... 65536, one per rank
+
+static uint64_t grab_templates[GRAB_TEMPLATES][GRAB_CELL_H];
+static int grab_template_count = 0;
+
+// 0 for black, 2 for a mid tone, 1 otherwise
+static inline unsigned grab_class(uint8_t v) {
+    return ((unsigned)((uint8_t)(v - 2) < 252) << 1) | (v != 0);
+}
+
+static inline uint64_t grab_row(const uint8_t *p, int channels, bool glyph) {
+    uint64_t row = 0;
+    for (int x = 0; x < GRAB_CELL_W; x++, p += channels) {
+        unsigned c = grab_class(p[0]) | grab_class(p[1]) | grab_class(p[2]);
+        row |= (uint64_t)(glyph ? c == 1 : c != 0) << x;
+    }
+    return row;
+}
+
+// Rank of the first template matching the cell at `p`, -1 when none does
+static int grab_cell(const uint8_t *p, int stride, int channels) {
+    uint32_t candidates = (1U << grab_template_count) - 1;
+    for (int y = 0; y < GRAB_CELL_H && candidates != 0; y++, p += stride) {
+        uint64_t row = grab_row(p, channels, true);
+        for (uint32_t left = candidates; left != 0; left &= left - 1) {
+            int t = __builtin_ctz(left);
+            if (grab_templates[t][y] != row) {
+                candidates &= ~(1U << t);
+            }
+        }
+    }
+    return (candidates != 0) ? __builtin_ctz(candidates) : -1;
+}
+
 extern "C" {
-	int find_best_move(board_t board) {
-		static table_data_t table;
-		static bool active = false;
-		//Init table when called at the first time
-		if (!active) {
-			init_tables(&table);
-			active = true;
+	// Use the opening book at `path`, returns 1 on success
+	int open_book(const char *path) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return 0;
+		}
+		struct stat st;
+		void *map = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(book_header_t)) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (map == MAP_FAILED) {
+			return 0;
+		}
+		const book_header_t *header = (const book_header_t *)map;
+		if (header->magic != BOOK_MAGIC || header->version != BOOK_VERSION ||
+			header->entry_size != sizeof(book_entry_t) ||
+			header->count > (st.st_size - sizeof(book_header_t)) / sizeof(book_entry_t)) {
+			munmap(map, st.st_size);
+			return 0;
+		}
+		if (book_map != NULL) {
+			munmap(book_map, book_size);
+		}
+		book_map = map;
+		book_size = st.st_size;
+		book_entries = (const book_entry_t *)(header + 1);
+		book_count = header->count;
+		return 1;
+	}
+
+	// Cancel pondering and drop its results
+	void ponder_stop() {
+		ponder.cancel = true;
+		if (ponder.thread.joinable()) {
+			ponder.thread.join();
+		}
+		std::lock_guard<std::mutex> lock(ponder.mutex);
+		ponder.results.clear();
+		ponder.searching = 0;
+		ponder.running = false;
+	}
+
+	/* Start pondering the boards that may follow `move` on `board`, called
+	 * right after the move has been committed to the game. */
+	int ponder_start(board_t board, int move) {
+		ponder_stop();
+		table_data_t *table = get_tables();
+		board_t newboard = execute_move(table, move, board);
+		if (newboard == board) {
+			return 0;
 		}
+		ponder.cancel = false;
+		ponder.running = true;
+		ponder.thread = std::thread(ponder_main, newboard);
+		return 1;
+	}
 
-		int move;
-		float best = 0;
-		int bestmove = -1;
+	// Boards answered from pondering, and boards searched after all
+	void ponder_stats(unsigned long *hits, unsigned long *misses) {
+		std::lock_guard<std::mutex> lock(ponder.mutex);
+		*hits = ponder.hits;
+		*misses = ponder.misses;
+	}
 
-		//print_board(board);
-		//printf("Current scores: heur %.0f, actual %.0f\n", score_heur_board(board), score_board(board));
+	/* Find the best move for a given board. */
+	int find_best_move(board_t board) {
+		{
+			std::unique_lock<std::mutex> lock(ponder.mutex);
+			ponder.updated.wait(lock, [board]() {
+				return !ponder.running || ponder.searching != board || ponder.results.count(board) > 0;
+			});
+			auto i = ponder.results.find(board);
+			if (i != ponder.results.end()) {
+				int move = i->second;
+				ponder.hits++;
+				lock.unlock();
+				ponder_stop();
+				return move;
+			}
+			if (ponder.running || !ponder.results.empty()) {
+				ponder.misses++;
+			}
+		}
+		ponder_stop();
+		return search_best_move(get_tables(), board, NULL);
+	}
+	/* Load the number templates from an image of GRAB_TEMPLATES rows of
+	 * 40x16 pixels, for rank 0 (empty) upwards. Returns the number loaded. */
+	int set_templates(const uint8_t *pixels, int width, int height, int stride, int channels) {
+		if (channels < 3 || width < GRAB_CELL_W) {
+			return 0;
+		}
+		int count = std::min(height / GRAB_CELL_H, GRAB_TEMPLATES);
+		for (int t = 0; t < count; t++) {
+			for (int y = 0; y < GRAB_CELL_H; y++) {
+				grab_templates[t][y] = grab_row(pixels + (size_t)(t * GRAB_CELL_H + y) * stride, channels, false);
+			}
+		}
+		grab_template_count = count;
+		return count;
+	}
 
-		for(move=0; move<4; move++) {
-			float res = score_toplevel_move(&table, board, move);
-			if(res > best) {
-				best = res;
-				bestmove = move;
+	/* Read the board from a captured window of `channels` bytes per pixel
+	 * and `stride` bytes per row. Returns 1 and stores the board, or 0 at
+	 * the first cell matching no template or a tile that does not fit. */
+	int recognize_board(const uint8_t *pixels, int width, int height, int stride, int channels, board_t *board) {
+		if (grab_template_count == 0 || channels < 3 ||
+			width < GRAB_X0 + 3 * GRAB_STEP_X + GRAB_CELL_W ||
+			height < GRAB_Y0 + 3 * GRAB_STEP_Y + GRAB_CELL_H) {
+			return 0;
+		}
+		board_t result = 0;
+		for (int i = 0; i < 16; i++) {
+			int x = GRAB_X0 + (i & 3) * GRAB_STEP_X, y = GRAB_Y0 + (i >> 2) * GRAB_STEP_Y;
+			int rank = grab_cell(pixels + (size_t)y * stride + x * channels, stride, channels);
+			if (rank < 0 || rank > 15) {
+				return 0;
 			}
+			result |= (board_t)rank << (4 * i);
 		}
-		return bestmove;
+		*board = result;
+		return 1;
 	}
+
 	int __init__(){
 		return 0;
 	}
 }
-
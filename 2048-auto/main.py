@@ -1,8 +1,33 @@
 #!/usr/bin/env python3
 
-import time, ctypes;
+import os, time, socket, ctypes;
 lib2048 = ctypes.CDLL('./lib2048.so');
 lib2048.find_best_move.argtypes = [ctypes.c_uint64];
+lib2048.ponder_start.argtypes = [ctypes.c_uint64, ctypes.c_int];
+lib2048.open_book.argtypes = [ctypes.c_char_p];
+
+# Same opening book as the daemon
+if os.environ.get('RUN2048_BOOK_FILE'):
+    lib2048.open_book(os.environ['RUN2048_BOOK_FILE'].encode());
+
+# With RUN2048_EVAL_SOCKET set, moves are asked of a shared `2048ai --serve`
+evalFile = None;
+if os.environ.get('RUN2048_EVAL_SOCKET'):
+    evalConn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM);
+    evalConn.connect(os.environ['RUN2048_EVAL_SOCKET']);
+    evalFile = evalConn.makefile('rwb');
+
+# Best move and the scores of up, down, left and right from the server
+def evaluate(boardHex):
+    evalFile.write(b'%016x\n' % boardHex);
+    evalFile.flush();
+    line = evalFile.readline().decode().strip();
+    if line == 'E':
+        raise ValueError('eval server rejected board %016x' % boardHex);
+    fields = line.split(',');
+    return int(fields[0]), [float(s) for s in fields[1:]];
+
+MOVES = ['UP', 'DOWN', 'LEFT', 'RIGHT'];
 
 def __trailingZeros(num):
     if (num == 0):
@@ -13,7 +38,7 @@ def __trailingZeros(num):
         result += 1;
     return result;
 
-def findBestMove(board):
+def boardToHex(board):
     boardHex = 0;
     i = 0;
     for row in range(4):
@@ -21,12 +46,22 @@ def findBestMove(board):
             n = __trailingZeros(board[row*4+col]);
             boardHex |= (int(n) << (i*4));
             i += 1;
-    return {
-        '0': 'UP',
-        '1': 'DOWN',
-        '2': 'LEFT',
-        '3': 'RIGHT',
-    }.get(str(lib2048.find_best_move(boardHex)));
+    return boardHex;
+
+def findBestMove(board):
+    if evalFile:
+        move = evaluate(boardToHex(board))[0];
+    else:
+        move = lib2048.find_best_move(boardToHex(board));
+    if move < 0:
+        return None;
+    return MOVES[move];
+
+# Search the boards the tile spawn may produce while the game animates
+def ponderMove(board, move):
+    if evalFile:
+        return;
+    lib2048.ponder_start(boardToHex(board), MOVES.index(move));
 
 TEST=False;
 if __name__ == '__main__':
@@ -62,7 +97,7 @@ if __name__ == '__main__':
                 status='online';
                 print('2048 is online.');
 
-            # Find best move, this is time costy
+            # Find best move, this is time costy unless it was pondered
             move = findBestMove(board);
             if None == move:
                 print('Game Over');
@@ -74,6 +109,7 @@ if __name__ == '__main__':
 
             # Make the move
             kbd.tap_key(keyOper[move]);
+            ponderMove(board, move);
             time.sleep(0.1);
     except KeyboardInterrupt:
         pass;
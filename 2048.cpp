@@ -1,8 +1,9 @@
 /* The fundamental trick: the 4x4 board is represented as a 64-bit word,
  * with each board square packed into a single 4-bit nibble.
  * 
- * The maximum possible board value that can be supported is 32768 (2^15), but
- * this is a minor limitation as achieving 65536 is highly unlikely under normal circumstances.
+ * The maximum possible board value that can be supported is 32768 (2^15). Games
+ * that get there switch to the wide board of wide.h, with a byte per square.
+ * The 3x3 and 5x5 variants of square.h run the same search on their own boards.
  * 
  * The space and computation savings from using this representation should be significant.
  * 
@@ -10,6 +11,7 @@
  */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -17,73 +19,591 @@
 #include <unistd.h>
 #include <time.h>
 //#include <algorithm>
-#include <unordered_map>
+#include <atomic>
+#include <vector>
 #include <future>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include "2048.h"
+#include "wide.h"
+#include "square.h"
 
-static inline uint8_t count_distinct_tiles(board_t board) {
-    uint16_t bitset = 0;
-    while (board) {
-        bitset |= 1<<(board & 0xf);
-        board >>= 4;
+/* Board representations the search runs on. Each provides the board type and
+ * the few operations the search needs, and the search is instantiated for
+ * each of them, so the nibble board keeps its inlined table lookups while
+ * games past 32768 play on the wide board. */
+struct nibble_board {
+    typedef board_t type;
+    static const int cells = 16;
+
+    static bool equal(type a, type b) {
+        return a == b;
+    }
+    static uint64_t hash(type board) {
+        return board;
+    }
+    static int cell(type board, int i) {
+        return (board >> (4 * i)) & 0xf;
+    }
+    static type with_tile(type board, int i, int rank) {
+        return board | ((board_t)rank << (4 * i));
+    }
+    static int count_empty(type board) {
+        return ::count_empty(board);
+    }
+    static int count_distinct_tiles(type board) {
+        return ::count_distinct_tiles(board);
     }
+    static type execute_move(table_data_t *table, int move, type board) {
+        return ::execute_move(table, move, board);
+    }
+    static uint8_t expand_all_moves(table_data_t *table, type board, type moves[4]) {
+        return ::expand_all_moves(table, board, moves);
+    }
+    // The moves of many boards, through the table-free batch kernel
+    static void execute_move_batch(table_data_t *table, int move, const type *boards, type *results, int count) {
+        ::execute_move_batch(move, boards, results, count);
+    }
+    static float score_heur_board(table_data_t *table, type board) {
+        return ::score_heur_board(table, board);
+    }
+};
 
-    // Don't count empty tiles.
-    bitset >>= 1;
+struct wide_board {
+    typedef wide_board_t type;
+    static const int cells = 16;
 
-    uint8_t count = 0;
-    while (bitset) {
-        bitset &= bitset - 1;
-        count++;
+    static bool equal(type a, type b) {
+        return wide_equal(a, b);
+    }
+    static uint64_t hash(type board) {
+        return board.half[0] ^ (board.half[1] * 0xC2B2AE3D27D4EB4FULL);
     }
-    return count;
+    static int cell(type board, int i) {
+        return wide_get(board, i);
+    }
+    static type with_tile(type board, int i, int rank) {
+        return wide_set(board, i, rank);
+    }
+    static int count_empty(type board) {
+        return wide_count_empty(board);
+    }
+    static int count_distinct_tiles(type board) {
+        return wide_count_distinct_tiles(board);
+    }
+    static type execute_move(table_data_t *table, int move, type board) {
+        return wide_execute_move(table, move, board);
+    }
+    static uint8_t expand_all_moves(table_data_t *table, type board, type moves[4]) {
+        return wide_expand_all_moves(table, board, moves);
+    }
+    static void execute_move_batch(table_data_t *table, int move, const type *boards, type *results, int count) {
+        for (int i = 0; i < count; i++) {
+            results[i] = wide_execute_move(table, move, boards[i]);
+        }
+    }
+    static float score_heur_board(table_data_t *table, type board) {
+        return wide_score_heur_board(table, board);
+    }
+};
+
+// The low bit of each of the first `n` nibbles
+template <typename T>
+static constexpr T nibble_ones(int n) {
+    return (n == 0) ? 0 : (T)((nibble_ones<T>(n - 1) << 4) | 1);
 }
+static inline uint64_t square_hash(uint64_t board) {
+    return board;
+}
+static inline uint64_t square_hash(square_board_t board) {
+    return (uint64_t)board ^ ((uint64_t)(board >> 64) * 0xC2B2AE3D27D4EB4FULL);
+}
+
+/* N x N board, see square.h. Boards of up to 16 cells fit a 64-bit word, the
+ * others use 128 bits. Rows are looked up in the tables of the size, columns
+ * through a transpose unrolled for the size. */
+template <int N>
+struct square_board {
+    typedef typename std::conditional<N * N <= 16, uint64_t, square_board_t>::type type;
+    static const int cells = N * N;
+    static const int row_bits = 4 * N;
+    static constexpr type row_mask = ((type)1 << row_bits) - 1;
+    static constexpr type ones = nibble_ones<type>(N * N);
+    static const square_tables_t *tables;   // set once by find_best_move_square()
+
+    static bool equal(type a, type b) {
+        return a == b;
+    }
+    static uint64_t hash(type board) {
+        return square_hash(board);
+    }
+    static int cell(type board, int i) {
+        return (int)(board >> (4 * i)) & 0xf;
+    }
+    static type with_tile(type board, int i, int rank) {
+        return board | ((type)rank << (4 * i));
+    }
+    static type transpose(type board) {
+        type t = 0;
+        for (int r = 0; r < N; r++) {
+            for (int c = 0; c < N; c++) {
+                t |= ((board >> (4 * (N * r + c))) & 0xf) << (4 * (N * c + r));
+            }
+        }
+        return t;
+    }
+    // Same trick as ::count_empty(), over all cells at once
+    static int count_empty(type board) {
+        type x = board | ((board >> 2) & (ones * 3));
+        x |= x >> 1;
+        x = ~x & ones;
+        return __builtin_popcountll((uint64_t)x) + __builtin_popcountll((uint64_t)(x >> 32 >> 32));
+    }
+    static int count_distinct_tiles(type board) {
+        uint16_t bitset = 0;
+        for (int i = 0; i < cells; i++) {
+            bitset |= 1 << cell(board, i);
+        }
+        return __builtin_popcount(bitset >> 1);
+    }
+    static type move_rows(const uint32_t *table, type board) {
+        type ret = board;
+        for (int r = 0; r < N; r++) {
+            ret ^= (type)table[(uint32_t)((board >> (row_bits * r)) & row_mask)] << (row_bits * r);
+        }
+        return ret;
+    }
+    static type execute_move(table_data_t *table, int move, type board) {
+        switch (move) {
+            case 0: // up
+                return transpose(move_rows(tables->row_left, transpose(board)));
+            case 1: // down
+                return transpose(move_rows(tables->row_right, transpose(board)));
+            case 2: // left
+                return move_rows(tables->row_left, board);
+            case 3: // right
+                return move_rows(tables->row_right, board);
+            default:
+                return ~(type)0;
+        }
+    }
+    static uint8_t expand_all_moves(table_data_t *table, type board, type moves[4]) {
+        type t = transpose(board);
+        moves[0] = transpose(move_rows(tables->row_left, t));
+        moves[1] = transpose(move_rows(tables->row_right, t));
+        moves[2] = move_rows(tables->row_left, board);
+        moves[3] = move_rows(tables->row_right, board);
+        return (moves[0] != board) | ((moves[1] != board) << 1) | ((moves[2] != board) << 2) |
+            ((moves[3] != board) << 3);
+    }
+    static void execute_move_batch(table_data_t *table, int move, const type *boards, type *results, int count) {
+        for (int i = 0; i < count; i++) {
+            results[i] = execute_move(table, move, boards[i]);
+        }
+    }
+    static float score_rows(type board) {
+        float score = 0;
+        for (int r = 0; r < N; r++) {
+            score += tables->heur_score[(uint32_t)((board >> (row_bits * r)) & row_mask)];
+        }
+        return score;
+    }
+    static float score_heur_board(table_data_t *table, type board) {
+        return score_rows(board) + score_rows(transpose(board));
+    }
+};
+template <int N>
+const square_tables_t *square_board<N>::tables = NULL;
+template <int N>
+constexpr typename square_board<N>::type square_board<N>::row_mask;
+template <int N>
+constexpr typename square_board<N>::type square_board<N>::ones;
 
 //store the depth at which the heuristic was recorded as well as the actual heuristic
+template <class B>
 struct trans_table_entry_t{
-    uint8_t depth;
+    typename B::type board; // empty slots are all zero, searched boards always hold tiles
     float heuristic;
+    uint8_t depth;
+};
+
+/* Transposition table of a single search. Boards hash to a bucket of four
+ * entries, one cache line for the nibble board, with the most recently stored
+ * entry first. The table doubles whenever a bucket fills up, as long as the
+ * old and the doubled table fit in the byte cap together, since both are held
+ * while the entries move; from then on a new board replaces the entry of its
+ * bucket stored farthest from the root, the oldest one on ties, since that
+ * one cost the least to compute. Below the cap the search is the same as with
+ * an unbounded table. */
+#define TRANS_BUCKET_ENTRIES (4)
+#define TRANS_INITIAL_BUCKETS (1024)
+#define TRANS_MIN_BUCKETS (2)       // index() shifts by 64 - log2(count)
+
+template <class B>
+struct alignas(64) trans_bucket_t{
+    trans_table_entry_t<B> entries[TRANS_BUCKET_ENTRIES];
 };
-typedef std::unordered_map<board_t, trans_table_entry_t> trans_table_t;
+
+static std::atomic<size_t> trans_table_cap(0);
+
+template <class B>
+class trans_table_t {
+  public:
+    typedef typename B::type board_type;
+    typedef trans_table_entry_t<B> entry_type;
+    typedef trans_bucket_t<B> bucket_type;
+
+    unsigned long evictions;
+
+    trans_table_t() : evictions(0), buckets(NULL), shift(64), cap(trans_table_cap.load(std::memory_order_relaxed)) {
+    }
+    ~trans_table_t() {
+        free(buckets);
+    }
+    const entry_type *find(board_type board) const {
+        if (buckets == NULL) {
+            return NULL;
+        }
+        const bucket_type &bucket = buckets[index(board)];
+        for (int i = 0; i < TRANS_BUCKET_ENTRIES; i++) {
+            if (B::equal(bucket.entries[i].board, board)) {
+                return &bucket.entries[i];
+            }
+        }
+        return NULL;
+    }
+    void store(board_type board, uint8_t depth, float heuristic) {
+        if (buckets == NULL && !resize(initial_buckets())) {
+            return;
+        }
+        bucket_type *bucket = &buckets[index(board)];
+        int slot = TRANS_BUCKET_ENTRIES - 1;
+        for (int i = 0; i < TRANS_BUCKET_ENTRIES; i++) {
+            if (B::equal(bucket->entries[i].board, board)) {
+                bucket->entries[i].depth = depth;
+                bucket->entries[i].heuristic = heuristic;
+                return;
+            }
+        }
+        while (!is_free(bucket->entries[slot]) && can_grow()) {
+            if (!resize(bucket_count() * 2)) {
+                break;
+            }
+            bucket = &buckets[index(board)];
+        }
+        if (!is_free(bucket->entries[slot])) {
+            for (int i = slot - 1; i >= 0; i--) {
+                if (bucket->entries[i].depth > bucket->entries[slot].depth) {
+                    slot = i;
+                }
+            }
+            evictions++;
+        } else {
+            while (slot > 0 && is_free(bucket->entries[slot - 1])) {
+                slot--;
+            }
+        }
+        memmove(&bucket->entries[1], &bucket->entries[0], slot * sizeof(entry_type));
+        bucket->entries[0].board = board;
+        bucket->entries[0].depth = depth;
+        bucket->entries[0].heuristic = heuristic;
+    }
+
+  private:
+    bucket_type *buckets;
+    int shift;
+    size_t cap;
+
+    static bool is_free(const entry_type &entry) {
+        static const board_type empty = board_type();
+        return B::equal(entry.board, empty);
+    }
+    size_t bucket_count() const {
+        return (buckets == NULL) ? 0 : (size_t)1 << (64 - shift);
+    }
+    size_t index(board_type board) const {
+        return (B::hash(board) * 0x9E3779B97F4A7C15ULL) >> shift;
+    }
+    size_t initial_buckets() const {
+        static_assert(TRANS_MIN_BUCKETS * sizeof(bucket_type) <= TRANS_TABLE_MIN_CAP, "minimum cap too small");
+        size_t count = TRANS_INITIAL_BUCKETS;
+        while (cap != 0 && count > TRANS_MIN_BUCKETS && count * sizeof(bucket_type) > cap) {
+            count /= 2;
+        }
+        return count;
+    }
+    bool can_grow() const {
+        return cap == 0 || bucket_count() * 3 * sizeof(bucket_type) <= cap;
+    }
+    // Move every entry to a table of `count` buckets, oldest first so bucket order is kept
+    bool resize(size_t count) {
+        bucket_type *old = buckets;
+        size_t old_count = bucket_count();
+        bucket_type *fresh = (bucket_type*)aligned_alloc(alignof(bucket_type), count * sizeof(bucket_type));
+        if (fresh == NULL) {
+            return false;
+        }
+        memset(fresh, 0, count * sizeof(bucket_type));
+        buckets = fresh;
+        shift = 64 - __builtin_ctzll(count);
+        for (size_t b = 0; b < old_count; b++) {
+            for (int i = TRANS_BUCKET_ENTRIES - 1; i >= 0; i--) {
+                const entry_type &entry = old[b].entries[i];
+                if (!is_free(entry)) {
+                    bucket_type &bucket = buckets[index(entry.board)];
+                    memmove(&bucket.entries[1], &bucket.entries[0], (TRANS_BUCKET_ENTRIES - 1) * sizeof(entry_type));
+                    bucket.entries[0] = entry;
+                }
+            }
+        }
+        free(old);
+        return true;
+    }
+};
+
+/* Limit the transposition table of every search started from now on to
+ * `bytes`, 0 for no limit. Caps below TRANS_TABLE_MIN_CAP are raised to it. */
+void set_trans_table_cap(size_t bytes) {
+    if (bytes != 0 && bytes < TRANS_TABLE_MIN_CAP) {
+        bytes = TRANS_TABLE_MIN_CAP;
+    }
+    trans_table_cap.store(bytes, std::memory_order_relaxed);
+}
+
+#ifdef SEARCH_TRACE
+/* Shape of one search by depth, built with `make trace=true`. A chance node at
+ * curdepth d either ends as a leaf (cut by cprob or by depth_limit), is found
+ * in the transposition table, is scored as a leaf parent (again by cprob or
+ * depth), or is expanded into the move nodes of depth d+1. Otherwise the
+ * TRACE() updates compile to nothing. */
+#define SEARCH_TRACE_DEPTH (32)
+#define ENV_TRACE_FILE ("RUN2048_TRACE_FILE")
+#define DEFAULT_TRACE_FILE ("2048.trace")
+
+struct search_trace_t {
+    unsigned long chance_nodes[SEARCH_TRACE_DEPTH];
+    unsigned long open_cells[SEARCH_TRACE_DEPTH];       // of chance nodes scored or expanded
+    unsigned long move_nodes[SEARCH_TRACE_DEPTH];
+    unsigned long legal_moves[SEARCH_TRACE_DEPTH];
+    unsigned long cprob_leaves[SEARCH_TRACE_DEPTH];
+    unsigned long depth_leaves[SEARCH_TRACE_DEPTH];
+    unsigned long cache_probes[SEARCH_TRACE_DEPTH];
+    unsigned long cache_hits[SEARCH_TRACE_DEPTH];
+    unsigned long cache_shallow[SEARCH_TRACE_DEPTH];    // found, but searched less deep
+    unsigned long cprob_leaf_parents[SEARCH_TRACE_DEPTH];
+    unsigned long depth_leaf_parents[SEARCH_TRACE_DEPTH];
+};
+#define TRACE(state, field, depth, n) \
+    ((state).trace.field[min((int)(depth), SEARCH_TRACE_DEPTH - 1)] += (n))
+#else
+#define TRACE(state, field, depth, n) ((void)0)
+#endif
 
 /* Optimizing the game */
+template <class B>
 struct eval_state {
-    trans_table_t trans_table; // transposition table, to cache previously-seen moves
+    trans_table_t<B> trans_table; // transposition table, to cache previously-seen moves
     int maxdepth;
     int curdepth;
     int cachehits;
     unsigned long moves_evaled;
     int depth_limit;
+#ifdef SEARCH_TRACE
+    search_trace_t trace{};
+#endif
     eval_state() : maxdepth(0), curdepth(0), cachehits(0), moves_evaled(0), depth_limit(0) {
     }
 };
 
-// score over all possible moves
-static float score_move_node(table_data_t *table, eval_state &state, board_t board, float cprob);
-// score over all possible tile choices and placements
-static float score_tilechoose_node(table_data_t *table, eval_state &state, board_t board, float cprob);
-
-// score a single board heuristically
-static inline float score_heur_board(table_data_t *table, board_t board) {
-    return score_helper(          board , table->heur_score_table) +
-           score_helper(transpose(board), table->heur_score_table);
-}
-
 // Statistics and controls
 // cprob: cumulative probability
 // don't recurse into a node with a cprob less than this threshold
 static const float CPROB_THRESH_BASE = 0.0001f;
 static const int CACHE_DEPTH_LIMIT  = 15;
 
-static float score_tilechoose_node(table_data_t *table, eval_state &state, board_t board, float cprob) {
+/* Chance node whose grandchildren are all leaves. The moves of all spawned
+ * boards are executed in one batch, which gives the same results as a move
+ * node on each of them. */
+template <class B>
+static float score_leaf_parent_node(table_data_t *table, eval_state<B> &state, typename B::type board) {
+    typename B::type spawned[2 * B::cells], moved[4][2 * B::cells];
+    int count = 0;
+    for (int i = 0; i < B::cells; ++i) {
+        if (B::cell(board, i) == 0) {
+            spawned[count++] = B::with_tile(board, i, 1);
+            spawned[count++] = B::with_tile(board, i, 2);
+        }
+    }
+    for (int move = 0; move < 4; ++move) {
+        B::execute_move_batch(table, move, spawned, moved[move], count);
+    }
+    state.moves_evaled += 4 * count;
+
+    float res = 0.0f;
+    bool leaves = false;
+    for (int i = 0; i < count; ++i) {
+        float best = 0.0f;
+        for (int move = 0; move < 4; ++move) {
+            if (!B::equal(moved[move][i], spawned[i])) {
+                float score = B::score_heur_board(table, moved[move][i]);
+                best = max(best, score);
+                leaves = true;
+            }
+        }
+        res += best * ((i & 1) ? 0.1f : 0.9f);
+    }
+    if (leaves) {
+        state.maxdepth = max(state.curdepth + 1, state.maxdepth);
+    }
+    return res;
+}
+
+/* The search runs on an explicit stack instead of recursing, so it can stop
+ * between any two nodes and continue later: search_run() returns after a node
+ * budget or as soon as its cancel flag is raised. Callers use this to
+ * time-slice searches and to abandon them within milliseconds. Nodes are
+ * visited in the same order and scored with the same arithmetic as by the
+ * plain recursive expectimax. */
+enum {
+    FRAME_TILE,     // chance node: every tile choice and placement
+    FRAME_MOVE      // max node: every move
+};
+
+template <class B>
+struct search_frame_t {
+    typename B::type board;
+    typename B::type moves[4];  // move nodes: the board after each move
+    float cprob;        // cumulative probability passed to the children
+    float value;        // tile nodes: weighted sum so far, move nodes: best so far
+    uint8_t kind;
+    uint8_t next;       // tile nodes: next cell * 2 + (1 for the 4-tile), move nodes: next move
+    uint8_t count;      // tile nodes: open cells, move nodes: mask of legal moves
+};
+
+template <class B>
+struct basic_search {
+    typedef typename B::type board_type;
+
+    table_data_t *table;
+    eval_state<B> state;
+    std::vector<search_frame_t<B> > stack;
+    size_t top;
+    bool done;
+    float result;
+#ifdef SEARCH_TRACE
+    board_type root;
+    int root_move;
+#endif
+
+    basic_search(table_data_t *table, board_type board, int move, int depth);
+};
+
+struct search_s : basic_search<nibble_board> {
+    search_s(table_data_t *table, board_t board, int move, int depth) :
+        basic_search<nibble_board>(table, board, move, depth) {
+    }
+};
+
+#ifdef SEARCH_TRACE
+static void format_board(char *buf, size_t size, board_t board) {
+    snprintf(buf, size, "%016llx", (unsigned long long)board);
+}
+static void format_board(char *buf, size_t size, wide_board_t board) {
+    snprintf(buf, size, "%016llx%016llx", (unsigned long long)board.half[1], (unsigned long long)board.half[0]);
+}
+static void format_board(char *buf, size_t size, unsigned __int128 board) {
+    snprintf(buf, size, "%016llx%016llx", (unsigned long long)(board >> 64), (unsigned long long)board);
+}
+
+static FILE *trace_fp;
+static std::once_flag trace_once;
+static std::mutex trace_mutex;
+static std::atomic<unsigned long> trace_seq(0);
+
+/* Append the trace of a finished search to the trace file, a line per depth:
+ * search,board,move,depth_limit,depth,chance_nodes,open_cells,move_nodes,
+ * legal_moves,cprob_leaves,depth_leaves,cache_probes,cache_hits,cache_shallow,
+ * cprob_leaf_parents,depth_leaf_parents. The four moves of a board are four
+ * searches with the same board. */
+template <class B>
+static void write_trace(const basic_search<B> &search) {
+    std::call_once(trace_once, []() {
+        const char *path = getenv(ENV_TRACE_FILE);
+        trace_fp = fopen((path != NULL) ? path : DEFAULT_TRACE_FILE, "a");
+        if (trace_fp == NULL) {
+            fprintf(stderr, "Failed to open trace file.\n");
+        } else if (ftell(trace_fp) == 0) {
+            fprintf(trace_fp, "search,board,move,depth_limit,depth,chance_nodes,open_cells,move_nodes,legal_moves,"
+                "cprob_leaves,depth_leaves,cache_probes,cache_hits,cache_shallow,cprob_leaf_parents,depth_leaf_parents\n");
+        }
+    });
+    if (trace_fp == NULL) {
+        return;
+    }
+    const search_trace_t &t = search.state.trace;
+    unsigned long seq = trace_seq++;
+    char board[40];
+    format_board(board, sizeof(board), search.root);
+    std::string lines;
+    for (int d = 0; d < SEARCH_TRACE_DEPTH; d++) {
+        if (t.chance_nodes[d] == 0 && t.move_nodes[d] == 0) {
+            continue;
+        }
+        char line[512];
+        snprintf(line, sizeof(line), "%lu,%s,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+            seq, board, search.root_move, search.state.depth_limit, d, t.chance_nodes[d], t.open_cells[d],
+            t.move_nodes[d], t.legal_moves[d], t.cprob_leaves[d], t.depth_leaves[d], t.cache_probes[d],
+            t.cache_hits[d], t.cache_shallow[d], t.cprob_leaf_parents[d], t.depth_leaf_parents[d]);
+        lines += line;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    fwrite(lines.data(), 1, lines.size(), trace_fp);
+    fflush(trace_fp);
+}
+#endif
+
+// Hand the score of a finished node to its parent, or end the search at the root
+template <class B>
+static void return_value(basic_search<B> &search, float value) {
+    if (search.top == 0) {
+        search.result = value + 1e-6;
+        search.done = true;
+#ifdef SEARCH_TRACE
+        write_trace(search);
+#endif
+        return;
+    }
+    search_frame_t<B> &parent = search.stack[search.top - 1];
+    if (parent.kind == FRAME_MOVE) {
+        parent.value = max(parent.value, value);
+    } else {
+        parent.value += value * (((parent.next - 1) & 1) ? 0.1f : 0.9f);
+    }
+}
+/* Start a chance node. Leaves, cached boards and leaf parents are scored
+ * right away and return true with the score in `value`, the others push a
+ * frame. */
+template <class B>
+static bool enter_tilechoose_node(basic_search<B> &search, typename B::type board, float cprob, float *value) {
+    table_data_t *table = search.table;
+    eval_state<B> &state = search.state;
+    TRACE(state, chance_nodes, state.curdepth, 1);
     if (cprob < CPROB_THRESH_BASE || state.curdepth >= state.depth_limit) {
+        if (state.curdepth >= state.depth_limit) {
+            TRACE(state, depth_leaves, state.curdepth, 1);
+        } else {
+            TRACE(state, cprob_leaves, state.curdepth, 1);
+        }
         state.maxdepth = max(state.curdepth, state.maxdepth);
-        return score_heur_board(table, board);
+        *value = B::score_heur_board(table, board);
+        return true;
     }
     if (state.curdepth < CACHE_DEPTH_LIMIT) {
-        const trans_table_t::iterator &i = state.trans_table.find(board);
-        if (i != state.trans_table.end()) {
-            trans_table_entry_t entry = i->second;
+        const trans_table_entry_t<B> *i = state.trans_table.find(board);
+        TRACE(state, cache_probes, state.curdepth, 1);
+        if (i != NULL) {
+            trans_table_entry_t<B> entry = *i;
             /*
             return heuristic from transposition table only if it means that
             the node will have been evaluated to a minimum depth of state.depth_limit.
@@ -92,105 +612,194 @@ static float score_tilechoose_node(table_data_t *table, eval_state &state, board
             */
             if(entry.depth <= state.curdepth) {
                 state.cachehits++;
-                return entry.heuristic;
+                TRACE(state, cache_hits, state.curdepth, 1);
+                *value = entry.heuristic;
+                return true;
             }
+            TRACE(state, cache_shallow, state.curdepth, 1);
         }
     }
 
-    int num_open = count_empty(board);
+    int num_open = B::count_empty(board);
     cprob /= num_open;
+    TRACE(state, open_cells, state.curdepth, num_open);
 
-    float res = 0.0f;
-    board_t tmp = board;
-    board_t tile_2 = 1;
-    while (tile_2) {
-        if ((tmp & 0xf) == 0) {
-            res += score_move_node(table, state, board |  tile_2      , cprob * 0.9f) * 0.9f;
-            res += score_move_node(table, state, board | (tile_2 << 1), cprob * 0.1f) * 0.1f;
+    if (state.curdepth + 1 >= state.depth_limit || cprob * 0.9f < CPROB_THRESH_BASE) {
+        if (state.curdepth + 1 >= state.depth_limit) {
+            TRACE(state, depth_leaf_parents, state.curdepth, 1);
+        } else {
+            TRACE(state, cprob_leaf_parents, state.curdepth, 1);
+        }
+        float res = score_leaf_parent_node(table, state, board) / num_open;
+        if (state.curdepth < CACHE_DEPTH_LIMIT) {
+            state.trans_table.store(board, static_cast<uint8_t>(state.curdepth), res);
         }
-        tmp >>= 4;
-        tile_2 <<= 4;
+        *value = res;
+        return true;
     }
-    res = res / num_open;
+    search_frame_t<B> &frame = search.stack[search.top++];
+    frame.kind = FRAME_TILE;
+    frame.board = board;
+    frame.cprob = cprob;
+    frame.value = 0.0f;
+    frame.next = 0;
+    frame.count = num_open;
+    return false;
+}
+template <class B>
+static void enter_move_node(basic_search<B> &search, typename B::type board, float cprob) {
+    search_frame_t<B> &frame = search.stack[search.top++];
+    frame.kind = FRAME_MOVE;
+    frame.board = board;
+    frame.count = B::expand_all_moves(search.table, board, frame.moves);
+    frame.cprob = cprob;
+    frame.value = 0.0f;
+    frame.next = 0;
+    search.state.curdepth++;
+    search.state.moves_evaled += 4;
+    TRACE(search.state, move_nodes, search.state.curdepth, 1);
+    TRACE(search.state, legal_moves, search.state.curdepth, __builtin_popcount(frame.count));
+}
 
-    if (state.curdepth < CACHE_DEPTH_LIMIT) {
-        trans_table_entry_t entry = {static_cast<uint8_t>(state.curdepth), res};
-        state.trans_table[board] = entry;
+template <class B>
+basic_search<B>::basic_search(table_data_t *table, board_type board, int move, int depth) :
+    table(table), top(0), done(false), result(0) {
+#ifdef SEARCH_TRACE
+    root = board;
+    root_move = move;
+#endif
+    state.depth_limit = (depth > 0) ? depth : max(3, B::count_distinct_tiles(board) - 2);
+    // At most one chance and one move node per level are open at a time
+    stack.resize(2 * state.depth_limit + 2);
+    board_type newboard = B::execute_move(table, move, board);
+    float value;
+    if (B::equal(board, newboard)) {
+        done = true;
+    } else if (enter_tilechoose_node(*this, newboard, 1.0f, &value)) {
+        return_value(*this, value);
     }
-
-    return res;
 }
-static float score_move_node(table_data_t *table, eval_state &state, board_t board, float cprob) {
-    float best = 0.0f;
-    state.curdepth++;
-    for (int move = 0; move < 4; ++move) {
-        board_t newboard = execute_move(table, move, board);
-        state.moves_evaled++;
 
-        if (board != newboard) {
-            best = max(best, score_tilechoose_node(table, state, newboard, cprob));
+template <class B>
+static int run_search(basic_search<B> &search, unsigned long nodes, const volatile bool *cancel) {
+    eval_state<B> &state = search.state;
+    unsigned long limit = (nodes > 0) ? state.moves_evaled + nodes : ULONG_MAX;
+    while (!search.done) {
+        search_frame_t<B> &frame = search.stack[search.top - 1];
+        if (frame.kind == FRAME_MOVE) {
+            while (frame.next < 4 && !(frame.count & (1 << frame.next))) {
+                frame.next++;
+            }
+            if (frame.next == 4) {
+                state.curdepth--;
+                search.top--;
+                return_value(search, frame.value);
+                continue;
+            }
+            float value;
+            if (enter_tilechoose_node(search, frame.moves[frame.next++], frame.cprob, &value)) {
+                return_value(search, value);
+            }
+        } else {
+            while (frame.next < 2 * B::cells && B::cell(frame.board, frame.next >> 1) != 0) {
+                frame.next += 2;
+            }
+            if (frame.next == 2 * B::cells) {
+                float res = frame.value / frame.count;
+                if (state.curdepth < CACHE_DEPTH_LIMIT) {
+                    state.trans_table.store(frame.board, static_cast<uint8_t>(state.curdepth), res);
+                }
+                search.top--;
+                return_value(search, res);
+                continue;
+            }
+            // Checked before every move node, the only place nodes are spent
+            if (cancel != NULL && *cancel) {
+                return SEARCH_CANCELLED;
+            }
+            if (state.moves_evaled >= limit) {
+                return SEARCH_PAUSED;
+            }
+            int rank = (frame.next & 1) ? 2 : 1;
+            float prob = (frame.next & 1) ? 0.1f : 0.9f;
+            int cell = frame.next >> 1;
+            frame.next++;
+            enter_move_node(search, B::with_tile(frame.board, cell, rank), frame.cprob * prob);
         }
     }
-    state.curdepth--;
-
-    return best;
+    return SEARCH_DONE;
 }
-static float _score_toplevel_move(table_data_t *table, eval_state &state, board_t board, int move) {
-    //int maxrank = get_max_rank(board);
-    board_t newboard = execute_move(table, move, board);
-    if (board == newboard) {
-        return 0;
-	}
-    return score_tilechoose_node(table, state, newboard, 1.0f) + 1e-6;
+template <class B>
+static float search_score(const basic_search<B> &search, search_stats_t *stats) {
+    if (stats != NULL) {
+        stats->moves_evaled = search.state.moves_evaled;
+        stats->cachehits = search.state.cachehits;
+        stats->maxdepth = search.state.maxdepth;
+        stats->evictions = search.state.trans_table.evictions;
+    }
+    return search.done ? search.result : 0;
 }
-float score_toplevel_move(table_data_t *table, board_t board, int move) {
-    float res;
-    //struct timeval start, finish;
-    //double elapsed;
-    eval_state state;
-    state.depth_limit = max(3, count_distinct_tiles(board) - 2);
-
-    //gettimeofday(&start, NULL);
-    res = _score_toplevel_move(table, state, board, move);
-    //gettimeofday(&finish, NULL);
 
-	/*
-    elapsed = (finish.tv_sec - start.tv_sec);
-    elapsed += (finish.tv_usec - start.tv_usec) / 1000000.0;
+/* Start searching `move` on `board`, `depth` moves deep or, when `depth` is 0,
+ * as deep as the number of distinct tiles suggests. */
+search_t *search_new(table_data_t *table, board_t board, int move, int depth) {
+    return new search_t(table, board, move, depth);
+}
+void search_free(search_t *search) {
+    delete search;
+}
+/* Continue a search for about `nodes` more nodes, or to the end when `nodes`
+ * is 0. Returns SEARCH_PAUSED when the budget runs out and SEARCH_CANCELLED as
+ * soon as `*cancel` is set; the search can be continued after either. */
+int search_run(search_t *search, unsigned long nodes, const volatile bool *cancel) {
+    return run_search(*search, nodes, cancel);
+}
+// The score of a finished search, 0 before, and its counters so far
+float search_result(const search_t *search, search_stats_t *stats) {
+    return search_score(*search, stats);
+}
 
-    printf("Move %d: result %f: eval'd %ld moves (%d cache hits, %d cache size) in %.2f seconds (maxdepth=%d)\n", move, res,
-        state.moves_evaled, state.cachehits, (int)state.trans_table.size(), elapsed, state.maxdepth);
-	*/
-    return res;
+float score_toplevel_move_depth(table_data_t *table, board_t board, int move, int depth, search_stats_t *stats) {
+    search_t search(table, board, move, depth);
+    search_run(&search, 0, NULL);
+    return search_result(&search, stats);
 }
 
-static inline bool has_move(table_data_t *table, board_t board)
-{
-    for (int move = 0; move < 4; move++) {
-        if(execute_move(table, move, board) != board){
-             return true;
-        }
-    }
-    return false;
+float score_toplevel_move(table_data_t *table, board_t board, int move, search_stats_t *stats) {
+    return score_toplevel_move_depth(table, board, move, 0, stats);
 }
 
-/* Find the best move for a given board. */
-int find_best_move(table_data_t *table, board_t board) {
+/* Search all four moves of a board at once, each on its own thread. Gives up
+ * with -1 soon after `*cancel` is set. */
+template <class B>
+static int best_move(table_data_t *table, typename B::type board, int depth, search_stats_t *stats,
+    const volatile bool *cancel) {
+    typename B::type moves[4];
     int move;
     float best = 0;
     int bestmove = -1;
-    if(!has_move(table,board)){
+    if(stats != NULL){
+        stats->moves_evaled = 0;
+        stats->cachehits = 0;
+        stats->maxdepth = 0;
+        stats->evictions = 0;
+    }
+    if(B::expand_all_moves(table, board, moves) == 0){
         return -1;
     }
 
     std::future<float> tasks[4];
-
-    //print_board(board);
-    //printf("Current scores: heur %.0f, actual %.0f\n", score_heur_board(board), score_board(board));
+    search_stats_t move_stats[4];
+    std::atomic<bool> cancelled(false);
 
     for(move=0; move<4; move++) {
-	tasks[move]=std::async(std::launch::async,[table,board,move](){
-	    return score_toplevel_move(table,board,move);
+	search_stats_t *move_stat=&move_stats[move];
+	tasks[move]=std::async(std::launch::async,[table,board,move,depth,move_stat,cancel,&cancelled](){
+	    basic_search<B> search(table,board,move,depth);
+	    if(run_search(search,0,cancel)==SEARCH_CANCELLED){
+	        cancelled=true;
+	    }
+	    return search_score(search,move_stat);
 	});
     }
     for (move = 0; move < 4; move++) {
@@ -200,5 +809,79 @@ int find_best_move(table_data_t *table, board_t board) {
             bestmove = move;
         }
     }
-    return bestmove;
+    if(stats != NULL){
+        for (move = 0; move < 4; move++) {
+            stats->moves_evaled += move_stats[move].moves_evaled;
+            stats->cachehits += move_stats[move].cachehits;
+            stats->maxdepth = max(stats->maxdepth, move_stats[move].maxdepth);
+            stats->evictions += move_stats[move].evictions;
+        }
+    }
+    return cancelled ? -1 : bestmove;
+}
+
+/* Find the best move for a given board, searching `depth` moves deep or, when
+ * `depth` is 0, as deep as the number of distinct tiles suggests. Gives up
+ * with -1 soon after `*cancel` is set. */
+int find_best_move_depth(table_data_t *table, board_t board, int depth, search_stats_t *stats,
+    const volatile bool *cancel) {
+    return best_move<nibble_board>(table, board, depth, stats, cancel);
+}
+int find_best_move(table_data_t *table, board_t board, search_stats_t *stats) {
+    return find_best_move_depth(table, board, 0, stats, NULL);
+}
+// Same as find_best_move_depth() for a game past 32768, searched as deep as its tiles suggest
+int find_best_move_wide(table_data_t *table, wide_board_t board, search_stats_t *stats,
+    const volatile bool *cancel) {
+    return best_move<wide_board>(table, board, 0, stats, cancel);
+}
+
+// Build the tables of a size on first use, false when they cannot be allocated
+template <int N>
+static bool square_ready() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+        square_board<N>::tables = alloc_square_tables(N);
+    });
+    return square_board<N>::tables != NULL;
+}
+template <int N>
+static int best_square_move(square_board_t board, search_stats_t *stats, const volatile bool *cancel) {
+    if (!square_ready<N>()) {
+        return -1;
+    }
+    return best_move<square_board<N> >(NULL, (typename square_board<N>::type)board, 0, stats, cancel);
+}
+template <int N>
+static square_board_t execute_square_move(int move, square_board_t board) {
+    if (!square_ready<N>()) {
+        return board;
+    }
+    return square_board<N>::execute_move(NULL, move, (typename square_board<N>::type)board);
+}
+/* Same as find_best_move_depth() on a `size` x `size` board, searched as deep
+ * as its tiles suggest. Sizes other than 3 to 5 have no move. */
+int find_best_move_square(int size, square_board_t board, search_stats_t *stats, const volatile bool *cancel) {
+    switch (size) {
+        case 3:
+            return best_square_move<3>(board, stats, cancel);
+        case 4:
+            return best_square_move<4>(board, stats, cancel);
+        case 5:
+            return best_square_move<5>(board, stats, cancel);
+        default:
+            return -1;
+    }
+}
+square_board_t execute_move_square(int size, int move, square_board_t board) {
+    switch (size) {
+        case 3:
+            return execute_square_move<3>(move, board);
+        case 4:
+            return execute_square_move<4>(move, board);
+        case 5:
+            return execute_square_move<5>(move, board);
+        default:
+            return board;
+    }
 }
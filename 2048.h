@@ -102,6 +102,28 @@ static inline board_t execute_move(table_data_t *table, int move, board_t board)
 			return ~0ULL;
     }
 }
+/* Execute all four moves, moves[i] being the board after move i. The transpose
+ * is shared by up and down and the 16 table lookups are independent of each
+ * other, so they can all be in flight at once. Returns the bitmask of the
+ * legal moves. */
+static inline uint8_t expand_all_moves(table_data_t *table, board_t board, board_t moves[4]) {
+    board_t t = transpose(board);
+    board_t up = board, down = board, left = board, right = board;
+    int i;
+    for (i = 0; i < 4; i++) {
+        row_t row = (board >> (16 * i)) & ROW_MASK;
+        row_t col = (t >> (16 * i)) & ROW_MASK;
+        up    ^= (table->col_up_table)[col] << (4 * i);
+        down  ^= (table->col_down_table)[col] << (4 * i);
+        left  ^= (board_t)((table->row_left_table)[row]) << (16 * i);
+        right ^= (board_t)((table->row_right_table)[row]) << (16 * i);
+    }
+    moves[0] = up;
+    moves[1] = down;
+    moves[2] = left;
+    moves[3] = right;
+    return (up != board) | ((down != board) << 1) | ((left != board) << 2) | ((right != board) << 3);
+}
 
 static inline uint8_t get_max_rank(board_t board) {
     uint8_t maxrank = 0;
@@ -112,6 +134,24 @@ static inline uint8_t get_max_rank(board_t board) {
     return maxrank;
 }
 
+static inline uint8_t count_distinct_tiles(board_t board) {
+    uint16_t bitset = 0;
+    while (board) {
+        bitset |= 1<<(board & 0xf);
+        board >>= 4;
+    }
+
+    // Don't count empty tiles.
+    bitset >>= 1;
+
+    uint8_t count = 0;
+    while (bitset) {
+        bitset &= bitset - 1;
+        count++;
+    }
+    return count;
+}
+
 // Calculate score
 static inline float score_helper(board_t board, const float* table) {
     return table[(board >>  0) & ROW_MASK] +
@@ -120,17 +160,55 @@ static inline float score_helper(board_t board, const float* table) {
            table[(board >> 48) & ROW_MASK];
 }
 
+// score a single board heuristically
+static inline float score_heur_board(table_data_t *table, board_t board) {
+    return score_helper(          board , table->heur_score_table) +
+           score_helper(transpose(board), table->heur_score_table);
+}
+
 // score a single board actually (adding in the score from spawned 4 tiles)
 static inline float score_board(table_data_t *table, board_t board) {
     return score_helper(board, table->score_table);
 }
 
+// Search counters of a single find_best_move call
+typedef struct {
+    unsigned long moves_evaled;
+    uint32_t cachehits;
+    uint8_t maxdepth;
+    unsigned long evictions;    // transposition entries replaced at the byte cap
+} search_stats_t;
+
+// A top-level move search that can be paused and continued, see search_run()
+typedef struct search_s search_t;
+
+#define SEARCH_DONE (0)
+#define SEARCH_PAUSED (1)
+#define SEARCH_CANCELLED (2)
+
+// Smallest transposition table cap in bytes, two buckets of the widest board
+#define TRANS_TABLE_MIN_CAP (256)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void init_tables(table_data_t *table);
-int find_best_move(table_data_t *table, board_t board);
+float line_score(const unsigned *line, int len);
+float line_heur_score(const unsigned *line, int len);
+void line_move_left(unsigned *line, int len, unsigned max_rank);
+float score_toplevel_move(table_data_t *table, board_t board, int move, search_stats_t *stats);
+float score_toplevel_move_depth(table_data_t *table, board_t board, int move, int depth, search_stats_t *stats);
+int find_best_move(table_data_t *table, board_t board, search_stats_t *stats);
+int find_best_move_depth(table_data_t *table, board_t board, int depth, search_stats_t *stats,
+    const volatile bool *cancel);
+search_t *search_new(table_data_t *table, board_t board, int move, int depth);
+int search_run(search_t *search, unsigned long nodes, const volatile bool *cancel);
+float search_result(const search_t *search, search_stats_t *stats);
+void search_free(search_t *search);
+void set_trans_table_cap(size_t bytes);
+void execute_move_batch(int move, const board_t *boards, board_t *results, size_t count);
+const char *execute_move_batch_isa(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,205 @@
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "affinity.h"
+
+static const char *placement_names[PLACEMENT_COUNT]={"none","compact","scatter","numa"};
+
+int placement_parse(const char *name)
+{
+    int i;
+    for(i=0; i<PLACEMENT_COUNT; i++){
+        if(strcmp(name,placement_names[i])==0){
+            return i;
+        }
+    }
+    return -1;
+}
+const char *placement_name(int policy)
+{
+    if(policy<0 || policy>=PLACEMENT_COUNT){
+        return "unknown";
+    }
+    return placement_names[policy];
+}
+
+// Parse a kernel cpulist such as "0-3,8-11" into a CPU set
+static void parse_cpulist(const char *list, cpu_set_t *cpuset)
+{
+    const char *p=list;
+    CPU_ZERO(cpuset);
+    while(*p!='\0' && *p!='\n'){
+        char *end;
+        unsigned long first=strtoul(p,&end,10),last=first,cpu;
+        if(end==p){
+            break;
+        }
+        if(*end=='-'){
+            p=end+1;
+            last=strtoul(p,&end,10);
+        }
+        for(cpu=first; cpu<=last && cpu<CPU_SETSIZE; cpu++){
+            CPU_SET(cpu,cpuset);
+        }
+        p=(*end==',') ? end+1 : end;
+    }
+}
+static void add_node(cpu_topology_t *topology, const cpu_set_t *cpuset)
+{
+    uint16_t cpu,count=0;
+    uint16_t node=topology->node_count;
+    topology->node_first[node]=topology->cpu_count;
+    for(cpu=0; cpu<CPU_SETSIZE; cpu++){
+        if(CPU_ISSET(cpu,cpuset)){
+            topology->cpus[topology->cpu_count++]=cpu;
+            count++;
+        }
+    }
+    if(count>0){
+        topology->node_cpu_count[node]=count;
+        topology->node_count++;
+    }
+}
+int topology_read(cpu_topology_t *topology)
+{
+    cpu_set_t allowed;
+    memset(topology,0,sizeof(*topology));
+    if(sched_getaffinity(0,sizeof(allowed),&allowed)!=0){
+        fprintf(stderr,"Failed to get CPU affinity: %s.\n",strerror(errno));
+        return E_INVAL;
+    }
+    topology->cpus=(uint16_t*)calloc(CPU_COUNT(&allowed),sizeof(uint16_t));
+    if(NULL==topology->cpus){
+        return E_NOSPACE;
+    }
+
+    // Only CPUs this process may run on are considered, nodes without any are skipped
+    int node;
+    for(node=0; node<MAX_NUMA_NODES; node++){
+        char path[64],buf[1024];
+        snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",node);
+        FILE *fp=fopen(path,"r");
+        if(NULL==fp){
+            continue;
+        }
+        if(fgets(buf,sizeof(buf),fp)!=NULL){
+            cpu_set_t cpuset;
+            parse_cpulist(buf,&cpuset);
+            CPU_AND(&cpuset,&cpuset,&allowed);
+            add_node(topology,&cpuset);
+        }
+        fclose(fp);
+    }
+    if(topology->node_count==0){
+        add_node(topology,&allowed);
+    }
+    return E_OK;
+}
+void topology_free(cpu_topology_t *topology)
+{
+    free(topology->cpus);
+    topology->cpus=NULL;
+}
+/* Compute the CPUs of game `index` out of `count` games.
+ * Returns the node the game is placed on, or -1 when it is not pinned. */
+int placement_cpuset(const cpu_topology_t *topology, int policy, uint16_t index, uint16_t count,
+    cpu_set_t *cpuset)
+{
+    uint16_t node,first,cpus,per,start,i;
+    CPU_ZERO(cpuset);
+    if(topology->node_count==0){
+        return -1;
+    }
+    switch(policy){
+        case PLACEMENT_COMPACT:
+            first=0;
+            cpus=topology->cpu_count;
+            per=max(1,cpus/count);
+            start=(index*per)%cpus;
+        break;
+        case PLACEMENT_SCATTER:
+        case PLACEMENT_NUMA:
+            node=index%topology->node_count;
+            first=topology->node_first[node];
+            cpus=topology->node_cpu_count[node];
+            if(policy==PLACEMENT_NUMA){
+                per=cpus;
+                start=0;
+            }else{
+                uint16_t games=(count-node+topology->node_count-1)/topology->node_count;
+                per=max(1,cpus/max(games,1));
+                start=((index/topology->node_count)*per)%cpus;
+            }
+        break;
+        default:
+            return -1;
+    }
+    for(i=0; i<per; i++){
+        CPU_SET(topology->cpus[first+(start+i)%cpus],cpuset);
+    }
+    // Compact blocks may straddle two nodes, the node of the first CPU is reported
+    uint16_t pos=first+start;
+    for(node=topology->node_count-1; node>0 && topology->node_first[node]>pos; node--);
+    return node;
+}
+/* Map memory for the move tables. Every search node does random row lookups
+ * all over the tables, which with 4 KB pages misses the TLB on most of them,
+ * so they are put in 2 MB pages when possible: explicit huge pages first, then
+ * transparent huge pages on a 2 MB aligned mapping, then normal pages. */
+static table_data_t *map_tables(bool huge_pages)
+{
+    void *mem;
+    if(huge_pages){
+        mem=mmap(NULL,TABLE_MAP_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(MAP_FAILED!=mem){
+            return (table_data_t*)mem;
+        }
+        mem=mmap(NULL,TABLE_MAP_SIZE+HUGE_PAGE_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(MAP_FAILED==mem){
+            return NULL;
+        }
+        uintptr_t start=(uintptr_t)mem;
+        uintptr_t aligned=(start+HUGE_PAGE_SIZE-1)&~(uintptr_t)(HUGE_PAGE_SIZE-1);
+        if(aligned>start){
+            munmap(mem,aligned-start);
+        }
+        munmap((void*)(aligned+TABLE_MAP_SIZE),start+HUGE_PAGE_SIZE-aligned);
+        madvise((void*)aligned,TABLE_MAP_SIZE,MADV_HUGEPAGE);
+        return (table_data_t*)aligned;
+    }
+    mem=mmap(NULL,TABLE_MAP_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    return (MAP_FAILED==mem) ? NULL : (table_data_t*)mem;
+}
+/* Allocate and fill move tables on the memory of `node`, or anywhere when
+ * `node` is negative. The pages are first touched from a thread temporarily
+ * pinned to the node, so the kernel's first-touch policy places them there
+ * without needing libnuma. */
+table_data_t *alloc_node_tables(const cpu_topology_t *topology, int node, bool huge_pages)
+{
+    cpu_set_t saved,cpuset;
+    bool pinned=false;
+    if(node>=0 && node<topology->node_count &&
+        pthread_getaffinity_np(pthread_self(),sizeof(saved),&saved)==0){
+        uint16_t i;
+        CPU_ZERO(&cpuset);
+        for(i=0; i<topology->node_cpu_count[node]; i++){
+            CPU_SET(topology->cpus[topology->node_first[node]+i],&cpuset);
+        }
+        pinned=(pthread_setaffinity_np(pthread_self(),sizeof(cpuset),&cpuset)==0);
+    }
+    table_data_t *table=map_tables(huge_pages);
+    if(NULL!=table){
+        init_tables(table);
+    }
+    if(pinned){
+        pthread_setaffinity_np(pthread_self(),sizeof(saved),&saved);
+    }
+    return table;
+}
+void free_node_tables(table_data_t *table)
+{
+    if(NULL!=table){
+        munmap(table,TABLE_MAP_SIZE);
+    }
+}
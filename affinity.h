@@ -0,0 +1,56 @@
+#ifndef __affinity_h__
+#define __affinity_h__
+
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "2048.h"
+
+/* Placement of game threads on CPUs. The search helpers of a game inherit
+ * the affinity of its game thread, so pinning the game thread pins them too.
+ *
+ *  compact  Each game gets its own block of CPUs, filling one node after the other.
+ *  scatter  Games are distributed round-robin over the nodes, each getting its
+ *           own block of CPUs within the node.
+ *  numa     Games are distributed round-robin over the nodes and may run on
+ *           any CPU of their node. */
+enum{
+    PLACEMENT_NONE,
+    PLACEMENT_COMPACT,
+    PLACEMENT_SCATTER,
+    PLACEMENT_NUMA,
+    PLACEMENT_COUNT
+};
+
+#define MAX_NUMA_NODES (64)
+#define HUGE_PAGE_SIZE (2UL<<20)
+// Move tables are mapped in whole huge pages
+#define TABLE_MAP_SIZE ((sizeof(table_data_t)+HUGE_PAGE_SIZE-1)&~(HUGE_PAGE_SIZE-1))
+
+typedef struct{
+    uint16_t node_count;
+    uint16_t cpu_count;
+    uint16_t node_cpu_count[MAX_NUMA_NODES];
+    uint16_t node_first[MAX_NUMA_NODES];
+    uint16_t *cpus;  // CPU ids grouped by node
+}cpu_topology_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int placement_parse(const char *name);
+const char *placement_name(int policy);
+int topology_read(cpu_topology_t *topology);
+void topology_free(cpu_topology_t *topology);
+int placement_cpuset(const cpu_topology_t *topology, int policy, uint16_t index, uint16_t count,
+    cpu_set_t *cpuset);
+table_data_t *alloc_node_tables(const cpu_topology_t *topology, int node, bool huge_pages);
+void free_node_tables(table_data_t *table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,333 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "2048.h"
+#include "stats.h"
+#include "logseg.h"
+#include "analyze.h"
+
+/* Scores and move counts go to log-linear histograms: values below 128 get a
+ * bucket each, larger ones 128 buckets per power of two, so percentiles are
+ * exact up to 127 and within 1% above, in fixed memory per thread. */
+#define ANALYZE_SUB_BITS (7)
+#define ANALYZE_BUCKETS ((32-ANALYZE_SUB_BITS+1)<<ANALYZE_SUB_BITS)
+
+typedef struct{
+    pthread_t tid;
+    const char *begin;      // lines starting in [begin,end) are this thread's
+    const char *end;
+    const char *data_end;
+    const logseg_t *seg;    // the log is a binary segment
+    uint64_t games;
+    uint64_t skipped;
+    uint64_t score_sum;
+    uint64_t moves_sum;
+    uint32_t score_max;
+    uint32_t moves_max;
+    uint64_t rank[STATS_RANK_COUNT];
+    uint64_t empty_sum;
+    uint64_t distinct_sum;
+    uint64_t max_corner;
+    uint64_t max_edge;
+    uint64_t score_hist[ANALYZE_BUCKETS];
+    uint64_t moves_hist[ANALYZE_BUCKETS];
+}analyze_part_t;
+
+static inline uint32_t hist_bucket(uint32_t value)
+{
+    if(value<(1U<<ANALYZE_SUB_BITS)){
+        return value;
+    }
+    int msb=31-__builtin_clz(value);
+    int shift=msb-ANALYZE_SUB_BITS;
+    return ((shift+1)<<ANALYZE_SUB_BITS)+((value>>shift)-(1U<<ANALYZE_SUB_BITS));
+}
+// The smallest value of a bucket
+static inline uint32_t hist_floor(uint32_t bucket)
+{
+    uint32_t group=bucket>>ANALYZE_SUB_BITS,mantissa=bucket&((1U<<ANALYZE_SUB_BITS)-1);
+    if(group==0){
+        return mantissa;
+    }
+    return ((1U<<ANALYZE_SUB_BITS)+mantissa)<<(group-1);
+}
+
+static void add_game(analyze_part_t *part, uint32_t moveno, uint32_t score, uint32_t max_tile, board_t board)
+{
+    part->games++;
+    part->score_sum+=score;
+    part->moves_sum+=moveno;
+    part->score_max=max(part->score_max,score);
+    part->moves_max=max(part->moves_max,moveno);
+    part->score_hist[hist_bucket(score)]++;
+    part->moves_hist[hist_bucket(moveno)]++;
+    int rank=(max_tile>0) ? 31-__builtin_clz(max_tile) : 0;
+    part->rank[min(rank,STATS_RANK_COUNT-1)]++;
+
+    static const uint8_t cell_kind[16]={2,1,1,2, 1,0,0,1, 1,0,0,1, 2,1,1,2};  // 2 corner, 1 edge
+    uint32_t ranks=0;
+    int i;
+    for(i=0; i<16; i++){
+        ranks|=1U<<((board>>(4*i))&0xf);
+    }
+    // The first cell holding the largest tile is the first zero nibble of the xor
+    board_t x=board^((board_t)(31-__builtin_clz(ranks))*0x1111111111111111ULL);
+    x|=(x>>2)&0x3333333333333333ULL;
+    x|=(x>>1);
+    int max_cell=__builtin_ctzll(~x&0x1111111111111111ULL)/4;
+    part->empty_sum+=count_empty(board);
+    part->distinct_sum+=__builtin_popcount(ranks>>1);
+    part->max_corner+=(cell_kind[max_cell]==2);
+    part->max_edge+=(cell_kind[max_cell]==1);
+}
+static void* analyze_main(void *data)
+{
+    analyze_part_t *part=(analyze_part_t*)data;
+    const char *p=part->begin,*end=part->data_end;
+    while(p<part->end){
+        uint32_t moveno,score,max_tile;
+        uint64_t board;
+        if(log_parse_dec(&p,end,&moveno) && log_parse_dec(&p,end,&score) &&
+            log_parse_dec(&p,end,&max_tile) && log_parse_hex(&p,end,&board) && board!=0){
+            add_game(part,moveno,score,max_tile,board);
+        }else{
+            part->skipped++;
+        }
+        // Parsing stops within the line; lines normally end after a 16-digit seed
+        if(end-p>=18 && p[0]==',' && p[17]=='\n' && !log_has_newline(p+1) && !log_has_newline(p+9)){
+            p+=18;
+        }else{
+            const char *nl=(const char*)memchr(p,'\n',end-p);
+            p=(NULL!=nl) ? nl+1 : end;
+        }
+    }
+    return NULL;
+}
+/* Decode the records of a segment starting in [begin,end), from the start of
+ * the block holding `begin` */
+static void* analyze_segment_main(void *data)
+{
+    analyze_part_t *part=(analyze_part_t*)data;
+    const logseg_t *seg=part->seg;
+    const uint8_t *begin=(const uint8_t*)part->begin,*stop=(const uint8_t*)part->end;
+    uint64_t lo=0,hi=seg->block_count;
+    while(lo<hi){
+        uint64_t mid=lo+(hi-lo)/2;
+        if(seg->data+seg->blocks[mid]<=begin){
+            lo=mid+1;
+        }else{
+            hi=mid;
+        }
+    }
+    const uint8_t *p=(lo>0) ? seg->data+seg->blocks[lo-1] : seg->records;
+    while(p<stop){
+        const uint8_t *record=p;
+        log_record_t rec;
+        if(!logseg_read(&p,seg->records_end,&rec)){
+            part->skipped++;
+            break;
+        }
+        if(record>=begin){
+            add_game(part,rec.moveno,rec.score,rec.max_tile,rec.board);
+        }
+    }
+    return NULL;
+}
+// The first line starting at or after `p`
+static const char *line_start(const char *data, const char *p, const char *data_end)
+{
+    if(p==data || p[-1]=='\n'){
+        return p;
+    }
+    const char *nl=(const char*)memchr(p,'\n',data_end-p);
+    return (NULL!=nl) ? nl+1 : data_end;
+}
+
+static void merge_part(analyze_part_t *total, const analyze_part_t *part)
+{
+    int i;
+    total->games+=part->games;
+    total->skipped+=part->skipped;
+    total->score_sum+=part->score_sum;
+    total->moves_sum+=part->moves_sum;
+    total->score_max=max(total->score_max,part->score_max);
+    total->moves_max=max(total->moves_max,part->moves_max);
+    for(i=0; i<STATS_RANK_COUNT; i++){
+        total->rank[i]+=part->rank[i];
+    }
+    total->empty_sum+=part->empty_sum;
+    total->distinct_sum+=part->distinct_sum;
+    total->max_corner+=part->max_corner;
+    total->max_edge+=part->max_edge;
+    for(i=0; i<ANALYZE_BUCKETS; i++){
+        total->score_hist[i]+=part->score_hist[i];
+        total->moves_hist[i]+=part->moves_hist[i];
+    }
+}
+static void print_percentiles(const char *name, const uint64_t *hist, uint64_t games)
+{
+    static const double percentiles[]={1,10,25,50,75,90,99,99.9};
+    size_t i;
+    uint32_t bucket=0;
+    uint64_t seen=hist[0];
+    printf("%s_percentiles",name);
+    for(i=0; i<sizeof(percentiles)/sizeof(percentiles[0]); i++){
+        // Nearest rank
+        uint64_t target=(uint64_t)(percentiles[i]*games/100+0.999999);
+        target=max(target,1);
+        while(seen<target && bucket<ANALYZE_BUCKETS-1){
+            seen+=hist[++bucket];
+        }
+        printf(" p%g:%u",percentiles[i],hist_floor(bucket));
+    }
+    printf("\n");
+}
+static void print_report(const analyze_part_t *total)
+{
+    uint64_t games=total->games;
+    int i;
+    printf("games %llu\n",(unsigned long long)games);
+    printf("skipped_lines %llu\n",(unsigned long long)total->skipped);
+    if(games==0){
+        return;
+    }
+    printf("score_mean %.0f\n",(double)total->score_sum/games);
+    printf("score_max %u\n",total->score_max);
+    print_percentiles("score",total->score_hist,games);
+    printf("moves_mean %.0f\n",(double)total->moves_sum/games);
+    printf("moves_max %u\n",total->moves_max);
+    print_percentiles("moves",total->moves_hist,games);
+
+    // Share of games whose largest tile was at least, and exactly, each tile
+    uint64_t reached=games;
+    int lowest=-1,highest=0;
+    for(i=0; i<STATS_RANK_COUNT; i++){
+        if(total->rank[i]>0){
+            if(lowest<0){
+                lowest=i;
+            }
+            highest=i;
+        }
+    }
+    printf("tile_reached");
+    for(i=lowest; i<=highest; i++){
+        printf(" %u:%.2f%%",1U<<i,100.0*reached/games);
+        reached-=total->rank[i];
+    }
+    printf("\n");
+    printf("tile_final");
+    for(i=1; i<STATS_RANK_COUNT; i++){
+        if(total->rank[i]>0){
+            printf(" %u:%.2f%%",1U<<i,100.0*total->rank[i]/games);
+        }
+    }
+    printf("\n");
+    printf("final_empty %.2f\n",(double)total->empty_sum/games);
+    printf("final_distinct_tiles %.2f\n",(double)total->distinct_sum/games);
+    printf("final_max_corner %.2f%%\n",100.0*total->max_corner/games);
+    printf("final_max_edge %.2f%%\n",100.0*total->max_edge/games);
+}
+
+int analyze_log(const analyze_param_t *param)
+{
+    struct timespec t0,t1;
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    int fd=open(param->log_path,O_RDONLY);
+    if(fd<0){
+        fprintf(stderr,"Failed to open %s: %s.\n",param->log_path,strerror(errno));
+        return E_FILEIO;
+    }
+    struct stat st;
+    if(fstat(fd,&st)!=0){
+        fprintf(stderr,"Failed to read %s: %s.\n",param->log_path,strerror(errno));
+        close(fd);
+        return E_FILEIO;
+    }
+    uint64_t size=st.st_size;
+    const char *data=NULL;
+    if(size>0){
+        data=(const char*)mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    }
+    close(fd);
+    if(MAP_FAILED==data){
+        fprintf(stderr,"Failed to map %s: %s.\n",param->log_path,strerror(errno));
+        return E_FILEIO;
+    }
+    if(NULL!=data){
+        madvise((void*)data,size,MADV_SEQUENTIAL);
+    }
+    // A rotated segment is read by record, its window applies to the records
+    logseg_t seg;
+    bool segment=logseg_detect(data,size);
+    uint64_t first=0,last=size;
+    if(segment){
+        if(logseg_map(&seg,data,size)!=E_OK){
+            fprintf(stderr,"Invalid log segment %s.\n",param->log_path);
+            munmap((void*)data,size);
+            return E_INVAL;
+        }
+        first=seg.records-seg.data;
+        last=seg.records_end-seg.data;
+    }
+    uint64_t from=max(min(param->from,last),first);
+    uint64_t to=max(min(param->to,last),first);
+    if(from>to){
+        if(NULL!=data){
+            munmap((void*)data,size);
+        }
+        return E_INVAL;
+    }
+
+    uint16_t thread_count=param->thread_count;
+    if(thread_count==0){
+        thread_count=max(sysconf(_SC_NPROCESSORS_ONLN),1);
+    }
+    // Small windows are not worth a thread each
+    thread_count=max(min((uint64_t)thread_count,(to-from)/(1<<20)),1);
+    analyze_part_t *parts=(analyze_part_t*)calloc(thread_count+1,sizeof(analyze_part_t));
+    if(NULL==parts){
+        if(NULL!=data){
+            munmap((void*)data,size);
+        }
+        return E_NOSPACE;
+    }
+    analyze_part_t *total=&parts[thread_count];
+    const char *data_end=data+size;
+    void *(*part_main)(void*)=segment ? analyze_segment_main : analyze_main;
+    uint16_t i;
+    for(i=0; i<thread_count; i++){
+        analyze_part_t *part=&parts[i];
+        part->begin=data+from+(to-from)*i/thread_count;
+        part->end=data+from+(to-from)*(i+1)/thread_count;
+        if(!segment){
+            part->begin=line_start(data,part->begin,data_end);
+            part->end=line_start(data,part->end,data_end);
+        }
+        part->data_end=data_end;
+        part->seg=segment ? &seg : NULL;
+        if(i>0 && pthread_create(&part->tid,NULL,part_main,part)!=0){
+            part->tid=0;
+            part_main(part);
+        }
+    }
+    part_main(&parts[0]);
+    for(i=0; i<thread_count; i++){
+        if(i>0 && parts[i].tid!=0){
+            pthread_join(parts[i].tid,NULL);
+        }
+        merge_part(total,&parts[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+
+    print_report(total);
+    double elapsed=stats_elapsed_usec(&t0,&t1)/1e6;
+    fprintf(stderr,"Analyzed %.2f GB in %.2f s, %.2f GB/s on %u threads.\n",(to-from)/1e9,elapsed,
+        elapsed>0 ? (to-from)/1e9/elapsed : 0.0,thread_count);
+    free(parts);
+    if(NULL!=data){
+        munmap((void*)data,size);
+    }
+    return E_OK;
+}
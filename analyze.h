@@ -0,0 +1,23 @@
+#ifndef __analyze_h__
+#define __analyze_h__
+
+#include <stdint.h>
+#include "util.h"
+
+/* Offline statistics of a daemon log: score and move count percentiles, how
+ * often each tile was reached, and what the final boards look like. The log
+ * is mapped and split over threads on line boundaries. Rotated segments
+ * (logseg.h) are read too, each thread decoding from the block before its
+ * share. Games are logged in the order they end, so a byte window of the log
+ * is a window in time. */
+
+typedef struct{
+    const char *log_path;
+    uint64_t from;          // only the lines or records starting in [from,to)
+    uint64_t to;            // UINT64_MAX for the end of the log
+    uint16_t thread_count;  // 0 for one per CPU
+}analyze_param_t;
+
+int analyze_log(const analyze_param_t *param);
+
+#endif
@@ -0,0 +1,140 @@
+/* Table-free move execution over many boards at once.
+ *
+ * Rows are processed in 16-bit vector lanes, eight rows (two boards) per 16
+ * bytes, with the slide and merge done by nibble arithmetic on all lanes in
+ * parallel instead of row table lookups. Columns are handled by transposing
+ * the boards in 64-bit lanes with the same bit tricks as transpose(). The
+ * kernel is written with GCC vector extensions, so it compiles to SSE2/AVX2
+ * on x86 and to NEON on ARM; the widest variant the CPU supports is picked at
+ * run time. */
+
+#include <string.h>
+#include "2048.h"
+
+// The vector helpers are always inlined, their by-value vector ABI never matters
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+typedef uint16_t v16u16 __attribute__((vector_size(32)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+#define BATCH_ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Nibble `i` of every lane
+template <typename V>
+static BATCH_ALWAYS_INLINE V nibble(V r, int i) {
+    return (r >> (4 * i)) & 0xf;
+}
+// Drop nibble `i` where `cond` is set, moving the nibbles above it down
+template <typename V>
+static BATCH_ALWAYS_INLINE V drop_nibble(V r, int i, V cond) {
+    const uint16_t low = (1U << (4 * i)) - 1;
+    V dropped = (r & low) | ((r >> 4) & (uint16_t)~low);
+    return (dropped & cond) | (r & ~cond);
+}
+// Move every row left (towards nibble 0), the same as row_left_table
+template <typename V>
+static BATCH_ALWAYS_INLINE V move_rows_left(V r) {
+    // Slide the tiles over the empty cells
+    r = drop_nibble(r, 0, (V)(nibble(r, 0) == 0));
+    r = drop_nibble(r, 0, (V)(nibble(r, 0) == 0));
+    r = drop_nibble(r, 0, (V)(nibble(r, 0) == 0));
+    r = drop_nibble(r, 1, (V)(nibble(r, 1) == 0));
+    r = drop_nibble(r, 1, (V)(nibble(r, 1) == 0));
+    r = drop_nibble(r, 2, (V)(nibble(r, 2) == 0));
+    // Merge equal neighbours from the left, 32768 + 32768 stays 32768
+    for (int i = 0; i < 3; i++) {
+        V a = nibble(r, i), b = nibble(r, i + 1);
+        V merge = (V)((a == b) & (a != 0));
+        V inc = (V)(a != 0xf) & (uint16_t)(1U << (4 * i));
+        r = drop_nibble(r + (inc & merge), i + 1, merge);
+    }
+    return r;
+}
+template <typename V>
+static BATCH_ALWAYS_INLINE V reverse_rows(V r) {
+    r = ((r & 0x0f0f) << 4) | ((r >> 4) & 0x0f0f);
+    return (r << 8) | (r >> 8);
+}
+template <typename U>
+static BATCH_ALWAYS_INLINE U transpose_lanes(U x) {
+    U a1 = x & 0xF0F00F0FF0F00F0FULL;
+    U a2 = x & 0x0000F0F00000F0F0ULL;
+    U a3 = x & 0x0F0F00000F0F0000ULL;
+    U a = a1 | (a2 << 12) | (a3 >> 12);
+    U b1 = a & 0xFF00FF0000FF00FFULL;
+    U b2 = a & 0x00FF00FF00000000ULL;
+    U b3 = a & 0x00000000FF00FF00ULL;
+    return b1 | (b2 >> 24) | (b3 << 24);
+}
+template <typename V, typename U>
+static BATCH_ALWAYS_INLINE U move_lanes(int move, U boards) {
+    switch (move) {
+        case 0: // up
+            return transpose_lanes(
+                (U)move_rows_left((V)transpose_lanes(boards)));
+        case 1: // down
+            return transpose_lanes(
+                (U)reverse_rows(move_rows_left(reverse_rows((V)transpose_lanes(boards)))));
+        case 2: // left
+            return (U)move_rows_left((V)boards);
+        case 3: // right
+            return (U)reverse_rows(move_rows_left(reverse_rows((V)boards)));
+        default:
+            return ~(U){};
+    }
+}
+template <typename V, typename U>
+static BATCH_ALWAYS_INLINE void move_batch(int move, const board_t *boards, board_t *results, size_t count) {
+    const size_t lanes = sizeof(U) / sizeof(board_t);
+    size_t i = 0;
+    for (; i + lanes <= count; i += lanes) {
+        U x;
+        memcpy(&x, boards + i, sizeof(x));
+        x = move_lanes<V, U>(move, x);
+        memcpy(results + i, &x, sizeof(x));
+    }
+    if (i < count) {
+        // Empty boards pad the last vector, they stay empty
+        U x = {};
+        memcpy(&x, boards + i, (count - i) * sizeof(board_t));
+        x = move_lanes<V, U>(move, x);
+        memcpy(results + i, &x, (count - i) * sizeof(board_t));
+    }
+}
+
+static void move_batch_128(int move, const board_t *boards, board_t *results, size_t count) {
+    move_batch<v8u16, v2u64>(move, boards, results, count);
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void move_batch_avx2(int move, const board_t *boards, board_t *results, size_t count) {
+    move_batch<v16u16, v4u64>(move, boards, results, count);
+}
+#endif
+
+typedef void (*move_batch_fn)(int, const board_t *, board_t *, size_t);
+static move_batch_fn select_kernel(const char **name) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return move_batch_avx2;
+    }
+    *name = "sse2";
+#else
+    *name = "vector";
+#endif
+    return move_batch_128;
+}
+static const char *kernel_name;
+static const move_batch_fn kernel = select_kernel(&kernel_name);
+
+/* Execute `move` on `count` boards. The results are the same as those of
+ * execute_move(), without touching the move tables. */
+void execute_move_batch(int move, const board_t *boards, board_t *results, size_t count) {
+    kernel(move, boards, results, count);
+}
+const char *execute_move_batch_isa(void) {
+    return kernel_name;
+}
@@ -0,0 +1,718 @@
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "2048.h"
+#include "game.h"
+#include "affinity.h"
+#include "scheduler.h"
+
+/* Throughput benchmark. Plays seeded games on a number of game threads for a
+ * fixed time under each requested placement policy and page size and reports
+ * moves and search nodes per second, along with the dTLB load misses per
+ * thousand search nodes when perf events are available. With -j the searches
+ * run on the shared scheduler instead of per-game helper threads. With -w the
+ * games play on the wide board engine of games past 32768 from the start, with
+ * -g on boards of other sizes; each size is reported on its own.
+ *
+ * With -k it compares the move kernels instead: execute_move() through the
+ * move tables against the table-free execute_move_batch(), on 1, 2, 4, ...
+ * threads up to the thread count, where the tables compete for cache.
+ *
+ * With -e it measures playing strength instead of speed: a fixed set of
+ * seeded games is played one after another as the daemon plays them, each
+ * stopped after a budget of CPU seconds, and the win rates, mean score and
+ * CPU seconds per game are printed as JSON. Games run one at a time because
+ * the search threads of a move cannot be told apart by game, and process CPU
+ * time counts them all. With -B the result is compared against a stored one,
+ * and a drop in strength beyond the tolerance fails the run. */
+
+#define BENCH_SEED (2048)
+
+typedef struct{
+    pthread_t tid;
+    uint16_t index;
+    bool wide;
+    int size;
+    search_sched_t *sched;
+    table_data_t *table;
+    uint32_t seed;
+    int node;
+    cpu_set_t cpuset;
+    volatile bool *running;
+    uint64_t moves;
+    uint64_t nodes;
+    uint64_t games;
+}bench_thread_t;
+
+// Start the game of `seed` on the board the thread benchmarks
+static void new_bench_game(bench_thread_t *bench, uint32_t seed, rand_t *rand, board_t *board,
+    wide_board_t *wide_board, square_board_t *square_board)
+{
+    initRandom(rand,seed);
+    if(bench->size!=4){
+        *square_board=new_square_board(rand,bench->size);
+    }else{
+        *board=new_board(rand);
+        *wide_board=wide_from_board(*board);
+    }
+}
+static void* bench_main(void *data)
+{
+    bench_thread_t *bench=(bench_thread_t*)data;
+    rand_t rand;
+    board_t board=0;
+    wide_board_t wide_board;
+    square_board_t square_board=0;
+    new_bench_game(bench,bench->seed,&rand,&board,&wide_board,&square_board);
+    while(*(bench->running)){
+        search_stats_t stats;
+        int move;
+        if(bench->size!=4){
+            move=find_best_move_square(bench->size,square_board,&stats,NULL);
+        }else if(bench->wide){
+            move=find_best_move_wide(bench->table,wide_board,&stats,NULL);
+        }else if(NULL!=bench->sched){
+            move=sched_find_best_move(bench->sched,bench->index,bench->node,bench->table,board,&stats,NULL);
+        }else{
+            move=find_best_move(bench->table,board,&stats);
+        }
+        if(move<0){
+            bench->games++;
+            new_bench_game(bench,bench->seed+bench->games,&rand,&board,&wide_board,&square_board);
+            continue;
+        }
+        if(bench->size!=4){
+            square_board=execute_move_square(bench->size,move,square_board);
+            square_board=square_insert_tile_rand(&rand,bench->size,square_board,draw_tile(&rand));
+        }else if(bench->wide){
+            wide_board=wide_execute_move(bench->table,move,wide_board);
+            wide_board=wide_insert_tile_rand(&rand,wide_board,draw_tile(&rand));
+        }else{
+            board=execute_move(bench->table,move,board);
+            board=insert_tile_rand(&rand,board,draw_tile(&rand));
+        }
+        bench->moves++;
+        bench->nodes+=stats.moves_evaled;
+    }
+    return NULL;
+}
+
+#define KERNEL_BOARDS (4096)
+
+typedef struct{
+    pthread_t tid;
+    table_data_t *table;
+    bool batch;
+    volatile bool *running;
+    uint64_t moves;
+}kernel_thread_t;
+
+static void* kernel_main(void *data)
+{
+    kernel_thread_t *kernel=(kernel_thread_t*)data;
+    board_t *boards=(board_t*)malloc(sizeof(board_t)*KERNEL_BOARDS*2);
+    if(NULL==boards){
+        return NULL;
+    }
+    board_t *results=boards+KERNEL_BOARDS;
+    board_t sink=0;
+    int i,move;
+    rand_t rand;
+    initRandom(&rand,BENCH_SEED);
+    for(i=0; i<KERNEL_BOARDS; i++){
+        // Boards of a game in progress: mostly small tiles, some empty cells
+        board_t board=0;
+        int cell;
+        for(cell=0; cell<16; cell++){
+            uint32_t r=getRandom(&rand);
+            board|=(board_t)((r%4==0) ? 0 : 1+(r>>8)%11)<<(4*cell);
+        }
+        boards[i]=board;
+    }
+    while(*(kernel->running)){
+        for(move=0; move<4; move++){
+            if(kernel->batch){
+                execute_move_batch(move,boards,results,KERNEL_BOARDS);
+            }else{
+                for(i=0; i<KERNEL_BOARDS; i++){
+                    results[i]=execute_move(kernel->table,move,boards[i]);
+                }
+            }
+            sink^=results[move];
+        }
+        kernel->moves+=4*KERNEL_BOARDS;
+    }
+    boards[0]=sink;
+    free(boards);
+    return NULL;
+}
+static double run_kernel(table_data_t *table, bool batch, uint16_t thread_count, unsigned int seconds)
+{
+    kernel_thread_t *threads=(kernel_thread_t*)calloc(thread_count,sizeof(kernel_thread_t));
+    volatile bool running=true;
+    uint16_t i;
+    if(NULL==threads){
+        return 0;
+    }
+    struct timespec t0,t1;
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    for(i=0; i<thread_count; i++){
+        threads[i].table=table;
+        threads[i].batch=batch;
+        threads[i].running=&running;
+        pthread_create(&threads[i].tid,NULL,kernel_main,&threads[i]);
+    }
+    sleep(seconds);
+    running=false;
+    uint64_t moves=0;
+    for(i=0; i<thread_count; i++){
+        pthread_join(threads[i].tid,NULL);
+        moves+=threads[i].moves;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    free(threads);
+    return moves/((t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9);
+}
+static void compare_kernels(uint16_t max_threads, unsigned int seconds)
+{
+    table_data_t *table=alloc_node_tables(NULL,-1,true);
+    uint16_t thread_count;
+    if(NULL==table){
+        return;
+    }
+    printf("# batch kernel: %s\n",execute_move_batch_isa());
+    printf("%8s %14s %14s %8s\n","threads","table moves/s","batch moves/s","speedup");
+    for(thread_count=1; ; thread_count=min(thread_count*2,max_threads)){
+        double table_rate=run_kernel(table,false,thread_count,seconds);
+        double batch_rate=run_kernel(table,true,thread_count,seconds);
+        printf("%8u %14.0f %14.0f %8.2f\n",thread_count,table_rate,batch_rate,batch_rate/table_rate);
+        fflush(stdout);
+        if(thread_count==max_threads){
+            break;
+        }
+    }
+    free_node_tables(table);
+}
+
+#define STRENGTH_TILES (4)
+#define STRENGTH_DEFAULT_BUDGET (60)
+#define STRENGTH_DEFAULT_TOLERANCE (2.0)
+
+typedef struct{
+    uint64_t seed;
+    uint32_t moves;
+    uint32_t score;
+    uint32_t max_tile;
+    double cpu_seconds;
+    uint64_t nodes;
+    bool finished;          // lost before running out of budget
+}strength_game_t;
+
+static double process_cpu_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&t);
+    return t.tv_sec+t.tv_nsec/1e9;
+}
+// Play the game of `seed` as the daemon would until it ends or uses up `budget`
+static void play_strength_game(table_data_t *table, strength_game_t *game, double budget)
+{
+    rand_t rand;
+    initRandom(&rand,game->seed);
+    board_t board=new_board(&rand);
+    bool wide=false;
+    wide_board_t wide_board;
+    uint32_t scoreoffset=0;
+    double start=process_cpu_seconds();
+    while(true){
+        if(!wide && get_max_rank(board)>=WIDE_SWITCH_RANK){
+            wide=true;
+            wide_board=wide_from_board(board);
+        }
+        game->cpu_seconds=process_cpu_seconds()-start;
+        if(game->cpu_seconds>=budget){
+            break;
+        }
+        search_stats_t stats;
+        int move=wide ? find_best_move_wide(table,wide_board,&stats,NULL) : find_best_move(table,board,&stats);
+        if(move<0){
+            game->finished=true;
+            break;
+        }
+        board_t tile=draw_tile(&rand);
+        if(wide){
+            wide_board=wide_insert_tile_rand(&rand,wide_execute_move(table,move,wide_board),tile);
+            board=wide_to_board(wide_board);
+        }else{
+            board=insert_tile_rand(&rand,execute_move(table,move,board),tile);
+        }
+        game->moves++;
+        game->nodes+=stats.moves_evaled;
+        if(tile==2){
+            scoreoffset+=4;
+        }
+    }
+    game->score=game_score(table,board,wide,wide_board,scoreoffset);
+    game->max_tile=1U<<game_max_rank(board,wide,wide_board);
+}
+
+static const uint32_t strength_tiles[STRENGTH_TILES]={2048,4096,8192,16384};
+
+typedef struct{
+    double games;
+    double cpu_budget;
+    double finished;
+    double win[STRENGTH_TILES];
+    double score_mean;
+    double moves_mean;
+    double cpu_seconds_per_game;
+    double score_per_cpu_second;
+    double nodes_per_cpu_second;
+}strength_summary_t;
+
+static void summarize_strength(const strength_game_t *games, uint32_t count, double budget, strength_summary_t *sum)
+{
+    uint32_t i;
+    int t;
+    double cpu=0,nodes=0;
+    memset(sum,0,sizeof(*sum));
+    sum->games=count;
+    sum->cpu_budget=budget;
+    for(i=0; i<count; i++){
+        sum->finished+=games[i].finished;
+        for(t=0; t<STRENGTH_TILES; t++){
+            sum->win[t]+=(games[i].max_tile>=strength_tiles[t]);
+        }
+        sum->score_mean+=games[i].score;
+        sum->moves_mean+=games[i].moves;
+        cpu+=games[i].cpu_seconds;
+        nodes+=games[i].nodes;
+    }
+    for(t=0; t<STRENGTH_TILES; t++){
+        sum->win[t]/=count;
+    }
+    sum->score_per_cpu_second=(cpu>0) ? sum->score_mean/cpu : 0;
+    sum->nodes_per_cpu_second=(cpu>0) ? nodes/cpu : 0;
+    sum->score_mean/=count;
+    sum->moves_mean/=count;
+    sum->cpu_seconds_per_game=cpu/count;
+}
+static void print_strength(const strength_game_t *games, uint32_t count, const strength_summary_t *sum)
+{
+    uint32_t i;
+    int t;
+    printf("{\n");
+    printf("  \"games\": %.0f,\n",sum->games);
+    printf("  \"cpu_budget\": %.1f,\n",sum->cpu_budget);
+    printf("  \"finished\": %.0f,\n",sum->finished);
+    for(t=0; t<STRENGTH_TILES; t++){
+        printf("  \"win_%u\": %.4f,\n",strength_tiles[t],sum->win[t]);
+    }
+    printf("  \"score_mean\": %.1f,\n",sum->score_mean);
+    printf("  \"moves_mean\": %.1f,\n",sum->moves_mean);
+    printf("  \"cpu_seconds_per_game\": %.3f,\n",sum->cpu_seconds_per_game);
+    printf("  \"score_per_cpu_second\": %.1f,\n",sum->score_per_cpu_second);
+    printf("  \"nodes_per_cpu_second\": %.0f,\n",sum->nodes_per_cpu_second);
+    printf("  \"game_list\": [\n");
+    for(i=0; i<count; i++){
+        const strength_game_t *game=&games[i];
+        printf("    {\"seed\": \"%016llx\", \"moves\": %u, \"score\": %u, \"max_tile\": %u, "
+            "\"cpu_seconds\": %.3f, \"finished\": %s}%s\n",(unsigned long long)game->seed,game->moves,
+            game->score,game->max_tile,game->cpu_seconds,game->finished ? "true" : "false",(i+1<count) ? "," : "");
+    }
+    printf("  ]\n}\n");
+    fflush(stdout);
+}
+// The number after "key": in a result printed by print_strength()
+static bool json_number(const char *json, const char *key, double *value)
+{
+    char pattern[64];
+    snprintf(pattern,sizeof(pattern),"\"%s\":",key);
+    const char *p=strstr(json,pattern);
+    if(NULL==p){
+        return false;
+    }
+    char *end;
+    *value=strtod(p+strlen(pattern),&end);
+    return end!=p+strlen(pattern);
+}
+static int read_strength(const char *path, strength_summary_t *sum)
+{
+    FILE *fp=fopen(path,"r");
+    if(NULL==fp){
+        fprintf(stderr,"Failed to open %s.\n",path);
+        return E_FILEIO;
+    }
+    static char json[1<<20];
+    size_t len=fread(json,1,sizeof(json)-1,fp);
+    fclose(fp);
+    json[len]='\0';
+    char key[32];
+    int t;
+    bool valid=json_number(json,"games",&sum->games) && json_number(json,"cpu_budget",&sum->cpu_budget) &&
+        json_number(json,"finished",&sum->finished) && json_number(json,"score_mean",&sum->score_mean) &&
+        json_number(json,"moves_mean",&sum->moves_mean) &&
+        json_number(json,"cpu_seconds_per_game",&sum->cpu_seconds_per_game) &&
+        json_number(json,"score_per_cpu_second",&sum->score_per_cpu_second) &&
+        json_number(json,"nodes_per_cpu_second",&sum->nodes_per_cpu_second);
+    for(t=0; t<STRENGTH_TILES; t++){
+        snprintf(key,sizeof(key),"win_%u",strength_tiles[t]);
+        valid=valid && json_number(json,key,&sum->win[t]);
+    }
+    if(!valid){
+        fprintf(stderr,"Invalid baseline %s.\n",path);
+        return E_INVAL;
+    }
+    return E_OK;
+}
+/* Print the change from the baseline. Strength regressed when a win rate
+ * fell by more than `tolerance` percentage points, or the mean score by
+ * more than `tolerance` percent. */
+static bool compare_strength(const strength_summary_t *base, const strength_summary_t *sum, double tolerance)
+{
+    bool regressed=false;
+    int t;
+    if(base->games!=sum->games || base->cpu_budget!=sum->cpu_budget){
+        fprintf(stderr,"Baseline played %.0f games of %.1f CPU seconds, not comparable.\n",base->games,base->cpu_budget);
+        return true;
+    }
+    fprintf(stderr,"%-22s %12s %12s %9s\n","metric","baseline","current","change");
+    for(t=0; t<STRENGTH_TILES; t++){
+        char name[32];
+        snprintf(name,sizeof(name),"win_%u",strength_tiles[t]);
+        double change=100*(sum->win[t]-base->win[t]);
+        fprintf(stderr,"%-22s %11.2f%% %11.2f%% %+8.2fpt\n",name,100*base->win[t],100*sum->win[t],change);
+        regressed=regressed || change<-tolerance;
+    }
+    const char *names[5]={"score_mean","moves_mean","cpu_seconds_per_game","score_per_cpu_second","nodes_per_cpu_second"};
+    double bases[5]={base->score_mean,base->moves_mean,base->cpu_seconds_per_game,base->score_per_cpu_second,
+        base->nodes_per_cpu_second};
+    double values[5]={sum->score_mean,sum->moves_mean,sum->cpu_seconds_per_game,sum->score_per_cpu_second,
+        sum->nodes_per_cpu_second};
+    int i;
+    for(i=0; i<5; i++){
+        double change=(bases[i]>0) ? 100*(values[i]/bases[i]-1) : 0;
+        fprintf(stderr,"%-22s %12.1f %12.1f %+8.2f%%\n",names[i],bases[i],values[i],change);
+        if(i==0){
+            regressed=regressed || change<-tolerance;
+        }
+    }
+    fprintf(stderr,"%s\n",regressed ? "Strength regressed." : "No strength regression.");
+    return regressed;
+}
+static int run_strength(uint32_t count, double budget, const char *baseline, double tolerance)
+{
+    table_data_t *table=alloc_node_tables(NULL,-1,true);
+    strength_game_t *games=(strength_game_t*)calloc(count,sizeof(strength_game_t));
+    strength_summary_t base,sum;
+    uint32_t i;
+    if(NULL==table || NULL==games || (NULL!=baseline && read_strength(baseline,&base)!=E_OK)){
+        free(games);
+        free_node_tables(table);
+        return 1;
+    }
+    for(i=0; i<count; i++){
+        strength_game_t *game=&games[i];
+        game->seed=BENCH_SEED+i;
+        play_strength_game(table,game,budget);
+        fprintf(stderr,"game %u/%u: %u moves, score %u, max tile %u, %.1f CPU s%s\n",i+1,count,game->moves,
+            game->score,game->max_tile,game->cpu_seconds,game->finished ? "" : ", out of budget");
+    }
+    summarize_strength(games,count,budget,&sum);
+    print_strength(games,count,&sum);
+    bool regressed=(NULL!=baseline && compare_strength(&base,&sum,tolerance));
+    free(games);
+    free_node_tables(table);
+    return regressed ? 1 : 0;
+}
+
+static const char *page_names[2]={"4k","huge"};
+
+/* Count dTLB load misses of the calling thread and of every thread it starts
+ * afterwards. The counts of a started thread are added once it has exited. */
+static int open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=PERF_TYPE_HW_CACHE;
+    attr.config=PERF_COUNT_HW_CACHE_DTLB|(PERF_COUNT_HW_CACHE_OP_READ<<8)|
+        (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+    attr.disabled=1;
+    attr.inherit=1;
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    return syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+}
+
+static int run_policy(const cpu_topology_t *topology, int policy, bool huge_pages,
+    uint16_t sched_threads, int sched_policy, bool wide, int size, uint16_t thread_count, unsigned int seconds)
+{
+    bench_thread_t *threads=(bench_thread_t*)calloc(thread_count,sizeof(bench_thread_t));
+    table_data_t *node_tables[MAX_NUMA_NODES]={NULL};
+    volatile bool running=true;
+    uint16_t i;
+    if(NULL==threads){
+        return E_NOSPACE;
+    }
+    table_data_t *shared_table=alloc_node_tables(topology,-1,huge_pages);
+    if(NULL==shared_table){
+        free(threads);
+        return E_NOSPACE;
+    }
+    // Threads started from here on are counted, the scheduler threads included
+    int counter=open_dtlb_counter();
+    if(counter>=0){
+        ioctl(counter,PERF_EVENT_IOC_ENABLE,0);
+    }
+    search_sched_t *sched=NULL;
+    if(sched_threads>0){
+        sched=sched_start(sched_threads,sched_policy,topology,policy);
+    }
+    for(i=0; i<thread_count; i++){
+        bench_thread_t *bench=&threads[i];
+        bench->index=i;
+        bench->wide=wide;
+        bench->size=size;
+        bench->sched=sched;
+        bench->seed=BENCH_SEED+i*1000;
+        bench->running=&running;
+        bench->table=shared_table;
+        bench->node=placement_cpuset(topology,policy,i,thread_count,&bench->cpuset);
+        if(bench->node>=0){
+            if(NULL==node_tables[bench->node]){
+                node_tables[bench->node]=alloc_node_tables(topology,bench->node,huge_pages);
+            }
+            if(NULL!=node_tables[bench->node]){
+                bench->table=node_tables[bench->node];
+            }
+        }
+    }
+
+    struct timespec t0,t1;
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    for(i=0; i<thread_count; i++){
+        bench_thread_t *bench=&threads[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if(bench->node>=0){
+            pthread_attr_setaffinity_np(&attr,sizeof(bench->cpuset),&bench->cpuset);
+        }
+        pthread_create(&bench->tid,&attr,bench_main,bench);
+        pthread_attr_destroy(&attr);
+    }
+    sleep(seconds);
+    running=false;
+    uint64_t moves=0,nodes=0,games=0;
+    for(i=0; i<thread_count; i++){
+        pthread_join(threads[i].tid,NULL);
+        moves+=threads[i].moves;
+        nodes+=threads[i].nodes;
+        games+=threads[i].games;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    sched_stop(sched);
+    double elapsed=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+    char dtlb[32]="-";
+    uint64_t misses;
+    if(counter>=0){
+        if(read(counter,&misses,sizeof(misses))==sizeof(misses) && nodes>0){
+            snprintf(dtlb,sizeof(dtlb),"%.3f",misses*1000.0/nodes);
+        }
+        close(counter);
+    }
+    printf("%-10s %5s %8u %8llu %10llu %12.1f %14.0f %12s\n",placement_name(policy),
+        page_names[huge_pages],thread_count,(unsigned long long)games,(unsigned long long)moves,
+        moves/elapsed,nodes/elapsed,dtlb);
+    fflush(stdout);
+
+    for(i=0; i<MAX_NUMA_NODES; i++){
+        free_node_tables(node_tables[i]);
+    }
+    free_node_tables(shared_table);
+    free(threads);
+    return E_OK;
+}
+
+static void print_help(const char *app_name)
+{
+    fprintf(stderr,"Usage: %s [-h] [-t threads] [-s seconds] [-p placement[,placement...]] [-P pages[,pages...]]\n"
+        "       [-j threads] [-S policy] [-k] [-w] [-g size[,size...]]\n"
+        "       %s -e games [-c seconds] [-B baseline] [-x tolerance]\n",app_name,app_name);
+    fprintf(stderr,"       -h            Print help.\n");
+    fprintf(stderr,"       -t threads    Number of concurrent games, defaults to CPU count / 4.\n");
+    fprintf(stderr,"       -s seconds    Duration of each run, defaults to 10.\n");
+    fprintf(stderr,"       -p placement  Placement policies to compare, defaults to all.\n");
+    fprintf(stderr,"       -P pages      Move table page sizes to compare, 4k and/or huge, defaults to both.\n");
+    fprintf(stderr,"       -j threads    Run the searches on a shared scheduler with this many threads.\n");
+    fprintf(stderr,"       -S policy     Scheduler policy: sjf (default) or fair.\n");
+    fprintf(stderr,"       -k            Compare the table and batch move kernels instead of playing.\n");
+    fprintf(stderr,"       -w            Play on the wide board engine of games past 32768.\n");
+    fprintf(stderr,"       -g size       Board sizes to compare, %u to %u, defaults to 4.\n",SQUARE_MIN_SIZE,SQUARE_MAX_SIZE);
+    fprintf(stderr,"       -e games      Measure playing strength on this many seeded games, printed as JSON.\n");
+    fprintf(stderr,"       -c seconds    CPU seconds each strength game may use, defaults to %u.\n",STRENGTH_DEFAULT_BUDGET);
+    fprintf(stderr,"       -B baseline   Compare with the JSON of an earlier strength run, fail on a regression.\n");
+    fprintf(stderr,"       -x tolerance  Allowed drop of win rates in points and of the mean score in percent, defaults to %g.\n",
+        STRENGTH_DEFAULT_TOLERANCE);
+}
+int main(int argc, char *argv[])
+{
+    cpu_topology_t topology;
+    if(topology_read(&topology)!=E_OK){
+        return 1;
+    }
+    uint16_t thread_count=max(topology.cpu_count/4,1);
+    unsigned int seconds=10;
+    bool policies[PLACEMENT_COUNT]={true,true,true,true};
+    bool pages[2]={true,true};
+    uint16_t sched_threads=0;
+    int sched_policy=SCHED_SJF;
+    bool kernels=false;
+    bool wide=false;
+    bool sizes[SQUARE_MAX_SIZE+1]={false};
+    bool sized=false;
+    uint32_t strength_games=0;
+    double strength_budget=STRENGTH_DEFAULT_BUDGET,tolerance=STRENGTH_DEFAULT_TOLERANCE;
+    const char *baseline=NULL;
+    int opt,i,size;
+    sizes[4]=true;
+    while((opt=getopt(argc,argv,"ht:s:p:P:j:S:kwg:e:c:B:x:"))!=-1){
+        switch(opt){
+            case 'e':
+                strength_games=strtoul(optarg,NULL,10);
+                if(strength_games<1){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'c':
+                strength_budget=strtod(optarg,NULL);
+                if(strength_budget<=0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'B':
+                baseline=optarg;
+            break;
+            case 'x':
+                tolerance=strtod(optarg,NULL);
+            break;
+            case 't':
+                thread_count=strtoul(optarg,NULL,10);
+            break;
+            case 's':
+                seconds=strtoul(optarg,NULL,10);
+            break;
+            case 'k':
+                kernels=true;
+            break;
+            case 'w':
+                wide=true;
+            break;
+            case 'g':{
+                char *list=strdup(optarg),*saveptr=NULL,*name;
+                memset(sizes,0,sizeof(sizes));
+                sized=true;
+                for(name=strtok_r(list,",",&saveptr); name!=NULL; name=strtok_r(NULL,",",&saveptr)){
+                    size=strtol(name,NULL,10);
+                    if(size<SQUARE_MIN_SIZE || size>SQUARE_MAX_SIZE){
+                        print_help(argv[0]);
+                        return 1;
+                    }
+                    sizes[size]=true;
+                }
+                free(list);
+            }
+            break;
+            case 'j':
+                sched_threads=strtoul(optarg,NULL,10);
+            break;
+            case 'S':
+                sched_policy=sched_parse(optarg);
+                if(sched_policy<0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'P':{
+                char *list=strdup(optarg),*saveptr=NULL,*name;
+                memset(pages,0,sizeof(pages));
+                for(name=strtok_r(list,",",&saveptr); name!=NULL; name=strtok_r(NULL,",",&saveptr)){
+                    if(strcmp(name,page_names[0])==0){
+                        pages[0]=true;
+                    }else if(strcmp(name,page_names[1])==0){
+                        pages[1]=true;
+                    }else{
+                        print_help(argv[0]);
+                        return 1;
+                    }
+                }
+                free(list);
+            }
+            break;
+            case 'p':{
+                char *list=strdup(optarg),*saveptr=NULL,*name;
+                memset(policies,0,sizeof(policies));
+                for(name=strtok_r(list,",",&saveptr); name!=NULL; name=strtok_r(NULL,",",&saveptr)){
+                    int policy=placement_parse(name);
+                    if(policy<0){
+                        print_help(argv[0]);
+                        return 1;
+                    }
+                    policies[policy]=true;
+                }
+                free(list);
+            }
+            break;
+            default:
+                print_help(argv[0]);
+                return 1;
+        }
+    }
+    if(thread_count<1 || seconds<1){
+        print_help(argv[0]);
+        return 1;
+    }
+    if(strength_games>0){
+        topology_free(&topology);
+        return run_strength(strength_games,strength_budget,baseline,tolerance);
+    }
+
+    printf("# %u CPUs on %u nodes\n",topology.cpu_count,topology.node_count);
+    if(kernels){
+        compare_kernels(thread_count,seconds);
+        topology_free(&topology);
+        return 0;
+    }
+    if(wide){
+        printf("# wide board engine\n");
+    }else if(sched_threads>0){
+        printf("# %s scheduler with %u threads\n",sched_name(sched_policy),sched_threads);
+    }
+    for(size=SQUARE_MIN_SIZE; size<=SQUARE_MAX_SIZE; size++){
+        if(!sizes[size]){
+            continue;
+        }
+        if(sized){
+            printf("# %ux%u board\n",size,size);
+        }
+        printf("%-10s %5s %8s %8s %10s %12s %14s %12s\n","placement","pages","threads","games","moves",
+            "moves/s","nodes/s","dtlb/knode");
+        for(i=0; i<PLACEMENT_COUNT; i++){
+            int huge;
+            for(huge=0; huge<2; huge++){
+                if(policies[i] && pages[huge]){
+                    run_policy(&topology,i,huge,sched_threads,sched_policy,wide,size,thread_count,seconds);
+                }
+            }
+        }
+    }
+    topology_free(&topology);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "book.h"
+
+int book_open(book_t *book, const char *path)
+{
+    memset(book,0,sizeof(*book));
+    int fd=open(path,O_RDONLY);
+    if(fd<0){
+        fprintf(stderr,"Failed to open book %s: %s.\n",path,strerror(errno));
+        return E_FILEIO;
+    }
+    struct stat st;
+    if(fstat(fd,&st)!=0 || (size_t)st.st_size<sizeof(book_header_t)){
+        fprintf(stderr,"Invalid book %s.\n",path);
+        close(fd);
+        return E_INVAL;
+    }
+    void *map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(MAP_FAILED==map){
+        fprintf(stderr,"Failed to map book %s: %s.\n",path,strerror(errno));
+        return E_FILEIO;
+    }
+    const book_header_t *header=(const book_header_t*)map;
+    if(header->magic!=BOOK_MAGIC || header->version!=BOOK_VERSION ||
+        header->entry_size!=sizeof(book_entry_t) ||
+        header->count>(st.st_size-sizeof(book_header_t))/sizeof(book_entry_t)){
+        fprintf(stderr,"Invalid book %s.\n",path);
+        munmap(map,st.st_size);
+        return E_INVAL;
+    }
+    book->map=map;
+    book->size=st.st_size;
+    book->entries=(const book_entry_t*)(header+1);
+    book->count=header->count;
+    return E_OK;
+}
+void book_close(book_t *book)
+{
+    if(NULL!=book->map){
+        munmap(book->map,book->size);
+    }
+    memset(book,0,sizeof(*book));
+}
+// The book move of a board, or -1 when the board is not in the book
+int book_lookup(const book_t *book, board_t board)
+{
+    uint64_t lo=0,hi=book->count;
+    while(lo<hi){
+        uint64_t mid=lo+(hi-lo)/2;
+        board_t key=book->entries[mid].board;
+        if(key==board){
+            return book->entries[mid].move;
+        }
+        if(key<board){
+            lo=mid+1;
+        }else{
+            hi=mid;
+        }
+    }
+    return -1;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    board_t x=((const book_entry_t*)a)->board,y=((const book_entry_t*)b)->board;
+    return (x>y)-(x<y);
+}
+/* Sort the entries and write them to `path`. Of duplicate boards the entry
+ * searched deepest is kept. The file is replaced atomically so running
+ * processes keep their mapping of the old book. */
+int book_write(const char *path, book_entry_t *entries, uint64_t count)
+{
+    uint64_t i,n=0;
+    qsort(entries,count,sizeof(book_entry_t),compare_entries);
+    for(i=0; i<count; i++){
+        if(n>0 && entries[n-1].board==entries[i].board){
+            if(entries[i].depth>entries[n-1].depth){
+                entries[n-1]=entries[i];
+            }
+            continue;
+        }
+        entries[n++]=entries[i];
+    }
+
+    char tmp_path[4096];
+    snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",path);
+    FILE *fp=fopen(tmp_path,"wb");
+    if(NULL==fp){
+        fprintf(stderr,"Failed to create %s: %s.\n",tmp_path,strerror(errno));
+        return E_FILEIO;
+    }
+    book_header_t header;
+    memset(&header,0,sizeof(header));
+    header.magic=BOOK_MAGIC;
+    header.version=BOOK_VERSION;
+    header.entry_size=sizeof(book_entry_t);
+    header.count=n;
+    if(fwrite(&header,sizeof(header),1,fp)!=1 || fwrite(entries,sizeof(book_entry_t),n,fp)!=n){
+        fprintf(stderr,"Failed to write %s: %s.\n",tmp_path,strerror(errno));
+        fclose(fp);
+        unlink(tmp_path);
+        return E_FILEIO;
+    }
+    if(fclose(fp)!=0 || rename(tmp_path,path)!=0){
+        fprintf(stderr,"Failed to write %s: %s.\n",path,strerror(errno));
+        unlink(tmp_path);
+        return E_FILEIO;
+    }
+    return E_OK;
+}
@@ -0,0 +1,51 @@
+#ifndef __book_h__
+#define __book_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "2048.h"
+
+/* Opening book: the best move of early positions, searched once ahead of time
+ * by 2048book. The file is a header followed by entries sorted by board, and
+ * is mapped read-only, so every process using the same book shares its pages.
+ * The Python libraries read the same format. */
+
+#define BOOK_MAGIC (0x4b4f4f4238343032ULL)  // "2048BOOK"
+#define BOOK_VERSION (1)
+
+typedef struct{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+    uint64_t reserved;
+}book_header_t;
+
+typedef struct{
+    board_t board;
+    uint8_t move;
+    uint8_t depth;      // search depth the move was found with
+    uint8_t reserved[6];
+}book_entry_t;
+
+typedef struct{
+    void *map;
+    size_t size;
+    const book_entry_t *entries;
+    uint64_t count;
+}book_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int book_open(book_t *book, const char *path);
+void book_close(book_t *book);
+int book_lookup(const book_t *book, board_t board);
+int book_write(const char *path, book_entry_t *entries, uint64_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "2048.h"
+#include "game.h"
+#include "affinity.h"
+#include "book.h"
+#include "logseg.h"
+
+/* Opening book builder. Positions come from replaying the start of the games
+ * in a daemon log by their seeds, from enumerating every position reachable
+ * from the starting boards within a number of moves, or both. Each position
+ * is searched deeper than the daemon would and its best move stored. */
+
+#define BOOK_DEFAULT_DEPTH (5)
+#define BOOK_DEFAULT_MOVES (20)
+
+typedef struct{
+    book_entry_t *entries;
+    uint64_t count;
+    uint64_t size;
+}entry_list_t;
+
+typedef struct{
+    board_t *boards;
+    uint64_t count;
+    uint64_t size;
+}board_list_t;
+
+static table_data_t *table;
+static int depth=BOOK_DEFAULT_DEPTH;
+
+static int add_entry(entry_list_t *list, board_t board, int move)
+{
+    if(list->count>=list->size){
+        uint64_t size=max(list->size*2,4096);
+        book_entry_t *entries=(book_entry_t*)realloc(list->entries,size*sizeof(book_entry_t));
+        if(NULL==entries){
+            return E_NOSPACE;
+        }
+        list->entries=entries;
+        list->size=size;
+    }
+    book_entry_t *entry=&list->entries[list->count++];
+    memset(entry,0,sizeof(*entry));
+    entry->board=board;
+    entry->move=move;
+    entry->depth=depth;
+    return E_OK;
+}
+static int add_board(board_list_t *list, board_t board)
+{
+    if(list->count>=list->size){
+        uint64_t size=max(list->size*2,4096);
+        board_t *boards=(board_t*)realloc(list->boards,size*sizeof(board_t));
+        if(NULL==boards){
+            return E_NOSPACE;
+        }
+        list->boards=boards;
+        list->size=size;
+    }
+    list->boards[list->count++]=board;
+    return E_OK;
+}
+static int compare_boards(const void *a, const void *b)
+{
+    board_t x=*(const board_t*)a,y=*(const board_t*)b;
+    return (x>y)-(x<y);
+}
+static void unique_boards(board_list_t *list)
+{
+    uint64_t i,n=0;
+    qsort(list->boards,list->count,sizeof(board_t),compare_boards);
+    for(i=0; i<list->count; i++){
+        if(n==0 || list->boards[n-1]!=list->boards[i]){
+            list->boards[n++]=list->boards[i];
+        }
+    }
+    list->count=n;
+}
+
+// Replay the first `moves` moves of the game of `seed`
+static void replay_game(entry_list_t *list, uint64_t seed, uint32_t moves)
+{
+    rand_t rand;
+    initRandom(&rand,seed);
+    board_t current=new_board(&rand);
+    uint32_t i;
+    for(i=0; i<moves; i++){
+        int move=find_best_move_depth(table,current,depth,NULL,NULL);
+        if(move<0 || add_entry(list,current,move)!=E_OK){
+            break;
+        }
+        board_t tile=draw_tile(&rand);
+        current=insert_tile_rand(&rand,execute_move(table,move,current),tile);
+    }
+}
+// Replay every logged game with a known seed, from a text log or a rotated segment
+static int add_log_games(entry_list_t *list, const char *log_path, uint32_t moves)
+{
+    uint64_t games=0;
+    logseg_t seg;
+    int rc=logseg_open(&seg,log_path);
+    if(rc==E_OK){
+        const uint8_t *p=seg.records;
+        log_record_t rec;
+        while(p<seg.records_end && logseg_read(&p,seg.records_end,&rec)){
+            if(rec.seed!=0){
+                replay_game(list,rec.seed,moves);
+                games++;
+            }
+        }
+        logseg_close(&seg);
+    }else if(rc!=E_INVAL){
+        return rc;
+    }else{
+        FILE *fp=fopen(log_path,"r");
+        if(NULL==fp){
+            fprintf(stderr,"Failed to open %s.\n",log_path);
+            return E_FILEIO;
+        }
+        char line[256];
+        while(fgets(line,sizeof(line),fp)!=NULL){
+            unsigned int moveno,score,max_tile;
+            unsigned long long board,seed=0;
+            if(sscanf(line,"%u,%u,%u,%llx,%llx",&moveno,&score,&max_tile,&board,&seed)!=5 || seed==0){
+                continue;
+            }
+            replay_game(list,seed,moves);
+            games++;
+        }
+        fclose(fp);
+    }
+    fprintf(stderr,"%llu logged games replayed.\n",(unsigned long long)games);
+    return E_OK;
+}
+// Search every position reachable from the starting boards within `plies` moves
+static int add_enumerated(entry_list_t *list, uint32_t plies)
+{
+    board_list_t level={NULL,0,0},next={NULL,0,0};
+    int a,b;
+    board_t ta,tb;
+    for(a=0; a<16; a++){
+        for(b=a+1; b<16; b++){
+            for(ta=1; ta<=2; ta++){
+                for(tb=1; tb<=2; tb++){
+                    add_board(&level,(ta<<(4*a))|(tb<<(4*b)));
+                }
+            }
+        }
+    }
+    uint32_t ply;
+    for(ply=0; ply<=plies; ply++){
+        uint64_t i;
+        fprintf(stderr,"Searching %llu positions after %u moves.\n",(unsigned long long)level.count,ply);
+        next.count=0;
+        for(i=0; i<level.count; i++){
+            board_t board=level.boards[i];
+            int move=find_best_move_depth(table,board,depth,NULL,NULL);
+            if(move<0 || add_entry(list,board,move)!=E_OK){
+                continue;
+            }
+            if(ply==plies){
+                continue;
+            }
+            board_t after=execute_move(table,move,board);
+            int shift;
+            for(shift=0; shift<64; shift+=4){
+                if(((after>>shift)&0xf)==0){
+                    add_board(&next,after|(1ULL<<shift));
+                    add_board(&next,after|(2ULL<<shift));
+                }
+            }
+        }
+        unique_boards(&next);
+        board_list_t tmp=level;
+        level=next;
+        next=tmp;
+    }
+    free(level.boards);
+    free(next.boards);
+    return E_OK;
+}
+
+static void print_help(const char *app_name)
+{
+    fprintf(stderr,"Usage: %s [-h] -o book [-l log] [-m moves] [-e plies] [-d depth] [-a]\n",app_name);
+    fprintf(stderr,"       -h            Print help.\n");
+    fprintf(stderr,"       -o book       Book file to write.\n");
+    fprintf(stderr,"       -l log        Replay the start of the games in a daemon log or log segment.\n");
+    fprintf(stderr,"       -m moves      Moves replayed per logged game, defaults to %u.\n",BOOK_DEFAULT_MOVES);
+    fprintf(stderr,"       -e plies      Enumerate all positions up to this many moves, defaults to 1 without -l.\n");
+    fprintf(stderr,"       -d depth      Search depth, defaults to %u.\n",BOOK_DEFAULT_DEPTH);
+    fprintf(stderr,"       -a            Add to the positions already in the book.\n");
+}
+int main(int argc, char *argv[])
+{
+    const char *book_path=NULL,*log_path=NULL;
+    uint32_t moves=BOOK_DEFAULT_MOVES;
+    int plies=-1;
+    bool append=false;
+    int opt;
+    while((opt=getopt(argc,argv,"ho:l:m:e:d:a"))!=-1){
+        switch(opt){
+            case 'o':
+                book_path=optarg;
+            break;
+            case 'l':
+                log_path=optarg;
+            break;
+            case 'm':
+                moves=strtoul(optarg,NULL,10);
+            break;
+            case 'e':
+                plies=strtol(optarg,NULL,10);
+            break;
+            case 'd':
+                depth=strtol(optarg,NULL,10);
+            break;
+            case 'a':
+                append=true;
+            break;
+            default:
+                print_help(argv[0]);
+                return 1;
+        }
+    }
+    if(NULL==book_path || depth<1 || depth>255){
+        print_help(argv[0]);
+        return 1;
+    }
+    if(plies<0 && NULL==log_path){
+        plies=1;
+    }
+
+    table=alloc_node_tables(NULL,-1,true);
+    if(NULL==table){
+        fprintf(stderr,"Failed to allocate move tables.\n");
+        return 1;
+    }
+    entry_list_t list={NULL,0,0};
+    if(append){
+        book_t book;
+        if(book_open(&book,book_path)==E_OK){
+            uint64_t i;
+            for(i=0; i<book.count; i++){
+                add_entry(&list,book.entries[i].board,book.entries[i].move);
+                list.entries[list.count-1].depth=book.entries[i].depth;
+            }
+            book_close(&book);
+        }
+    }
+    if(NULL!=log_path && add_log_games(&list,log_path,moves)!=E_OK){
+        return 1;
+    }
+    if(plies>=0){
+        add_enumerated(&list,plies);
+    }
+    int rc=book_write(book_path,list.entries,list.count);
+    if(rc==E_OK){
+        book_t book;
+        if(book_open(&book,book_path)==E_OK){
+            fprintf(stderr,"%llu positions in %s.\n",(unsigned long long)book.count,book_path);
+            book_close(&book);
+        }
+    }
+    free(list.entries);
+    free_node_tables(table);
+    return (rc==E_OK) ? 0 : 1;
+}
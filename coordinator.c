@@ -0,0 +1,728 @@
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "coordinator.h"
+#include "fileio.h"
+#include "game.h"
+
+// Read what the channel has, E_FILEIO once the other end is closed
+static int channel_fill(channel_t *ch)
+{
+    if(ch->len==sizeof(ch->buf)){
+        // No line is that long, drop it
+        ch->len=0;
+    }
+    ssize_t n=read(ch->fd,ch->buf+ch->len,sizeof(ch->buf)-ch->len);
+    if(n<0 && (errno==EAGAIN || errno==EINTR)){
+        return E_AGAIN;
+    }else if(n<=0){
+        return E_FILEIO;
+    }
+    ch->len+=n;
+    return E_OK;
+}
+// Take the next complete line out of the channel
+static bool channel_line(channel_t *ch, char *line, size_t size)
+{
+    char *nl=(char*)memchr(ch->buf,'\n',ch->len);
+    if(NULL==nl){
+        return false;
+    }
+    size_t len=nl-ch->buf;
+    size_t copy=min(len,size-1);
+    memcpy(line,ch->buf,copy);
+    line[copy]='\0';
+    ch->len-=len+1;
+    memmove(ch->buf,nl+1,ch->len);
+    return true;
+}
+static void shard_command(shard_t *shard, const char *cmd)
+{
+    if(shard->channel.fd>=0 && write(shard->channel.fd,cmd,strlen(cmd))<0){
+        fprintf(stderr,"Failed to write to shard %u: %s.\n",shard->index,strerror(errno));
+    }
+}
+// Make room for `count` games in both the snapshot and the one being received
+static bool shard_reserve(shard_t *shard, uint32_t count)
+{
+    if(count<=shard->games_size){
+        return true;
+    }
+    uint32_t size=max(max(shard->games_size*2,count),16);
+    shard_game_t *games=(shard_game_t*)realloc(shard->games,sizeof(shard_game_t)*size);
+    if(NULL==games){
+        return false;
+    }
+    shard->games=games;
+    shard_game_t *next=(shard_game_t*)realloc(shard->next,sizeof(shard_game_t)*size);
+    if(NULL==next){
+        return false;
+    }
+    shard->next=next;
+    shard->games_size=size;
+    return true;
+}
+
+/* Rebuild the thread list of the coordinator from the running games of the
+ * shards, so the socket commands, the metrics and the live state see every
+ * game as if it were played by a thread of this process. */
+static void update_mirrors(worker_t *worker)
+{
+    coordinator_t *c=worker->coordinator;
+    uint32_t count=0,i;
+    uint16_t s;
+    for(s=0; s<c->shard_count; s++){
+        const shard_t *shard=&c->shards[s];
+        for(i=0; i<shard->running && count<MAX_THREADS; i++){
+            thread_data_t *mirror=worker->thread_data[count];
+            if(NULL==mirror){
+                mirror=(thread_data_t*)calloc(1,sizeof(thread_data_t));
+                if(NULL==mirror){
+                    break;
+                }
+                mirror->worker=worker;
+                mirror->node=-1;
+                pthread_rwlock_init(&mirror->rwlock,NULL);
+                worker->thread_data[count]=mirror;
+            }
+            const shard_game_t *game=&shard->games[i];
+            pthread_rwlock_wrlock(&mirror->rwlock);
+            mirror->index=count;
+            mirror->seed=game->game.seed;
+            mirror->rand=game->game.rand;
+            mirror->moveno=game->game.moveno;
+            mirror->scoreoffset=game->game.scoreoffset;
+            mirror->board=game->game.board;
+            mirror->wide=game->game.wide;
+            mirror->wide_board=game->game.wide_board;
+            mirror->moves_evaled_total=game->moves_evaled_total;
+            mirror->last_move_usec=game->last_move_usec;
+            pthread_rwlock_unlock(&mirror->rwlock);
+            __atomic_store_n(&mirror->busy_usec,game->busy_usec,__ATOMIC_RELAXED);
+
+            shm_snapshot_t snapshot;
+            memset(&snapshot,0,sizeof(snapshot));
+            snapshot.moveno=game->game.moveno;
+            snapshot.scoreoffset=game->game.scoreoffset;
+            snapshot.board=game->game.board;
+            snapshot.moves_evaled_total=game->moves_evaled_total;
+            snapshot.score=game_score(worker->table_data,game->game.board,game->game.wide,
+                game->game.wide_board,game->game.scoreoffset);
+            stats_track_board(&worker->stats,&mirror->track,
+                game_max_rank(game->game.board,game->game.wide,game->game.wide_board),snapshot.score);
+            if(NULL!=worker->shm.header){
+                shm_state_update(&worker->shm,count,&snapshot);
+            }
+            count++;
+        }
+    }
+    for(i=count; i<MAX_THREADS && NULL!=worker->thread_data[i]; i++){
+        thread_data_t *mirror=worker->thread_data[i];
+        stats_untrack_board(&worker->stats,&mirror->track);
+        pthread_rwlock_destroy(&mirror->rwlock);
+        free(mirror);
+        worker->thread_data[i]=NULL;
+    }
+    worker->thread_count=count;
+    shm_state_set_count(&worker->shm,count);
+    c->changed=false;
+}
+
+// Highest descriptor open in this process, for a shard to close the others
+static int max_open_fd(void)
+{
+    DIR *d=opendir("/proc/self/fd");
+    if(NULL==d){
+        return 1023;
+    }
+    int res=0;
+    struct dirent *ent;
+    while((ent=readdir(d))!=NULL){
+        res=max(res,atoi(ent->d_name));
+    }
+    closedir(d);
+    return res;
+}
+static int hand_out_games(shard_t *shard)
+{
+    int fd=dup(shard->channel.fd);
+    FILE *fp=(fd>=0) ? fdopen(fd,"w") : NULL;
+    if(NULL==fp){
+        if(fd>=0){
+            close(fd);
+        }
+        return E_FILEIO;
+    }
+    uint32_t i;
+    for(i=0; i<shard->games_len; i++){
+        fputc('G',fp);
+        write_saved_game(fp,&shard->games[i].game);
+    }
+    fputs("R\n",fp);
+    return (fclose(fp)==0) ? E_OK : E_FILEIO;
+}
+/* Start the shard process, on its node and in its cgroup, and hand it its
+ * games. Everything the child needs is prepared before the fork. */
+static int launch_shard(worker_t *worker, shard_t *shard)
+{
+    coordinator_t *c=worker->coordinator;
+    char args[4][32];
+    const char *argv[24];
+    int argc=0;
+    argv[argc++]=c->exe;
+    argv[argc++]="--shard";
+    snprintf(args[0],sizeof(args[0]),"%u",shard->index);
+    argv[argc++]=args[0];
+    argv[argc++]="-n";
+    snprintf(args[1],sizeof(args[1]),"%u",shard->game_count);
+    argv[argc++]=args[1];
+    if(c->placement!=PLACEMENT_NONE && shard->node<0){
+        argv[argc++]="-p";
+        argv[argc++]=placement_name(c->placement);
+    }
+    if(c->sched_threads>0){
+        // The pool is split like the games, so the shards do not oversubscribe the CPUs
+        uint16_t threads=c->sched_threads/c->shard_count+(shard->index<c->sched_threads%c->shard_count);
+        snprintf(args[2],sizeof(args[2]),"%u",threads);
+        argv[argc++]="-j";
+        argv[argc++]=args[2];
+        argv[argc++]="-S";
+        argv[argc++]=sched_name(c->sched_policy);
+    }
+    if(!c->huge_pages){
+        argv[argc++]="-4";
+    }
+    if(NULL!=c->book_path){
+        argv[argc++]="-b";
+        argv[argc++]=c->book_path;
+    }
+    // The cap a single process with the daemon's games and pool would use
+    if(worker->trans_table_cap>0){
+        snprintf(args[3],sizeof(args[3]),"%llu",(unsigned long long)worker->trans_table_cap);
+        argv[argc++]="-T";
+        argv[argc++]=args[3];
+    }
+    argv[argc]=NULL;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    if(shard->node>=0){
+        const cpu_topology_t *topology=&worker->topology;
+        uint16_t i;
+        for(i=0; i<topology->node_cpu_count[shard->node]; i++){
+            CPU_SET(topology->cpus[topology->node_first[shard->node]+i],&cpuset);
+        }
+    }
+    char cgroup_procs[4096]="";
+    if(NULL!=c->cgroup){
+        char dir[4000];
+        snprintf(dir,sizeof(dir),"%s/shard%u",c->cgroup,shard->index);
+        if(mkdir(dir,0755)!=0 && errno!=EEXIST){
+            fprintf(stderr,"Failed to create cgroup %s: %s.\n",dir,strerror(errno));
+        }else{
+            snprintf(cgroup_procs,sizeof(cgroup_procs),"%s/cgroup.procs",dir);
+        }
+    }
+
+    int fds[2];
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,fds)!=0){
+        fprintf(stderr,"Failed to create shard channel: %s.\n",strerror(errno));
+        return E_FILEIO;
+    }
+    int maxfd=max_open_fd();
+    pid_t pid=fork();
+    if(pid<0){
+        fprintf(stderr,"Failed to start shard %u: %s.\n",shard->index,strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return E_AGAIN;
+    }
+    if(pid==0){
+        prctl(PR_SET_PDEATHSIG,SIGTERM);
+        if(shard->node>=0){
+            sched_setaffinity(0,sizeof(cpuset),&cpuset);
+        }
+        if(cgroup_procs[0]!='\0'){
+            int fd=open(cgroup_procs,O_WRONLY);
+            char buf[16];
+            snprintf(buf,sizeof(buf),"%d",(int)getpid());
+            if(fd<0 || write(fd,buf,strlen(buf))<0){
+                fprintf(stderr,"Failed to enter cgroup %s: %s.\n",cgroup_procs,strerror(errno));
+            }
+            if(fd>=0){
+                close(fd);
+            }
+        }
+        if(dup2(fds[1],SHARD_FD)<0){
+            _exit(127);
+        }
+        int fd;
+        for(fd=SHARD_FD+1; fd<=maxfd; fd++){
+            close(fd);
+        }
+        execv(c->exe,(char *const *)argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    shard->pid=pid;
+    shard->channel.fd=fds[0];
+    shard->channel.len=0;
+    shard->next_len=0;
+    shard->moves_total=shard->nodes_total=shard->book_moves_total=shard->evictions_total=0;
+    shard->started=time(NULL);
+    if(hand_out_games(shard)!=E_OK){
+        // The shard exits without its games and is started again
+        fprintf(stderr,"Failed to hand out games to shard %u.\n",shard->index);
+    }
+    return E_OK;
+}
+
+// Log the completed game of a shard
+static void log_game(worker_t *worker, shard_t *shard, const char *line)
+{
+    unsigned int moveno,score,max_tile;
+    unsigned long long board,seed;
+    if(sscanf(line,"%u,%u,%u,%llx,%llx",&moveno,&score,&max_tile,&board,&seed)!=5 || moveno==0 || board==0){
+        fprintf(stderr,"Invalid log line from shard %u.\n",shard->index);
+        return;
+    }
+    pthread_mutex_lock(&worker->log_mutex);
+    fprintf(worker->fileinfo.fp_log,"%s\n",line);
+    fflush(worker->fileinfo.fp_log);
+    pthread_mutex_unlock(&worker->log_mutex);
+    stats_game_completed(&worker->stats,moveno,score,(max_tile>0) ? __builtin_ctz(max_tile) : 0);
+
+    // Not to play it again should the shard exit before its next snapshot
+    uint32_t i;
+    for(i=0; seed!=0 && i<shard->games_len; i++){
+        if(shard->games[i].game.seed==seed){
+            memmove(&shard->games[i],&shard->games[i+1],sizeof(shard_game_t)*(shard->games_len-i-1));
+            shard->games_len--;
+            if(i<shard->running){
+                shard->running--;
+            }
+            break;
+        }
+    }
+}
+static void add_counter(uint64_t *total, uint64_t *last, unsigned long long value)
+{
+    if(value>=*last){
+        __atomic_fetch_add(total,value-*last,__ATOMIC_RELAXED);
+    }
+    *last=value;
+}
+static void shard_line(worker_t *worker, shard_t *shard, const char *line)
+{
+    switch(line[0]){
+        case 'L':
+            log_game(worker,shard,line+1);
+        break;
+        case 'S':{
+            shard_game_t game;
+            unsigned long long busy,nodes;
+            int n=0;
+            if(sscanf(line+1,"%u,%llu,%llu,%n",&game.last_move_usec,&busy,&nodes,&n)<3 || n==0 ||
+                !parse_saved_game(line+1+n,&game.game)){
+                break;
+            }
+            game.busy_usec=busy;
+            game.moves_evaled_total=nodes;
+            if(shard_reserve(shard,shard->next_len+1)){
+                shard->next[shard->next_len++]=game;
+            }
+        }
+        break;
+        case 'E':{
+            unsigned int running;
+            unsigned long long moves,nodes,book,evictions;
+            if(sscanf(line+1,"%u,%llu,%llu,%llu,%llu",&running,&moves,&nodes,&book,&evictions)!=5){
+                shard->next_len=0;
+                break;
+            }
+            stats_t *stats=&worker->stats;
+            add_counter(&stats->moves_total,&shard->moves_total,moves);
+            add_counter(&stats->nodes_total,&shard->nodes_total,nodes);
+            add_counter(&stats->book_moves_total,&shard->book_moves_total,book);
+            add_counter(&stats->evictions_total,&shard->evictions_total,evictions);
+            shard_game_t *games=shard->games;
+            shard->games=shard->next;
+            shard->next=games;
+            shard->games_len=shard->next_len;
+            shard->running=min(running,shard->games_len);
+            shard->next_len=0;
+            worker->coordinator->changed=true;
+        }
+        break;
+    }
+}
+// Handle what the shards sent, waiting up to `usec` for it
+static void drain_shards(worker_t *worker, long usec)
+{
+    coordinator_t *c=worker->coordinator;
+    fd_set readset;
+    FD_ZERO(&readset);
+    int maxfd=-1;
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        int fd=c->shards[i].channel.fd;
+        if(fd>=0){
+            FD_SET(fd,&readset);
+            maxfd=max(maxfd,fd);
+        }
+    }
+    struct timeval tm={0,usec};
+    if(select(maxfd+1,&readset,NULL,NULL,&tm)<=0){
+        return;
+    }
+    char line[SHARD_LINE_MAX];
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        if(shard->channel.fd<0 || !FD_ISSET(shard->channel.fd,&readset)){
+            continue;
+        }
+        int rc=channel_fill(&shard->channel);
+        while(channel_line(&shard->channel,line,sizeof(line))){
+            shard_line(worker,shard,line);
+        }
+        if(rc==E_FILEIO){
+            // A snapshot cut short is dropped, the last complete one stands
+            close(shard->channel.fd);
+            shard->channel.fd=-1;
+            shard->channel.len=0;
+            shard->next_len=0;
+        }
+    }
+}
+static void reap_shards(worker_t *worker)
+{
+    coordinator_t *c=worker->coordinator;
+    int status;
+    pid_t pid;
+    while((pid=waitpid(-1,&status,WNOHANG))>0){
+        uint16_t i;
+        for(i=0; i<c->shard_count && c->shards[i].pid!=pid; i++);
+        if(i==c->shard_count){
+            continue;
+        }
+        shard_t *shard=&c->shards[i];
+        shard->pid=0;
+        if(c->stopping){
+            continue;
+        }
+        // Shards that keep failing are started again less and less often
+        time_t t=time(NULL);
+        time_t delay=1;
+        if(t-shard->started<SHARD_RESTART_MAX_DELAY){
+            delay=min((time_t)1<<min(shard->restarts,6),SHARD_RESTART_MAX_DELAY);
+        }
+        shard->restart_at=t+delay;
+        shard->restarts++;
+        if(WIFSIGNALED(status)){
+            fprintf(stderr,"Shard %u killed by signal %d, restarting in %ld s.\n",shard->index,
+                WTERMSIG(status),(long)delay);
+        }else{
+            fprintf(stderr,"Shard %u exited with status %d, restarting in %ld s.\n",shard->index,
+                WEXITSTATUS(status),(long)delay);
+        }
+    }
+}
+
+/* Hand the games of the snapshot out to the shards: each gets its running
+ * games first, the games past the daemon's game count are spread over them
+ * and parked there. */
+int coordinator_start(worker_t *worker, const worker_param_t *param)
+{
+    coordinator_t *c=(coordinator_t*)calloc(1,sizeof(coordinator_t));
+    if(NULL==c){
+        fprintf(stderr,"malloc failed\n");
+        return E_NOSPACE;
+    }
+    worker->coordinator=c;
+    ssize_t len=readlink("/proc/self/exe",c->exe,sizeof(c->exe)-1);
+    if(len<=0){
+        fprintf(stderr,"Failed to find the executable for the shards: %s.\n",strerror(errno));
+        return E_FILEIO;
+    }
+    c->exe[len]='\0';
+    c->shard_count=min(min(param->shard_count,param->thread_count),MAX_SHARDS);
+    if(param->sched_threads>0){
+        // Every shard gets at least one search thread
+        c->shard_count=min(c->shard_count,param->sched_threads);
+    }
+    c->cgroup=getenv(ENV_SHARD_CGROUP);
+    c->placement=param->placement;
+    c->sched_threads=param->sched_threads;
+    c->sched_policy=param->sched_policy;
+    c->huge_pages=param->huge_pages;
+    c->book_path=param->book_path;
+    signal(SIGPIPE,SIG_IGN);
+
+    // With several nodes each shard keeps to one, its tables allocated there
+    if(NULL==worker->topology.cpus && topology_read(&worker->topology)!=E_OK){
+        memset(&worker->topology,0,sizeof(worker->topology));
+    }
+    bool pin=(worker->topology.node_count>1);
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        shard->index=i;
+        shard->channel.fd=-1;
+        shard->game_count=param->thread_count/c->shard_count+(i<param->thread_count%c->shard_count);
+        shard->node=pin ? i%worker->topology.node_count : -1;
+    }
+    uint32_t g=0;
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        while(shard->games_len<shard->game_count && g<worker->parked_count && shard_reserve(shard,shard->games_len+1)){
+            shard->games[shard->games_len++].game=worker->parked[g++];
+        }
+    }
+    for(i=0; g<worker->parked_count; i=(i+1)%c->shard_count){
+        shard_t *shard=&c->shards[i];
+        if(!shard_reserve(shard,shard->games_len+1)){
+            fprintf(stderr,"Failed to hand out parked games, they will be lost\n");
+            break;
+        }
+        shard->games[shard->games_len++].game=worker->parked[g++];
+    }
+    worker->parked_count=0;
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        uint32_t j;
+        for(j=0; j<shard->games_len; j++){
+            shard->games[j].last_move_usec=0;
+            shard->games[j].busy_usec=0;
+            shard->games[j].moves_evaled_total=0;
+        }
+        shard->running=min(shard->game_count,shard->games_len);
+        if(launch_shard(worker,shard)!=E_OK){
+            shard->restart_at=time(NULL)+1;
+        }
+    }
+    update_mirrors(worker);
+    return E_OK;
+}
+// Called from the main loop of the coordinator
+void coordinator_handler(worker_t *worker)
+{
+    coordinator_t *c=worker->coordinator;
+    if(NULL==c){
+        return;
+    }
+    drain_shards(worker,0);
+    reap_shards(worker);
+    time_t t=time(NULL);
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        if(worker->running && !c->stopping && shard->pid==0 && shard->channel.fd<0 && t>=shard->restart_at &&
+            launch_shard(worker,shard)!=E_OK){
+            shard->restart_at=t+1;
+        }
+    }
+    if(c->changed){
+        update_mirrors(worker);
+    }
+}
+// Spread the games over the shards, each parking or resuming games on its own
+int coordinator_resize(worker_t *worker, uint16_t thread_count)
+{
+    coordinator_t *c=worker->coordinator;
+    if(thread_count<c->shard_count){
+        fprintf(stderr,"At least one game per shard, %u shards are running.\n",c->shard_count);
+        return E_INVAL;
+    }
+    // Reported right away, the mirrors follow with the next snapshots
+    worker->thread_count=thread_count;
+    update_trans_table_cap(worker);
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        char cmd[32];
+        if(worker->trans_table_cap>0){
+            snprintf(cmd,sizeof(cmd),"T%llu\n",(unsigned long long)worker->trans_table_cap);
+            shard_command(shard,cmd);
+        }
+        shard->game_count=thread_count/c->shard_count+(i<thread_count%c->shard_count);
+        snprintf(cmd,sizeof(cmd),"N%u\n",shard->game_count);
+        shard_command(shard,cmd);
+    }
+    return E_OK;
+}
+void coordinator_write_snapshot(worker_t *worker, FILE *fp)
+{
+    coordinator_t *c=worker->coordinator;
+    uint16_t i;
+    uint32_t j;
+    for(i=0; i<c->shard_count; i++){
+        const shard_t *shard=&c->shards[i];
+        for(j=0; j<shard->games_len; j++){
+            write_saved_game(fp,&shard->games[j].game);
+        }
+    }
+}
+// Stop the shards and wait for their last snapshots
+void coordinator_stop(worker_t *worker)
+{
+    coordinator_t *c=worker->coordinator;
+    if(NULL==c || c->stopping){
+        return;
+    }
+    c->stopping=true;
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        shard_command(&c->shards[i],"Q\n");
+    }
+    time_t t0=time(NULL);
+    while(time(NULL)-t0<SHARD_STOP_TIMEOUT){
+        bool done=true;
+        for(i=0; i<c->shard_count; i++){
+            done=done && c->shards[i].pid==0 && c->shards[i].channel.fd<0;
+        }
+        if(done){
+            break;
+        }
+        drain_shards(worker,10000);
+        reap_shards(worker);
+    }
+    for(i=0; i<c->shard_count; i++){
+        shard_t *shard=&c->shards[i];
+        if(shard->pid>0){
+            fprintf(stderr,"Shard %u did not stop, killing it.\n",shard->index);
+            kill(shard->pid,SIGKILL);
+            waitpid(shard->pid,NULL,0);
+            shard->pid=0;
+        }
+        if(shard->channel.fd>=0){
+            close(shard->channel.fd);
+            shard->channel.fd=-1;
+        }
+    }
+}
+void coordinator_close(worker_t *worker)
+{
+    coordinator_t *c=worker->coordinator;
+    if(NULL==c){
+        return;
+    }
+    uint16_t i;
+    for(i=0; i<c->shard_count; i++){
+        free(c->shards[i].games);
+        free(c->shards[i].next);
+    }
+    free(c);
+    worker->coordinator=NULL;
+}
+
+// Take the games handed out by the coordinator, before the threads start
+int shard_read_games(worker_t *worker)
+{
+    channel_t *ch=&worker->fileinfo.coordinator;
+    uint32_t next=0;
+    char line[SHARD_LINE_MAX];
+    while(true){
+        while(channel_line(ch,line,sizeof(line))){
+            saved_game_t game;
+            if(line[0]=='R'){
+                return E_OK;
+            }else if(line[0]=='G' && parse_saved_game(line+1,&game)){
+                restore_game(worker,&next,&game);
+            }
+        }
+        if(channel_fill(ch)==E_FILEIO){
+            fprintf(stderr,"Shard lost its coordinator.\n");
+            return E_FILEIO;
+        }
+    }
+}
+int shard_send_snapshot(worker_t *worker)
+{
+    FILE *fp=worker->fileinfo.fp_log;
+    uint32_t running=0,i;
+    pthread_mutex_lock(&worker->log_mutex);
+    for(i=0; i<worker->thread_count; i++){
+        thread_data_t *thread_data=worker->thread_data[i];
+        saved_game_t game;
+        pthread_rwlock_rdlock(&thread_data->rwlock);
+        game.moveno=thread_data->moveno;
+        game.scoreoffset=thread_data->scoreoffset;
+        game.board=thread_data->board;
+        game.wide=thread_data->wide;
+        game.wide_board=thread_data->wide_board;
+        game.seed=thread_data->seed;
+        game.rand=thread_data->rand;
+        uint32_t usec=thread_data->last_move_usec;
+        uint64_t nodes=thread_data->moves_evaled_total;
+        pthread_rwlock_unlock(&thread_data->rwlock);
+        // Like the snapshot file, games not started yet are left out
+        if(game.moveno==0){
+            continue;
+        }
+        fprintf(fp,"S%u,%llu,%llu,",usec,
+            (unsigned long long)__atomic_load_n(&thread_data->busy_usec,__ATOMIC_RELAXED),(unsigned long long)nodes);
+        write_saved_game(fp,&game);
+        running++;
+    }
+    for(i=0; i<worker->parked_count; i++){
+        fprintf(fp,"S0,0,0,");
+        write_saved_game(fp,&worker->parked[i]);
+    }
+    stats_t *stats=&worker->stats;
+    fprintf(fp,"E%u,%llu,%llu,%llu,%llu\n",running,
+        (unsigned long long)__atomic_load_n(&stats->moves_total,__ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&stats->nodes_total,__ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&stats->book_moves_total,__ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&stats->evictions_total,__ATOMIC_RELAXED));
+    int rc=(fflush(fp)==0) ? E_OK : E_FILEIO;
+    pthread_mutex_unlock(&worker->log_mutex);
+    return rc;
+}
+// Commands of the coordinator, a closed channel stops the shard
+void shard_handler(worker_t *worker)
+{
+    channel_t *ch=&worker->fileinfo.coordinator;
+    fd_set readset;
+    FD_ZERO(&readset);
+    FD_SET(ch->fd,&readset);
+    struct timeval tm={0,10000};
+    if(select(ch->fd+1,&readset,NULL,NULL,&tm)<=0){
+        return;
+    }
+    int rc=channel_fill(ch);
+    char line[SHARD_LINE_MAX];
+    while(channel_line(ch,line,sizeof(line))){
+        switch(line[0]){
+            case 'N':{
+                char *end=NULL;
+                unsigned long count=strtoul(line+1,&end,10);
+                if(*end!='\0' || worker_resize(worker,count)!=E_OK){
+                    fprintf(stderr,"Failed to resize to %s games\n",line+1);
+                }
+            }
+            break;
+            case 'T':{
+                char *end=NULL;
+                unsigned long long cap=strtoull(line+1,&end,10);
+                if(*end=='\0'){
+                    worker->trans_table_search=cap;
+                    update_trans_table_cap(worker);
+                }
+            }
+            break;
+            case 'Q':
+                worker->running=false;
+            break;
+        }
+    }
+    if(rc==E_FILEIO){
+        worker->running=false;
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef __coordinator_h__
+#define __coordinator_h__
+
+#include <sys/types.h>
+#include <stdio.h>
+#include "worker.h"
+
+/* Sharded daemon. With `-P shards` the daemon becomes a coordinator: it keeps
+ * the log, the snapshot, the control socket, the live state and the metrics,
+ * and runs the games in shard processes, each with its own address space,
+ * allocator and move tables. Shards are pinned to one NUMA node each when
+ * there are several, or placed in a cgroup named by RUN2048_SHARD_CGROUP.
+ *
+ * A shard is `2048ai --shard index` with its channel on SHARD_FD, a socket
+ * pair carrying lines tagged by their first character:
+ *
+ *  G<game>   coordinator to shard, a snapshot line of a game to play
+ *  R         end of the games handed out, start playing
+ *  T<bytes>  cap the transposition table of each search, sent before N
+ *  N<count>  change the number of running games, the rest stay parked
+ *  Q         stop, after sending a last snapshot
+ *  L<line>   shard to coordinator, the log line of a completed game
+ *  S<usec>,<busy_usec>,<nodes_total>,<game>
+ *            a game of the shard's snapshot, running ones first with the
+ *            time of their last move and their search counters
+ *  E<running>,<moves>,<nodes>,<book_moves>,<evictions>
+ *            end of the snapshot, with the shard's counters so far
+ *
+ * Shards send their snapshot every second. A shard that exits is started
+ * again with the games of its last snapshot, less the games it logged since,
+ * while the other shards keep playing. */
+
+#define MAX_SHARDS (64)
+#define SHARD_FD (3)
+#define SHARD_LINE_MAX (256)
+#define SHARD_STOP_TIMEOUT (20)
+#define SHARD_RESTART_MAX_DELAY (60)
+#define ENV_SHARD_CGROUP ("RUN2048_SHARD_CGROUP")
+
+typedef struct{
+    saved_game_t game;
+    uint32_t last_move_usec;
+    uint64_t busy_usec;
+    uint64_t moves_evaled_total;
+}shard_game_t;
+
+typedef struct{
+    pid_t pid;                  // 0 when not running
+    channel_t channel;          // fd -1 when closed
+    uint16_t index;
+    uint16_t game_count;        // running games asked of the shard
+    int node;                   // NUMA node it is pinned to, or -1
+    shard_game_t *games;        // as of its last snapshot, running ones first
+    uint32_t games_len;
+    uint32_t running;
+    shard_game_t *next;         // snapshot being received
+    uint32_t next_len;
+    uint32_t games_size;        // capacity of games and next
+    uint64_t moves_total;       // counters of its last snapshot
+    uint64_t nodes_total;
+    uint64_t book_moves_total;
+    uint64_t evictions_total;
+    time_t started;
+    time_t restart_at;
+    uint32_t restarts;
+}shard_t;
+
+typedef struct coordinator_s{
+    uint16_t shard_count;
+    shard_t shards[MAX_SHARDS];
+    bool stopping;
+    bool changed;               // a snapshot arrived since the mirrors were updated
+    char exe[4096];
+    const char *cgroup;
+    int placement;
+    uint16_t sched_threads;
+    int sched_policy;
+    bool huge_pages;
+    const char *book_path;
+}coordinator_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int coordinator_start(worker_t *worker, const worker_param_t *param);
+void coordinator_handler(worker_t *worker);
+int coordinator_resize(worker_t *worker, uint16_t thread_count);
+void coordinator_write_snapshot(worker_t *worker, FILE *fp);
+void coordinator_stop(worker_t *worker);
+void coordinator_close(worker_t *worker);
+int shard_read_games(worker_t *worker);
+int shard_send_snapshot(worker_t *worker);
+void shard_handler(worker_t *worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,430 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "util.h"
+#include "affinity.h"
+#include "scheduler.h"
+#include "book.h"
+#include "worker.h"
+#include "logseg.h"
+#include "evalserver.h"
+
+#define EVAL_PENDING_MAX (1024)
+
+struct eval_result_t{
+    int move;
+    float scores[4];
+};
+
+// A board being searched, shared by every request of it until it is answered
+struct eval_job_t{
+    board_t board;
+    uint32_t game;
+    bool done;
+    eval_result_t result;
+};
+typedef std::shared_ptr<eval_job_t> eval_job_ptr;
+
+struct eval_cache_entry_t{
+    board_t board;      // 0 when empty
+    eval_result_t result;
+};
+
+struct eval_client_t{
+    int fd;
+    char buf[EVAL_LINE_MAX];
+    size_t len;
+    bool overlong;      // skipping the rest of a line too long for buf
+    bool eof;           // sent everything, is answered before it is closed
+    bool closed;
+    std::deque<eval_job_ptr> pending;   // in request order, NULL for a malformed line
+    std::string out;
+};
+
+// A line read from a client, queued with the other lines of its round
+struct eval_line_t{
+    eval_client_t *client;
+    bool valid;
+    board_t board;
+};
+
+struct eval_server_t{
+    table_data_t *table;
+    book_t book;
+    search_sched_t *sched;
+    volatile bool cancel;
+
+    // Guards everything below
+    std::mutex mutex;
+    std::condition_variable queued;
+    bool running;
+    std::deque<eval_job_ptr> queue;
+    std::unordered_map<board_t, eval_job_ptr> searching;
+    std::vector<eval_cache_entry_t> cache;
+
+    int wake[2];        // written when a search finishes
+    uint64_t requests;
+    uint64_t searches;
+    uint64_t cache_hits;
+    uint64_t joined;
+};
+
+static inline eval_cache_entry_t *cache_entry(eval_server_t *server, board_t board)
+{
+    uint64_t hash=(board*0x9e3779b97f4a7c15ULL)>>32;
+    return &server->cache[hash&(EVAL_CACHE_ENTRIES-1)];
+}
+// Run the queued searches on the shared pool until the server stops
+static void eval_main(eval_server_t *server)
+{
+    std::unique_lock<std::mutex> lock(server->mutex);
+    while(true){
+        server->queued.wait(lock,[server](){
+            return !server->queue.empty() || !server->running;
+        });
+        if(!server->running){
+            break;
+        }
+        eval_job_ptr job=server->queue.front();
+        server->queue.pop_front();
+        lock.unlock();
+        eval_result_t result;
+        result.move=sched_score_moves(server->sched,job->game,-1,server->table,job->board,result.scores,NULL,
+            &server->cancel);
+        int book_move=book_lookup(&server->book,job->board);
+        if(book_move>=0 && execute_move(server->table,book_move,job->board)!=job->board){
+            result.move=book_move;
+        }
+        lock.lock();
+        job->result=result;
+        job->done=true;
+        server->searching.erase(job->board);
+        if(!server->cancel && job->board!=0){
+            eval_cache_entry_t *entry=cache_entry(server,job->board);
+            entry->board=job->board;
+            entry->result=result;
+        }
+        char c=0;
+        if(write(server->wake[1],&c,1)<0){
+            // The pipe is full, the I/O loop wakes up anyway
+        }
+    }
+}
+
+static bool parse_line(const char *s, size_t len, board_t *board)
+{
+    if(len>0 && s[len-1]=='\r'){
+        len--;
+    }
+    const char *p=s,*end=s+len;
+    uint64_t value;
+    if(!log_parse_hex(&p,end,&value) || p!=end){
+        return false;
+    }
+    *board=value;
+    return true;
+}
+static void end_line(eval_client_t *client, std::vector<eval_line_t> &lines)
+{
+    eval_line_t line;
+    line.client=client;
+    line.valid=!client->overlong && parse_line(client->buf,client->len,&line.board);
+    if(client->len>0 || client->overlong){
+        lines.push_back(line);
+    }
+    client->len=0;
+    client->overlong=false;
+}
+/* Read what a client sent and split it into lines. At the end of its input,
+ * e.g. after shutdown(SHUT_WR), the last line may lack its newline and the
+ * client stays until it has its answers. False on an error. */
+static bool client_read(eval_client_t *client, std::vector<eval_line_t> &lines)
+{
+    char buf[4096];
+    ssize_t rc=recv(client->fd,buf,sizeof(buf),0);
+    if(rc<0){
+        return errno==EAGAIN || errno==EINTR;
+    }
+    if(rc==0){
+        end_line(client,lines);
+        client->eof=true;
+        return true;
+    }
+    ssize_t i;
+    for(i=0; i<rc; i++){
+        if(buf[i]!='\n'){
+            if(client->len<sizeof(client->buf)){
+                client->buf[client->len++]=buf[i];
+            }else{
+                client->overlong=true;
+            }
+            continue;
+        }
+        end_line(client,lines);
+    }
+    return true;
+}
+/* Queue the lines of one round: answered from the cache, joined to a search
+ * of the same board, or searched. The caller holds the mutex. */
+static size_t queue_lines(eval_server_t *server, const std::vector<eval_line_t> &lines)
+{
+    size_t queued=0;
+    for(const eval_line_t &line : lines){
+        eval_client_t *client=line.client;
+        if(!line.valid){
+            client->pending.push_back(NULL);
+            continue;
+        }
+        server->requests++;
+        eval_cache_entry_t *entry=cache_entry(server,line.board);
+        if(line.board!=0 && entry->board==line.board){
+            eval_job_ptr job(new eval_job_t);
+            job->board=line.board;
+            job->game=client->fd;
+            job->done=true;
+            job->result=entry->result;
+            client->pending.push_back(job);
+            server->cache_hits++;
+            continue;
+        }
+        auto it=server->searching.find(line.board);
+        if(it!=server->searching.end()){
+            client->pending.push_back(it->second);
+            server->joined++;
+            continue;
+        }
+        eval_job_ptr job(new eval_job_t);
+        job->board=line.board;
+        job->game=client->fd;
+        job->done=false;
+        server->searching[line.board]=job;
+        server->queue.push_back(job);
+        client->pending.push_back(job);
+        server->searches++;
+        queued++;
+    }
+    return queued;
+}
+// Format the answers at the head of the client's queue. The caller holds the mutex.
+static void collect_answers(eval_client_t *client)
+{
+    while(!client->pending.empty()){
+        const eval_job_ptr &job=client->pending.front();
+        char line[EVAL_LINE_MAX*2];
+        if(NULL==job){
+            snprintf(line,sizeof(line),"E\n");
+        }else if(job->done){
+            const eval_result_t &r=job->result;
+            snprintf(line,sizeof(line),"%d,%.9g,%.9g,%.9g,%.9g\n",r.move,r.scores[0],r.scores[1],r.scores[2],
+                r.scores[3]);
+        }else{
+            break;
+        }
+        client->out.append(line);
+        client->pending.pop_front();
+    }
+}
+static bool client_write(eval_client_t *client)
+{
+    if(client->out.empty()){
+        return true;
+    }
+    ssize_t rc=send(client->fd,client->out.data(),client->out.size(),MSG_NOSIGNAL);
+    if(rc<0){
+        return errno==EAGAIN || errno==EINTR;
+    }
+    client->out.erase(0,rc);
+    return true;
+}
+
+static int open_socket(const char *path)
+{
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd<0){
+        fprintf(stderr,"Failed to create socket: %s.\n",strerror(errno));
+        return -1;
+    }
+    fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    strncpy(addr.sun_path,path,sizeof(addr.sun_path)-1);
+    if(bind(fd,(const struct sockaddr *)&addr,sizeof(addr))!=0){
+        fprintf(stderr,"Failed to create socket %s: %s.\n",path,strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if(listen(fd,64)<0){
+        fprintf(stderr,"Listen failed: %s\n",strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+static void accept_clients(int listen_fd, std::vector<std::unique_ptr<eval_client_t>> &clients)
+{
+    while(true){
+        int fd=accept(listen_fd,NULL,NULL);
+        if(fd<0){
+            return;
+        }
+        if(clients.size()>=EVAL_MAX_CLIENTS){
+            close(fd);
+            continue;
+        }
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+        std::unique_ptr<eval_client_t> client(new eval_client_t);
+        client->fd=fd;
+        client->len=0;
+        client->overlong=false;
+        client->eof=false;
+        client->closed=false;
+        clients.push_back(std::move(client));
+    }
+}
+
+/* Serve move evaluations on `param->socket_path` until `stop` is set. The
+ * calling thread does all socket I/O; searches run on the scheduler pool. */
+int eval_server_run(const eval_server_param_t *param, const volatile bool *stop)
+{
+    eval_server_t server;
+    server.table=alloc_node_tables(NULL,-1,param->huge_pages);
+    if(NULL==server.table){
+        fprintf(stderr,"Failed to allocate move tables.\n");
+        return E_NOSPACE;
+    }
+    uint16_t thread_count=max(param->sched_threads,1);
+    set_trans_table_cap(trans_table_search_cap(param->trans_table_search,param->trans_table_daemon,
+        (size_t)thread_count*SCHED_LIVE_SEARCHES));
+    memset(&server.book,0,sizeof(server.book));
+    if(NULL!=param->book_path && book_open(&server.book,param->book_path)!=E_OK){
+        fprintf(stderr,"Playing without opening book.\n");
+    }
+    int listen_fd=open_socket(param->socket_path);
+    if(listen_fd<0){
+        book_close(&server.book);
+        free_node_tables(server.table);
+        return E_FILEIO;
+    }
+    if(pipe(server.wake)!=0){
+        fprintf(stderr,"Failed to create pipe: %s.\n",strerror(errno));
+        close(listen_fd);
+        unlink(param->socket_path);
+        book_close(&server.book);
+        free_node_tables(server.table);
+        return E_FILEIO;
+    }
+    fcntl(server.wake[0],F_SETFL,fcntl(server.wake[0],F_GETFL)|O_NONBLOCK);
+    fcntl(server.wake[1],F_SETFL,fcntl(server.wake[1],F_GETFL)|O_NONBLOCK);
+    server.cache.resize(EVAL_CACHE_ENTRIES);
+    memset(server.cache.data(),0,EVAL_CACHE_ENTRIES*sizeof(eval_cache_entry_t));
+    server.cancel=false;
+    server.running=true;
+    server.requests=server.searches=server.cache_hits=server.joined=0;
+    server.sched=sched_start(thread_count,param->sched_policy,NULL,PLACEMENT_NONE);
+    std::vector<std::thread> threads;
+    int i;
+    for(i=0; i<thread_count*EVAL_REQUESTS_PER_THREAD; i++){
+        threads.emplace_back(eval_main,&server);
+    }
+    fprintf(stderr,"Serving moves on %s with %u search threads.\n",param->socket_path,thread_count);
+
+    std::vector<std::unique_ptr<eval_client_t>> clients;
+    std::vector<struct pollfd> fds;
+    std::vector<eval_line_t> lines;
+    while(!*stop){
+        fds.clear();
+        fds.push_back({listen_fd,POLLIN,0});
+        fds.push_back({server.wake[0],POLLIN,0});
+        for(auto &client : clients){
+            short events=0;
+            // Stop reading from a client that does not collect its answers
+            if(!client->eof && client->pending.size()<EVAL_PENDING_MAX){
+                events|=POLLIN;
+            }
+            if(!client->out.empty()){
+                events|=POLLOUT;
+            }
+            fds.push_back({client->fd,events,0});
+        }
+        if(poll(fds.data(),fds.size(),100)<0 && errno!=EINTR){
+            fprintf(stderr,"Poll failed: %s.\n",strerror(errno));
+            break;
+        }
+        if(fds[1].revents&POLLIN){
+            char buf[256];
+            while(read(server.wake[0],buf,sizeof(buf))>0);
+        }
+        lines.clear();
+        size_t n;
+        for(n=0; n<clients.size(); n++){
+            eval_client_t *client=clients[n].get();
+            short revents=fds[n+2].revents;
+            if(client->eof){
+                // Gone for good, its answers cannot be sent any more
+                client->closed=(revents&(POLLHUP|POLLERR))!=0;
+            }else if((revents&(POLLIN|POLLHUP|POLLERR)) && !client_read(client,lines)){
+                client->closed=true;
+            }
+        }
+        if(fds[0].revents&POLLIN){
+            accept_clients(listen_fd,clients);
+        }
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            if(queue_lines(&server,lines)>0){
+                server.queued.notify_all();
+            }
+            for(auto &client : clients){
+                collect_answers(client.get());
+            }
+        }
+        for(n=0; n<clients.size();){
+            eval_client_t *client=clients[n].get();
+            bool answered=client->eof && client->pending.empty() && client->out.empty();
+            if(client->closed || !client_write(client) || answered){
+                close(client->fd);
+                clients[n]=std::move(clients.back());
+                clients.pop_back();
+                continue;
+            }
+            n++;
+        }
+    }
+
+    server.cancel=true;
+    {
+        std::lock_guard<std::mutex> lock(server.mutex);
+        server.running=false;
+    }
+    server.queued.notify_all();
+    for(auto &thread : threads){
+        thread.join();
+    }
+    sched_stop(server.sched);
+    for(auto &client : clients){
+        close(client->fd);
+    }
+    close(listen_fd);
+    unlink(param->socket_path);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    book_close(&server.book);
+    free_node_tables(server.table);
+    fprintf(stderr,"Answered %llu requests: %llu searched, %llu from the cache, %llu joined a search.\n",
+        (unsigned long long)server.requests,(unsigned long long)server.searches,
+        (unsigned long long)server.cache_hits,(unsigned long long)server.joined);
+    return E_OK;
+}
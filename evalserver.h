@@ -0,0 +1,53 @@
+#ifndef __evalserver_h__
+#define __evalserver_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Move evaluation server. `2048ai --serve socket` loads the move tables once
+ * and answers board evaluations from any number of clients on a Unix stream
+ * socket, e.g. the Python libraries with RUN2048_EVAL_SOCKET set. A request
+ * is a line holding a board in hex, as in the log, and is answered by a line
+ *
+ *  move,up,down,left,right
+ *
+ * with the best move (-1 when none is legal) and the score of each move (0
+ * when illegal), or by `E` for a malformed line. A board of the opening book
+ * is answered with the book move, as the daemon would play it, and the scores
+ * of the search. Clients may send many lines
+ * without waiting; the answers come back in the same order.
+ *
+ * Every line read in one round, from all clients, is queued at once, and the
+ * requests are searched on one shared scheduler pool (see scheduler.h), at
+ * most EVAL_REQUESTS_PER_THREAD per search thread at a time so the pool is
+ * never idle. A board requested again while it is searched waits for that
+ * search, and recent results are kept in a cache of EVAL_CACHE_ENTRIES shared
+ * by all clients. */
+
+#define EVAL_MAX_CLIENTS (1024)
+#define EVAL_LINE_MAX (64)
+#define EVAL_REQUESTS_PER_THREAD (4)
+#define EVAL_CACHE_ENTRIES (1 << 16)
+
+typedef struct{
+    const char *socket_path;
+    uint16_t sched_threads;
+    int sched_policy;
+    bool huge_pages;
+    const char *book_path;      // NULL without an opening book
+    size_t trans_table_search;
+    size_t trans_table_daemon;  // shared by the searches the pool keeps started
+}eval_server_param_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int eval_server_run(const eval_server_param_t *param, const volatile bool *stop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,7 +4,12 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <dirent.h>
+#include <ctype.h>
 #include "fileio.h"
+#include "game.h"
+#include "logseg.h"
+#include "coordinator.h"
 
 bool test_running(const char *log_path,const char *snapshot_path)
 {
@@ -49,11 +54,44 @@ int wait_daemon(bool start_action, const char *socket_path, time_t timeout)
     }while(t-t0 < timeout);
     return rc;
 }
+// Number of the last segment rotated out of `log_path`, 0 when none
+static uint32_t last_log_segment(const char *log_path)
+{
+    char dir[4096];
+    const char *base=strrchr(log_path,'/');
+    if(NULL!=base){
+        snprintf(dir,sizeof(dir),"%.*s",(int)(base-log_path+1),log_path);
+        base++;
+    }else{
+        snprintf(dir,sizeof(dir),".");
+        base=log_path;
+    }
+    DIR *d=opendir(dir);
+    if(NULL==d){
+        return 0;
+    }
+    size_t len=strlen(base);
+    uint32_t last=0;
+    struct dirent *ent;
+    while((ent=readdir(d))!=NULL){
+        const char *num=ent->d_name+len+1;
+        if(strncmp(ent->d_name,base,len)!=0 || ent->d_name[len]!='.' || !isdigit((unsigned char)*num)){
+            continue;
+        }
+        char *end;
+        unsigned long seq=strtoul(num,&end,10);
+        if(*end=='\0' || strcmp(end,".seg")==0){
+            last=max(last,seq);
+        }
+    }
+    closedir(d);
+    return last;
+}
 int init_files(fileinfo_t *info)
 {
     size_t i;
-    if(NULL==info || NULL==info->log_path || NULL==info->snapshot_path ||
-        NULL==info->socket_path){
+    if(NULL==info || (info->coordinator.fd<0 && (NULL==info->log_path || NULL==info->snapshot_path ||
+        NULL==info->socket_path))){
         fprintf(stderr,"Invalid param.\n");
         return E_INVAL;
     }
@@ -63,6 +101,16 @@ int init_files(fileinfo_t *info)
     for(i=0; i<MAX_CONNECTIONS; i++){
         info->clients[i]=-1;
     }
+    if(info->coordinator.fd>=0){
+        // A shard logs and saves its games through its coordinator
+        int fd=dup(info->coordinator.fd);
+        info->fp_log=(fd>=0) ? fdopen(fd,"w") : NULL;
+        if(NULL==info->fp_log){
+            fprintf(stderr,"Failed to open coordinator channel: %s.\n",strerror(errno));
+            goto error_exit;
+        }
+        return E_OK;
+    }
     
     FILE *fp_log=fopen(info->log_path, "a");
     if(NULL==fp_log){
@@ -74,6 +122,16 @@ int init_files(fileinfo_t *info)
         fprintf(stderr,"Failed to lock log file %s, possibly other instance is running.\n",info->log_path);
         goto error_exit;
     }
+    info->log_segment=last_log_segment(info->log_path);
+    if(info->rotate_period>0){
+        // A log last written in an earlier period is rotated right away
+        struct stat st;
+        time_t t=time(NULL);
+        if(fstat(fileno(fp_log),&st)==0 && st.st_size>0){
+            t=min(t,st.st_mtime);
+        }
+        info->log_period=t/info->rotate_period;
+    }
     
     FILE *fp_snapshot=fopen(info->snapshot_path, "rb+");
     if(NULL==fp_snapshot){
@@ -135,60 +193,300 @@ void close_files(fileinfo_t *info)
     if(info->socket_created){
         unlink(info->socket_path);
     }
+    if(info->coordinator.fd>=0){
+        close(info->coordinator.fd);
+        info->coordinator.fd=-1;
+    }
 }
 int write_log(thread_data_t *thread_data)
 {
     pthread_rwlock_rdlock(&thread_data->rwlock);
     board_t board=thread_data->board;
+    bool wide=thread_data->wide;
+    wide_board_t wide_board=thread_data->wide_board;
     uint32_t score_offset=thread_data->scoreoffset;
     uint32_t moveno=thread_data->moveno;
+    uint64_t seed=thread_data->seed;
     pthread_rwlock_unlock(&thread_data->rwlock);
 
     if (moveno==0 || board==0){
 	return E_INVAL;
     }
     worker_t *worker=thread_data->worker;
-    uint32_t score=score_board(worker->table_data,board)-score_offset;
-    uint16_t max_rank=(1<<get_max_rank(board));
+    uint32_t score=game_score(worker->table_data,board,wide,wide_board,score_offset);
+    uint32_t max_rank=(1U<<game_max_rank(board,wide,wide_board));
 
     pthread_mutex_lock(&worker->log_mutex);
-    fprintf(worker->fileinfo.fp_log,"%u,%u,%u,%016llx\n",moveno,score,max_rank,board);
+    // A shard sends the line to its coordinator, which logs it
+    fprintf(worker->fileinfo.fp_log,"%s%u,%u,%u,%016llx,%016llx\n",
+        (worker->fileinfo.coordinator.fd>=0) ? "L" : "",moveno,score,max_rank,(unsigned long long)board,
+        (unsigned long long)seed);
     fflush(worker->fileinfo.fp_log);
     pthread_mutex_unlock(&worker->log_mutex);
     return E_OK;
 }
-int read_snapshot(worker_t *worker)
+/* Log rotation. The log is renamed to the next segment number and reopened
+ * under the log mutex, so write_log never sees a closed file, and the lock
+ * test_running looks for moves to the new file. A background thread then
+ * encodes every text segment into a binary one (logseg.h), one at a time. */
+static bool log_index_has(const char *index_path, uint32_t seq)
 {
-    int i;
-    for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
-        board_t board=0;
-        uint32_t score_offset=0;
-        uint32_t moveno=0;
-        fscanf(worker->fileinfo.fp_snapshot,"%u,%u,%llx",&moveno,&score_offset,&board);
+    FILE *fp=fopen(index_path,"r");
+    if(NULL==fp){
+        return false;
+    }
+    char line[256];
+    bool found=false;
+    while(!found && fgets(line,sizeof(line),fp)!=NULL){
+        char *end;
+        unsigned long n=strtoul(line,&end,10);
+        found=(end!=line && *end==',' && n==seq);
+    }
+    fclose(fp);
+    return found;
+}
+/* A segment that was encoded and indexed before the daemon died, but whose
+ * text was not removed yet, is not encoded nor counted again. */
+static bool log_segment_done(const char *seg_path, const char *index_path, uint32_t seq)
+{
+    struct stat st;
+    logseg_t seg;
+    if(stat(seg_path,&st)!=0 || logseg_open(&seg,seg_path)!=E_OK){
+        return false;
+    }
+    logseg_close(&seg);
+    return log_index_has(index_path,seq);
+}
+static void encode_log_segment(fileinfo_t *info, uint32_t seq)
+{
+    char text_path[4096],seg_path[4096+8],index_path[4096+8];
+    snprintf(text_path,sizeof(text_path),"%s.%06u",info->log_path,seq);
+    struct stat st;
+    if(stat(text_path,&st)!=0){
+        return;
+    }
+    snprintf(seg_path,sizeof(seg_path),"%s.seg",text_path);
+    snprintf(index_path,sizeof(index_path),"%s.index",info->log_path);
+    if(log_segment_done(seg_path,index_path,seq)){
+        unlink(text_path);
+        return;
+    }
+    logseg_summary_t summary;
+    int rc=logseg_encode(text_path,seg_path,&summary,&info->encoder_stop);
+    if(rc!=E_OK){
+        if(rc!=E_AGAIN){
+            fprintf(stderr,"Failed to encode log segment %s.\n",text_path);
+        }
+        return;
+    }
+    FILE *fp=fopen(index_path,"a");
+    if(NULL==fp){
+        fprintf(stderr,"Failed to open log index %s.\n",index_path);
+    }else{
+        fprintf(fp,"%06u,%lld,%llu,%llu,%llu,%llu\n",seq,(long long)st.st_mtime,
+            (unsigned long long)summary.games,(unsigned long long)summary.skipped,
+            (unsigned long long)summary.text_bytes,(unsigned long long)summary.segment_bytes);
+        fclose(fp);
+    }
+    unlink(text_path);
+}
+static void* encoder_main(void *data)
+{
+    worker_t *worker=(worker_t*)data;
+    fileinfo_t *info=&worker->fileinfo;
+    uint32_t seq=1;
+    while(true){
+        pthread_mutex_lock(&worker->log_mutex);
+        uint32_t last=info->log_segment;
+        if(seq>last || info->encoder_stop){
+            info->encoder_running=false;
+            pthread_mutex_unlock(&worker->log_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&worker->log_mutex);
+        for(; seq<=last && !info->encoder_stop; seq++){
+            encode_log_segment(info,seq);
+        }
+    }
+    return NULL;
+}
+// Start encoding the rotated segments, unless the encoder is still running
+void encode_log_segments(worker_t *worker)
+{
+    fileinfo_t *info=&worker->fileinfo;
+    pthread_mutex_lock(&worker->log_mutex);
+    if(!info->encoder_running && info->log_segment>0 && !info->encoder_stop){
+        if(info->encoder!=0){
+            pthread_join(info->encoder,NULL);
+            info->encoder=0;
+        }
+        if(pthread_create(&info->encoder,NULL,encoder_main,worker)==0){
+            info->encoder_running=true;
+        }else{
+            info->encoder=0;
+        }
+    }
+    pthread_mutex_unlock(&worker->log_mutex);
+}
+// Interrupts the segment being encoded, which is encoded again on restart
+void stop_log_encoder(worker_t *worker)
+{
+    fileinfo_t *info=&worker->fileinfo;
+    info->encoder_stop=true;
+    if(info->encoder!=0){
+        pthread_join(info->encoder,NULL);
+        info->encoder=0;
+    }
+}
+int rotate_log(worker_t *worker)
+{
+    fileinfo_t *info=&worker->fileinfo;
+    char text_path[4096];
+    pthread_mutex_lock(&worker->log_mutex);
+    uint32_t seq=info->log_segment+1;
+    snprintf(text_path,sizeof(text_path),"%s.%06u",info->log_path,seq);
+    fflush(info->fp_log);
+    if(rename(info->log_path,text_path)!=0){
+        pthread_mutex_unlock(&worker->log_mutex);
+        fprintf(stderr,"Failed to rotate log file %s: %s.\n",info->log_path,strerror(errno));
+        return E_FILEIO;
+    }
+    FILE *fp_log=fopen(info->log_path,"a");
+    if(NULL==fp_log){
+        fprintf(stderr,"Failed to open log file %s: %s.\n",info->log_path,strerror(errno));
+        rename(text_path,info->log_path);
+        pthread_mutex_unlock(&worker->log_mutex);
+        return E_FILEIO;
+    }
+    flock(fileno(fp_log),LOCK_EX|LOCK_NB);
+    fclose(info->fp_log);
+    info->fp_log=fp_log;
+    info->log_segment=seq;
+    pthread_mutex_unlock(&worker->log_mutex);
+    encode_log_segments(worker);
+    return E_OK;
+}
+// Rotate the log once it reaches the size limit or a new period starts
+void log_rotation_handler(worker_t *worker)
+{
+    fileinfo_t *info=&worker->fileinfo;
+    if(info->rotate_size==0 && info->rotate_period==0){
+        return;
+    }
+    struct stat st;
+    if(fstat(fileno(info->fp_log),&st)!=0){
+        return;
+    }
+    time_t t=time(NULL);
+    bool new_period=(info->rotate_period>0 && t/info->rotate_period!=info->log_period);
+    bool full=(info->rotate_size>0 && (uint64_t)st.st_size>=info->rotate_size);
+    if((new_period || full) && st.st_size>0 && rotate_log(worker)!=E_OK){
+        return;
+    }
+    if(info->rotate_period>0){
+        info->log_period=t/info->rotate_period;
+    }
+}
+/* Games past the current thread count are parked, so that a snapshot written
+ * by a daemon with more threads is resumed as the thread count grows.
+ * Each line holds moveno,scoreoffset,board,seed,generator state. Lines of older
+ * snapshots lack the last two, such games continue with a fresh generator and
+ * are logged with seed 0. Games past 32768 add their wide board as 32 hex
+ * digits, high half first. */
+bool parse_saved_game(const char *line, saved_game_t *game)
+{
+    unsigned long long board=0,seed=0,wide_hi=0,wide_lo=0;
+    char state[RANDOM_STATE_SIZE]="";
+    int n=sscanf(line,"%u,%u,%llx,%llx,%39[^,\n],%16llx%16llx",&game->moveno,&game->scoreoffset,&board,&seed,
+        state,&wide_hi,&wide_lo);
+    if(n<3 || game->moveno==0 || board==0){
+        return false;
+    }
+    game->board=board;
+    game->wide=(n==7);
+    game->wide_board.half[1]=wide_hi;
+    game->wide_board.half[0]=wide_lo;
+    game->seed=seed;
+    if(n<5 || !loadRandom(&game->rand,game->seed,state)){
+        game->seed=0;
+        initRandom(&game->rand,new_game_seed());
+    }
+    return true;
+}
+// Give the game to thread `*next`, or park it once every thread has one
+void restore_game(worker_t *worker, uint32_t *next, const saved_game_t *game)
+{
+    if(*next<worker->thread_count){
+        thread_data_t *thread_data=worker->thread_data[(*next)++];
         pthread_rwlock_wrlock(&thread_data->rwlock);
-        thread_data->moveno=moveno;
-        thread_data->scoreoffset=score_offset;
-        thread_data->board=board;
+        thread_data->moveno=game->moveno;
+        thread_data->scoreoffset=game->scoreoffset;
+        thread_data->board=game->board;
+        thread_data->wide=game->wide;
+        thread_data->wide_board=game->wide_board;
+        thread_data->seed=game->seed;
+        thread_data->rand=game->rand;
         pthread_rwlock_unlock(&thread_data->rwlock);
+    }else{
+        worker_park_game(worker,game);
+    }
+}
+int read_snapshot(worker_t *worker)
+{
+    uint32_t i=0;
+    char line[256];
+    while(fgets(line,sizeof(line),worker->fileinfo.fp_snapshot)!=NULL){
+        saved_game_t game;
+        if(parse_saved_game(line,&game)){
+            restore_game(worker,&i,&game);
+        }
     }
     return E_OK;
 }
+void write_saved_game(FILE *fp, const saved_game_t *game)
+{
+    char state[RANDOM_STATE_SIZE];
+    saveRandom(&game->rand,state,sizeof(state));
+    fprintf(fp,"%u,%u,%016llx,%016llx,%s",game->moveno,game->scoreoffset,
+        (unsigned long long)game->board,(unsigned long long)game->seed,state);
+    if(game->wide){
+        fprintf(fp,",%016llx%016llx",(unsigned long long)game->wide_board.half[1],
+            (unsigned long long)game->wide_board.half[0]);
+    }
+    fprintf(fp,"\n");
+}
 int write_snapshot(worker_t *worker)
 {
+    if(worker->fileinfo.coordinator.fd>=0){
+        return shard_send_snapshot(worker);
+    }
     FILE *fp=worker->fileinfo.fp_snapshot;
     fseek(fp,0,SEEK_SET);
     ftruncate(fileno(fp), 0);
     fseek(fp,0,SEEK_SET);
+    if(NULL!=worker->coordinator){
+        coordinator_write_snapshot(worker,fp);
+        fflush(fp);
+        return E_OK;
+    }
     int i;
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
+        thread_data_t *thread_data=worker->thread_data[i];
+        saved_game_t game;
         pthread_rwlock_rdlock(&(thread_data->rwlock));
-        board_t board=thread_data->board;
-        uint32_t score_offset=thread_data->scoreoffset;
-        uint32_t moveno=thread_data->moveno;
+        game.moveno=thread_data->moveno;
+        game.scoreoffset=thread_data->scoreoffset;
+        game.board=thread_data->board;
+        game.wide=thread_data->wide;
+        game.wide_board=thread_data->wide_board;
+        game.seed=thread_data->seed;
+        game.rand=thread_data->rand;
         pthread_rwlock_unlock(&(thread_data->rwlock));
-        fprintf(fp,"%u,%u,%016llx\n",moveno,score_offset,board);
+        write_saved_game(fp,&game);
+    }
+    uint32_t j;
+    for (j = 0; j < worker->parked_count; j++) {
+        write_saved_game(fp,&(worker->parked[j]));
     }
     fflush(fp);
     return E_OK;
@@ -229,13 +527,15 @@ static void output_board_all(int fd,worker_t *worker)
     }
     uint16_t i;
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
+        thread_data_t *thread_data=worker->thread_data[i];
         pthread_rwlock_rdlock(&(thread_data->rwlock));
         board_t board=thread_data->board;
+        bool wide=thread_data->wide;
+        wide_board_t wide_board=thread_data->wide_board;
         uint32_t score_offset=thread_data->scoreoffset;
         uint32_t moveno=thread_data->moveno;
         pthread_rwlock_unlock(&(thread_data->rwlock));
-        uint32_t score=score_board(worker->table_data,board)-score_offset;
+        uint32_t score=game_score(worker->table_data,board,wide,wide_board,score_offset);
         snprintf(buf,sizeof(buf),"%u,%u,%u,%016llx\n",i,moveno,score,board);
         int rc=write(fd,buf,strlen(buf));
         if(rc<=0){
@@ -243,6 +543,125 @@ static void output_board_all(int fd,worker_t *worker)
         }
     }
 }
+#define STATS_SLOWEST_COUNT (8)
+static void output_stats(int fd,worker_t *worker)
+{
+    stats_t *stats=&worker->stats;
+    char buf[4096];
+    uint16_t i,j;
+    int lines=0;
+    size_t len=0;
+#define APPEND(...) do{ \
+        int n=snprintf(buf+len,sizeof(buf)-len,__VA_ARGS__); \
+        if(n>0){ len=min(len+n,sizeof(buf)-1); } \
+    }while(0)
+#define NEWLINE() do{ APPEND("\n"); lines++; }while(0)
+
+    time_t uptime=time(NULL)-stats->start_time;
+    APPEND("uptime %ld",(long)uptime); NEWLINE();
+    APPEND("games %u",worker->thread_count); NEWLINE();
+    APPEND("moves %llu",(unsigned long long)__atomic_load_n(&stats->moves_total,__ATOMIC_RELAXED)); NEWLINE();
+    APPEND("moves_per_sec %.1f",stats->moves_per_sec); NEWLINE();
+    APPEND("evictions %llu",(unsigned long long)__atomic_load_n(&stats->evictions_total,__ATOMIC_RELAXED)); NEWLINE();
+
+    pthread_mutex_lock(&stats->completed_mutex);
+    uint64_t completed=stats->games_completed;
+    APPEND("games_completed %llu",(unsigned long long)completed); NEWLINE();
+    APPEND("games_per_hour %.1f",uptime>0 ? completed*3600.0/uptime : 0.0); NEWLINE();
+    APPEND("completed_score %.0f %u",completed>0 ? (double)stats->completed_score_sum/completed : 0.0,
+        stats->completed_score_max); NEWLINE();
+    APPEND("completed_moves %.0f %u",completed>0 ? (double)stats->completed_moves_sum/completed : 0.0,
+        stats->completed_moves_max); NEWLINE();
+    APPEND("completed_tile");
+    for(i=1; i<STATS_RANK_COUNT; i++){
+        if(stats->completed_rank[i]>0){
+            APPEND(" %u:%llu",1U<<i,(unsigned long long)stats->completed_rank[i]);
+        }
+    }
+    NEWLINE();
+    pthread_mutex_unlock(&stats->completed_mutex);
+
+    APPEND("current_tile");
+    for(i=1; i<STATS_RANK_COUNT; i++){
+        uint32_t count=__atomic_load_n(&stats->current_rank[i],__ATOMIC_RELAXED);
+        if(count>0){
+            APPEND(" %u:%u",1U<<i,count);
+        }
+    }
+    NEWLINE();
+    APPEND("current_score");
+    for(i=0; i<STATS_SCORE_BUCKETS; i++){
+        uint32_t count=__atomic_load_n(&stats->current_score[i],__ATOMIC_RELAXED);
+        if(count>0){
+            APPEND(" %u:%u",i>0 ? 1U<<i : 0,count);
+        }
+    }
+    NEWLINE();
+
+    // Keep the slowest games sorted by insertion, only a handful are reported
+    uint16_t slowest_idx[STATS_SLOWEST_COUNT];
+    uint32_t slowest_usec[STATS_SLOWEST_COUNT];
+    uint16_t slowest_count=0;
+    for(i=0; i<worker->thread_count; i++){
+        thread_data_t *thread_data=worker->thread_data[i];
+        pthread_rwlock_rdlock(&(thread_data->rwlock));
+        uint32_t usec=thread_data->last_move_usec;
+        pthread_rwlock_unlock(&(thread_data->rwlock));
+        if(slowest_count==STATS_SLOWEST_COUNT && usec<=slowest_usec[slowest_count-1]){
+            continue;
+        }
+        if(slowest_count<STATS_SLOWEST_COUNT){
+            slowest_count++;
+        }
+        for(j=slowest_count-1; j>0 && slowest_usec[j-1]<usec; j--){
+            slowest_idx[j]=slowest_idx[j-1];
+            slowest_usec[j]=slowest_usec[j-1];
+        }
+        slowest_idx[j]=i;
+        slowest_usec[j]=usec;
+    }
+    APPEND("slowest");
+    for(i=0; i<slowest_count; i++){
+        APPEND(" %u:%u",slowest_idx[i],slowest_usec[i]);
+    }
+    NEWLINE();
+#undef NEWLINE
+#undef APPEND
+
+    char header[32];
+    snprintf(header,sizeof(header),"%d\n",lines);
+    if(write(fd,header,strlen(header))<=0 || write(fd,buf,len)<=0){
+        fprintf(stderr,"Failed to write pipe %d\n",errno);
+    }
+}
+// "n<count>\n" changes the number of concurrent games, the reply is the resulting count
+static void resize_handler(int fd,worker_t *worker)
+{
+    char buf[16];
+    size_t len=0;
+    uint16_t retry=100;
+    while(len<sizeof(buf)-1 && retry>0){
+        int rc=read(fd,buf+len,1);
+        if(rc<0 && errno==EAGAIN){
+            retry--;
+            usleep(1000);
+            continue;
+        }else if(rc<=0 || buf[len]=='\n'){
+            break;
+        }
+        len++;
+    }
+    buf[len]='\0';
+    char *end=NULL;
+    unsigned long count=strtoul(buf,&end,10);
+    if(len==0 || *end!='\0' || worker_resize(worker,count)!=E_OK){
+        fprintf(stderr,"Failed to resize to %s games\n",buf);
+    }
+    snprintf(buf,sizeof(buf),"%u\n",worker->thread_count);
+    if(write(fd,buf,strlen(buf))<=0){
+        fprintf(stderr,"Failed to write pipe %d\n",errno);
+    }
+}
 static int session_handler(worker_t *worker,int fd)
 {
     char cmd='\0';
@@ -261,6 +680,14 @@ static int session_handler(worker_t *worker,int fd)
         case 'b':
             output_board_all(fd,worker);
         break;
+        case 'S':
+        case 's':
+            output_stats(fd,worker);
+        break;
+        case 'N':
+        case 'n':
+            resize_handler(fd,worker);
+        break;
     }
     return E_OK;
 }
@@ -15,6 +15,13 @@ int wait_daemon(bool start_action,const char *socket_path,time_t timeout);
 int init_files(fileinfo_t *info);
 void close_files(fileinfo_t *info);
 int write_log(thread_data_t *thread_data);
+int rotate_log(worker_t *worker);
+void log_rotation_handler(worker_t *worker);
+void encode_log_segments(worker_t *worker);
+void stop_log_encoder(worker_t *worker);
+bool parse_saved_game(const char *line, saved_game_t *game);
+void write_saved_game(FILE *fp, const saved_game_t *game);
+void restore_game(worker_t *worker, uint32_t *next, const saved_game_t *game);
 int read_snapshot(worker_t *worker);
 int write_snapshot(worker_t *worker);
 void socket_handler(worker_t *worker);
@@ -0,0 +1,76 @@
+#ifndef __game_h__
+#define __game_h__
+
+#include "2048.h"
+#include "wide.h"
+#include "square.h"
+#include "random.h"
+
+// For game play
+static inline board_t draw_tile(rand_t *rand) {
+    return (getRandom(rand) & 1) ? 2 : 1;
+}
+static inline board_t insert_tile_rand(rand_t *rand, board_t board, board_t tile) {
+    int index = getRandom(rand) % (count_empty(board));
+    board_t tmp = board;
+    while (true) {
+        while ((tmp & 0xf) != 0) {
+            tmp >>= 4;
+            tile <<= 4;
+        }
+        if (index == 0) break;
+        --index;
+        tmp >>= 4;
+        tile <<= 4;
+    }
+    return board | tile;
+}
+// Same as insert_tile_rand(), drawing the same numbers
+static inline wide_board_t wide_insert_tile_rand(rand_t *rand, wide_board_t board, board_t tile) {
+    int index = getRandom(rand) % (wide_count_empty(board));
+    int i;
+    for (i = 0; i < 16; i++) {
+        if (wide_get(board, i) == 0) {
+            if (index == 0) break;
+            --index;
+        }
+    }
+    return wide_set(board, i, tile);
+}
+// The draws are sequenced so a seed opens the same under every compiler
+static inline board_t new_board(rand_t *rand) {
+    board_t tile = draw_tile(rand);
+    int pos = getRandom(rand) % 16;
+    board_t board = tile << (4 * pos);
+    return insert_tile_rand(rand, board, draw_tile(rand));
+}
+// The same for a `size` x `size` board
+static inline square_board_t square_insert_tile_rand(rand_t *rand, int size, square_board_t board, board_t tile) {
+    int index = getRandom(rand) % (square_count_empty(size, board));
+    int i;
+    for (i = 0; i < size * size; i++) {
+        if (square_get(board, i) == 0) {
+            if (index == 0) break;
+            --index;
+        }
+    }
+    return square_set(board, i, tile);
+}
+static inline square_board_t new_square_board(rand_t *rand, int size) {
+    int pos = getRandom(rand) % (size * size);
+    board_t tile = draw_tile(rand);
+    square_board_t board = square_set(0, pos, tile);
+    return square_insert_tile_rand(rand, size, board, draw_tile(rand));
+}
+
+/* Score and max rank of a game. Games past 32768 play on `wide_board` and
+ * `board` only shows their big tiles as 32768. */
+static inline uint32_t game_score(table_data_t *table, board_t board, bool wide, wide_board_t wide_board,
+    uint32_t scoreoffset) {
+    return (wide ? wide_score_board(wide_board) : (uint32_t)score_board(table, board)) - scoreoffset;
+}
+static inline uint8_t game_max_rank(board_t board, bool wide, wide_board_t wide_board) {
+    return wide ? wide_get_max_rank(wide_board) : get_max_rank(board);
+}
+
+#endif
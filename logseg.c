@@ -0,0 +1,250 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "logseg.h"
+
+#define HEX_ROW_NONE 0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+#define HEX_ROW_ALPHA 0xff,10,11,12,13,14,15,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff
+
+// Value of every hex digit, 0xff for other characters
+const uint8_t log_hex_digits[256]={
+    HEX_ROW_NONE,HEX_ROW_NONE,HEX_ROW_NONE,
+    0,1,2,3,4,5,6,7,8,9,0xff,0xff,0xff,0xff,0xff,0xff,
+    HEX_ROW_ALPHA,HEX_ROW_NONE,HEX_ROW_ALPHA,HEX_ROW_NONE,
+    HEX_ROW_NONE,HEX_ROW_NONE,HEX_ROW_NONE,HEX_ROW_NONE,
+    HEX_ROW_NONE,HEX_ROW_NONE,HEX_ROW_NONE,HEX_ROW_NONE
+};
+
+bool logseg_detect(const void *data, size_t size)
+{
+    uint64_t magic;
+    if(size<sizeof(magic)){
+        return false;
+    }
+    memcpy(&magic,data,sizeof(magic));
+    return magic==LOGSEG_MAGIC;
+}
+// Check the segment in `data` and point `seg` into it
+int logseg_map(logseg_t *seg, const void *data, size_t size)
+{
+    memset(seg,0,sizeof(*seg));
+    if(size<sizeof(logseg_header_t)){
+        return E_INVAL;
+    }
+    const logseg_header_t *header=(const logseg_header_t*)data;
+    if(header->magic!=LOGSEG_MAGIC || header->version!=LOGSEG_VERSION ||
+        header->block_games!=LOGSEG_BLOCK_GAMES ||
+        header->index_offset<sizeof(logseg_header_t) || header->index_offset>size){
+        return E_INVAL;
+    }
+    uint64_t block_count=(header->games+LOGSEG_BLOCK_GAMES-1)/LOGSEG_BLOCK_GAMES;
+    if(block_count>(size-header->index_offset)/sizeof(uint64_t)){
+        return E_INVAL;
+    }
+    seg->data=(const uint8_t*)data;
+    seg->size=size;
+    seg->records=seg->data+sizeof(logseg_header_t);
+    seg->records_end=seg->data+header->index_offset;
+    seg->blocks=(const uint64_t*)seg->records_end;
+    seg->block_count=block_count;
+    seg->games=header->games;
+    uint64_t i;
+    for(i=0; i<block_count; i++){
+        if(seg->blocks[i]<sizeof(logseg_header_t) || seg->blocks[i]>=header->index_offset ||
+            (i>0 && seg->blocks[i]<=seg->blocks[i-1])){
+            memset(seg,0,sizeof(*seg));
+            return E_INVAL;
+        }
+    }
+    return E_OK;
+}
+/* Map the segment at `path`. Returns E_INVAL without a message when the file
+ * is not a segment, so callers can fall back to reading text. */
+int logseg_open(logseg_t *seg, const char *path)
+{
+    memset(seg,0,sizeof(*seg));
+    int fd=open(path,O_RDONLY);
+    if(fd<0){
+        fprintf(stderr,"Failed to open %s: %s.\n",path,strerror(errno));
+        return E_FILEIO;
+    }
+    struct stat st;
+    uint64_t magic;
+    if(fstat(fd,&st)!=0 || pread(fd,&magic,sizeof(magic),0)!=sizeof(magic) || magic!=LOGSEG_MAGIC){
+        close(fd);
+        return E_INVAL;
+    }
+    void *map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(MAP_FAILED==map){
+        fprintf(stderr,"Failed to map %s: %s.\n",path,strerror(errno));
+        return E_FILEIO;
+    }
+    if(logseg_map(seg,map,st.st_size)!=E_OK){
+        fprintf(stderr,"Invalid log segment %s.\n",path);
+        munmap(map,st.st_size);
+        return E_INVAL;
+    }
+    seg->map=map;
+    return E_OK;
+}
+void logseg_close(logseg_t *seg)
+{
+    if(NULL!=seg->map){
+        munmap(seg->map,seg->size);
+    }
+    memset(seg,0,sizeof(*seg));
+}
+
+static inline uint8_t *write_varint(uint8_t *p, uint32_t v)
+{
+    while(v>=0x80){
+        *p++=(uint8_t)(v|0x80);
+        v>>=7;
+    }
+    *p++=(uint8_t)v;
+    return p;
+}
+// Parse the line at `*p` and move past it
+static bool parse_line(const char **p, const char *end, log_record_t *rec)
+{
+    const char *s=*p;
+    uint64_t board=0,seed=0;
+    bool valid=log_parse_dec(&s,end,&rec->moveno) && log_parse_dec(&s,end,&rec->score) &&
+        log_parse_dec(&s,end,&rec->max_tile) && log_parse_hex(&s,end,&board) && board!=0 &&
+        (s>=end || *s!=',' || (++s,log_parse_hex(&s,end,&seed))) &&
+        (rec->max_tile&(rec->max_tile-1))==0;
+    if(valid && s<end && *s=='\r'){
+        s++;
+    }
+    valid=valid && (s>=end || *s=='\n');
+    const char *nl=(s<end) ? (const char*)memchr(s,'\n',end-s) : NULL;
+    *p=(NULL!=nl) ? nl+1 : end;
+    rec->board=board;
+    rec->seed=seed;
+    return valid;
+}
+/* Encode the text log at `text_path` into the segment `seg_path`. The segment
+ * is written under a temporary name and synced before it is renamed, so the
+ * text can be removed once this returns E_OK. E_AGAIN when `cancel` was set,
+ * leaving no segment behind. */
+int logseg_encode(const char *text_path, const char *seg_path, logseg_summary_t *summary,
+    const volatile bool *cancel)
+{
+    memset(summary,0,sizeof(*summary));
+    int fd=open(text_path,O_RDONLY);
+    if(fd<0){
+        fprintf(stderr,"Failed to open %s: %s.\n",text_path,strerror(errno));
+        return E_FILEIO;
+    }
+    struct stat st;
+    if(fstat(fd,&st)!=0){
+        close(fd);
+        return E_FILEIO;
+    }
+    const char *text=NULL;
+    if(st.st_size>0){
+        text=(const char*)mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    }
+    close(fd);
+    if(MAP_FAILED==text){
+        fprintf(stderr,"Failed to map %s: %s.\n",text_path,strerror(errno));
+        return E_FILEIO;
+    }
+    if(NULL!=text){
+        madvise((void*)text,st.st_size,MADV_SEQUENTIAL);
+    }
+
+    char tmp_path[4096];
+    snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",seg_path);
+    FILE *fp=fopen(tmp_path,"wb");
+    uint64_t *blocks=NULL,block_size=0;
+    int rc=E_FILEIO;
+    if(NULL==fp){
+        fprintf(stderr,"Failed to create %s: %s.\n",tmp_path,strerror(errno));
+        goto exit;
+    }
+    setvbuf(fp,NULL,_IOFBF,1<<20);
+    logseg_header_t header;
+    memset(&header,0,sizeof(header));
+    if(fwrite(&header,sizeof(header),1,fp)!=1){
+        goto write_error;
+    }
+    uint64_t offset=sizeof(header);
+    const char *p=text,*end=text+st.st_size;
+    while(p<end){
+        log_record_t rec;
+        if(!parse_line(&p,end,&rec)){
+            summary->skipped++;
+            continue;
+        }
+        if(summary->games%LOGSEG_BLOCK_GAMES==0){
+            if(NULL!=cancel && *cancel){
+                rc=E_AGAIN;
+                goto exit;
+            }
+            uint64_t block=summary->games/LOGSEG_BLOCK_GAMES;
+            if(block>=block_size){
+                uint64_t size=max(block_size*2,256);
+                uint64_t *grown=(uint64_t*)realloc(blocks,size*sizeof(uint64_t));
+                if(NULL==grown){
+                    rc=E_NOSPACE;
+                    goto exit;
+                }
+                blocks=grown;
+                block_size=size;
+            }
+            blocks[block]=offset;
+        }
+        uint8_t buf[LOGSEG_RECORD_MAX],*q=buf;
+        q=write_varint(q,rec.moveno);
+        q=write_varint(q,rec.score);
+        *q++=(rec.max_tile>0) ? __builtin_ctz(rec.max_tile) : 0;
+        memcpy(q,&rec.board,sizeof(rec.board));
+        memcpy(q+8,&rec.seed,sizeof(rec.seed));
+        q+=16;
+        if(fwrite(buf,q-buf,1,fp)!=1){
+            goto write_error;
+        }
+        offset+=q-buf;
+        summary->games++;
+    }
+    uint64_t block_count=(summary->games+LOGSEG_BLOCK_GAMES-1)/LOGSEG_BLOCK_GAMES;
+    header.magic=LOGSEG_MAGIC;
+    header.version=LOGSEG_VERSION;
+    header.block_games=LOGSEG_BLOCK_GAMES;
+    header.games=summary->games;
+    header.index_offset=offset;
+    if(fwrite(blocks,sizeof(uint64_t),block_count,fp)!=block_count ||
+        fseek(fp,0,SEEK_SET)!=0 || fwrite(&header,sizeof(header),1,fp)!=1 ||
+        fflush(fp)!=0 || fsync(fileno(fp))!=0){
+        goto write_error;
+    }
+    rc=fclose(fp);
+    fp=NULL;
+    if(rc!=0 || rename(tmp_path,seg_path)!=0){
+        rc=E_FILEIO;
+        goto write_error;
+    }
+    summary->text_bytes=st.st_size;
+    summary->segment_bytes=offset+block_count*sizeof(uint64_t);
+    rc=E_OK;
+    goto exit;
+write_error:
+    fprintf(stderr,"Failed to write %s: %s.\n",tmp_path,strerror(errno));
+    rc=E_FILEIO;
+exit:
+    if(NULL!=fp){
+        fclose(fp);
+    }
+    if(rc!=E_OK){
+        unlink(tmp_path);
+    }
+    free(blocks);
+    if(NULL!=text){
+        munmap((void*)text,st.st_size);
+    }
+    return rc;
+}
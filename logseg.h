@@ -0,0 +1,207 @@
+#ifndef __logseg_h__
+#define __logseg_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "2048.h"
+
+/* Rotated log segments. The daemon renames its log to `log.NNNNNN` when it
+ * rotates, and a background thread re-encodes that text into the binary
+ * segment `log.NNNNNN.seg` and appends a line to `log.index`. A segment is a
+ * header, the records, then the offset of every LOGSEG_BLOCK_GAMES-th record
+ * so readers can start in the middle. A record is moveno and score as
+ * varints, the rank of the largest tile in a byte, then the board and seed as
+ * 8 little-endian bytes each, about 22 bytes against 52 for a text line.
+ * Each index line holds segment,rotated_at,games,skipped_lines,text_bytes,
+ * segment_bytes. */
+
+#define LOGSEG_MAGIC (0x4745534c38343032ULL)  // "2048LSEG"
+#define LOGSEG_VERSION (1)
+#define LOGSEG_BLOCK_GAMES (4096)
+#define LOGSEG_RECORD_MAX (5+5+1+8+8)
+
+typedef struct{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_games;
+    uint64_t games;
+    uint64_t index_offset;  // the records end here, the block offsets follow
+}logseg_header_t;
+
+typedef struct{
+    uint32_t moveno;
+    uint32_t score;
+    uint32_t max_tile;
+    board_t board;
+    uint64_t seed;          // 0 when unknown
+}log_record_t;
+
+typedef struct{
+    const uint8_t *data;
+    size_t size;
+    const uint8_t *records;
+    const uint8_t *records_end;
+    const uint64_t *blocks;  // file offsets of records 0, block_games, 2*block_games...
+    uint64_t block_count;
+    uint64_t games;
+    void *map;              // owned by logseg_open
+}logseg_t;
+
+typedef struct{
+    uint64_t games;
+    uint64_t skipped;
+    uint64_t text_bytes;
+    uint64_t segment_bytes;
+}logseg_summary_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const uint8_t log_hex_digits[256];
+
+bool logseg_detect(const void *data, size_t size);
+int logseg_map(logseg_t *seg, const void *data, size_t size);
+int logseg_open(logseg_t *seg, const char *path);
+void logseg_close(logseg_t *seg);
+int logseg_encode(const char *text_path, const char *seg_path, logseg_summary_t *summary,
+    const volatile bool *cancel);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* Parse a decimal field followed by a comma. Fields of up to 7 digits, with
+ * 8 bytes to read, are converted 8 bytes at a time: the first non-digit is
+ * found from the bytes whose value minus '0' is above 9, and the digits are
+ * combined pairwise by multiplications. */
+static inline bool log_parse_dec(const char **p, const char *end, uint32_t *value)
+{
+    const char *s=*p;
+    uint32_t v=0;
+    if(end-s>=8){
+        uint64_t x;
+        memcpy(&x,s,sizeof(x));
+        uint64_t d=x-0x3030303030303030ULL;
+        uint64_t stop=((d+0x7676767676767676ULL)|d)&0x8080808080808080ULL;
+        if(stop!=0){
+            int len=__builtin_ctzll(stop)/8;
+            if(len==0 || s[len]!=','){
+                return false;
+            }
+            d<<=8*(8-len);
+            d=((d&0x0F0F0F0F0F0F0F0FULL)*2561)>>8;
+            d=((d&0x00FF00FF00FF00FFULL)*6553601)>>16;
+            d=((d&0x0000FFFF0000FFFFULL)*42949672960001ULL)>>32;
+            *value=(uint32_t)d;
+            *p=s+len+1;
+            return true;
+        }
+    }
+    while(s<end && (unsigned)(*s-'0')<10){
+        v=v*10+(*s-'0');
+        s++;
+    }
+    if(s==*p || s>=end || *s!=','){
+        return false;
+    }
+    *value=v;
+    *p=s+1;
+    return true;
+}
+/* Parse a hex field ending the line or followed by a comma. Boards are
+ * always written with 16 digits, which are converted without a branch per
+ * digit. */
+static inline bool log_parse_hex(const char **p, const char *end, uint64_t *value)
+{
+    const char *s=*p;
+    uint64_t v=0;
+    if(end-s>=16){
+        uint8_t invalid=0;
+        int i;
+        for(i=0; i<16; i++){
+            uint8_t d=log_hex_digits[(unsigned char)s[i]];
+            invalid|=d;
+            v=(v<<4)|(d&0xf);
+        }
+        if(!(invalid&0xf0)){
+            s+=16;
+            if(s<end && *s!=',' && *s!='\r' && *s!='\n'){
+                return false;
+            }
+            *value=v;
+            *p=s;
+            return true;
+        }
+        v=0;
+    }
+    while(s<end && log_hex_digits[(unsigned char)*s]<16){
+        v=(v<<4)|log_hex_digits[(unsigned char)*s];
+        s++;
+    }
+    if(s==*p || s-*p>16 || (s<end && *s!=',' && *s!='\r' && *s!='\n')){
+        return false;
+    }
+    *value=v;
+    *p=s;
+    return true;
+}
+// Whether any of 8 bytes is a newline
+static inline bool log_has_newline(const char *s)
+{
+    uint64_t x;
+    memcpy(&x,s,sizeof(x));
+    x^=0x0a0a0a0a0a0a0a0aULL;
+    return ((x-0x0101010101010101ULL)&~x&0x8080808080808080ULL)!=0;
+}
+
+static inline uint32_t logseg_read_varint(const uint8_t **p)
+{
+    const uint8_t *s=*p;
+    uint32_t v=s[0]&0x7f;
+    int i=0;
+    while(s[i]&0x80 && i<4){
+        i++;
+        v|=(uint32_t)(s[i]&0x7f)<<(7*i);
+    }
+    *p=s+i+1;
+    return v;
+}
+/* Decode the record at `*p`, which must start before `end`. False when the
+ * record runs past `end`, i.e. the segment is damaged. */
+static inline bool logseg_read(const uint8_t **p, const uint8_t *end, log_record_t *rec)
+{
+    const uint8_t *s=*p;
+    if(end-s>=LOGSEG_RECORD_MAX){
+        rec->moveno=logseg_read_varint(&s);
+        rec->score=logseg_read_varint(&s);
+    }else{
+        // Near the end, check every byte of the varints
+        uint32_t *fields[2]={&rec->moveno,&rec->score};
+        int f;
+        for(f=0; f<2; f++){
+            uint32_t v=0;
+            int i=0;
+            do{
+                if(s>=end || i>4){
+                    return false;
+                }
+                v|=(uint32_t)(*s&0x7f)<<(7*i);
+                i++;
+            }while(*s++&0x80);
+            *fields[f]=v;
+        }
+        if(end-s<17){
+            return false;
+        }
+    }
+    uint8_t rank=*s++;
+    rec->max_tile=(rank>0 && rank<32) ? 1U<<rank : 0;
+    memcpy(&rec->board,s,sizeof(rec->board));
+    memcpy(&rec->seed,s+8,sizeof(rec->seed));
+    *p=s+16;
+    return true;
+}
+
+#endif
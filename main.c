@@ -1,18 +1,27 @@
 #include <signal.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <sys/sysinfo.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
 #include "2048.h"
 #include "fileio.h"
 #include "worker.h"
 #include "viewer.h"
+#include "shmstate.h"
+#include "game.h"
+#include "analyze.h"
+#include "coordinator.h"
+#include "evalserver.h"
 
 #define ENV_SNAPSHOT_FILE ("RUN2048_SNAPSHOT_FILE")
 #define ENV_LOG_FILE ("RUN2048_LOG_FILE")
 #define ENV_SOCKET_PATH ("RUN2048_SOCKET_PATH")
+#define ENV_SHM_NAME ("RUN2048_SHM_NAME")
+#define ENV_BOOK_FILE ("RUN2048_BOOK_FILE")
 
 #define DEFAULT_SNAPSHOT_FILE ("2048.snapshot")
 #define DEFAULT_LOG_FILE ("2048.log")
@@ -26,11 +35,35 @@ void print_help(const char *app_name){
     }else if(NULL!=app_name_last_win){
         app_name=app_name_last_win+1;
     }
-    fprintf(stderr,"Usage: %s [-h] [-d] [-s] [-n instances]\n",app_name);
+    fprintf(stderr,"Usage: %s [-h] [-d] [-s] [-D] [-n instances] [-r instances] [-m port|socket] [-p placement]\n"
+        "       [-j threads] [-S policy] [-4] [-R seed] [-b book] [-T size] [-M size]\n"
+        "       [-L size] [-I period] [-P shards] [-a log [-w from:to]] [-E socket]\n",app_name);
     fprintf(stderr,"       -h            Print help.\n");
     fprintf(stderr,"       -d            Start 2048 daemon.\n");
     fprintf(stderr,"       -s            Stop 2048 daemon.\n");
+    fprintf(stderr,"       -D            Start viewer in dashboard mode (toggle with 'd').\n");
     fprintf(stderr,"       -n instances  Specify instances for running.\n");
+    fprintf(stderr,"       -r instances  Change instances of the running daemon, stopped games are resumed later.\n");
+    fprintf(stderr,"       -m endpoint   Serve Prometheus metrics on a localhost port or a Unix socket.\n");
+    fprintf(stderr,"       -p placement  Pin games to CPUs: none, compact, scatter or numa.\n");
+    fprintf(stderr,"       -j threads    Run the searches of all games on a shared pool of threads.\n");
+    fprintf(stderr,"       -S policy     Order of shared searches: sjf (default) or fair.\n");
+    fprintf(stderr,"       -4            Keep the move tables in 4 KB pages instead of huge pages.\n");
+    fprintf(stderr,"       -b book       Play the opening from a book built by 2048book.\n");
+    fprintf(stderr,"       -T size       Cap the transposition table of each search, e.g. 64M.\n");
+    fprintf(stderr,"       -M size       Cap the transposition tables of all searches together, e.g. 2G.\n");
+    fprintf(stderr,"       -L size       Rotate the log when it reaches this size, e.g. 512M.\n");
+    fprintf(stderr,"       -I period     Rotate the log every period, e.g. 1d, aligned to the clock.\n");
+    fprintf(stderr,"                     Rotated logs are encoded into compact binary segments.\n");
+    fprintf(stderr,"       -P shards     Run the games in this many processes, or one per NUMA node with numa.\n");
+    fprintf(stderr,"       -R seed       Replay the game of a seed from the log and print its moves.\n");
+    fprintf(stderr,"       -a, --analyze log\n");
+    fprintf(stderr,"                     Print score, move and tile statistics of the games in a log or segment.\n");
+    fprintf(stderr,"       -w, --window from:to\n");
+    fprintf(stderr,"                     Analyze only the lines starting in this byte range, e.g. 1G: or -512M:.\n");
+    fprintf(stderr,"                     Games are logged as they end, so it is a window in time.\n");
+    fprintf(stderr,"       -E, --serve socket\n");
+    fprintf(stderr,"                     Answer board evaluations of clients on a Unix socket, searched on -j threads.\n");
 }
 uint16_t get_cpu_count()
 {
@@ -48,6 +81,84 @@ uint16_t get_cpu_count()
     }
     return max(res,1);
 }
+// A byte count with an optional K, M or G suffix, 0 when invalid
+size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long size=strtoull(str,&end,10);
+    switch(toupper((unsigned char)*end)){
+        case 'G':
+            size<<=10;
+            /* fall through */
+        case 'M':
+            size<<=10;
+            /* fall through */
+        case 'K':
+            size<<=10;
+            end++;
+        break;
+    }
+    if(end==str || *end!='\0'){
+        return 0;
+    }
+    return size;
+}
+// A duration in seconds with an optional s, m, h or d suffix, 0 when invalid
+time_t parse_period(const char *str)
+{
+    char *end;
+    unsigned long long period=strtoull(str,&end,10);
+    switch(tolower((unsigned char)*end)){
+        case 'd':
+            period*=24;
+            /* fall through */
+        case 'h':
+            period*=60;
+            /* fall through */
+        case 'm':
+            period*=60;
+            /* fall through */
+        case 's':
+            end++;
+        break;
+    }
+    if(end==str || *end!='\0'){
+        return 0;
+    }
+    return period;
+}
+/* A byte window "from:to" of a file of `size` bytes. Either end may be left
+ * out, and a negative one counts from the end of the file. */
+bool parse_window(const char *str,uint64_t size,uint64_t *from,uint64_t *to)
+{
+    const char *colon=strchr(str,':');
+    if(NULL==colon){
+        return false;
+    }
+    char part[32];
+    uint64_t *ends[2]={from,to};
+    const char *starts[2]={str,colon+1};
+    size_t lens[2]={(size_t)(colon-str),strlen(colon+1)};
+    int i;
+    for(i=0; i<2; i++){
+        *ends[i]=(i==0) ? 0 : size;
+        if(lens[i]==0){
+            continue;
+        }
+        if(lens[i]>=sizeof(part)){
+            return false;
+        }
+        memcpy(part,starts[i],lens[i]);
+        part[lens[i]]='\0';
+        bool negative=(part[0]=='-');
+        uint64_t value=parse_size(part+negative);
+        if(value==0 && strcmp(part+negative,"0")!=0){
+            return false;
+        }
+        *ends[i]=negative ? size-min(value,size) : min(value,size);
+    }
+    return *from<=*to;
+}
 const char *getfromenv(const char *key,const char *defval)
 {
     char *res=getenv(key);
@@ -56,16 +167,11 @@ const char *getfromenv(const char *key,const char *defval)
     }
     return res;
 }
-int do_stop_daemon(bool daemon_running,const char *socket_path){
-    if(!daemon_running){
-        fprintf(stderr,"2048 daemon is not running.\n");
-        return 1;
-    }
-    
+int connect_daemon(const char *socket_path){
     int fd=socket(PF_UNIX,SOCK_STREAM,0);
     if(fd<0){
         fprintf(stderr,"Failed to init socket.\n");
-        return 1;
+        return -1;
     }
     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
     
@@ -75,6 +181,18 @@ int do_stop_daemon(bool daemon_running,const char *socket_path){
     if(connect(fd,(struct sockaddr*)&addr,sizeof(addr)) < 0){
         fprintf(stderr,"Failed to open socket %s, maybe daemon is not running.\n",socket_path);
         close(fd);
+        return -1;
+    }
+    return fd;
+}
+int do_stop_daemon(bool daemon_running,const char *socket_path){
+    if(!daemon_running){
+        fprintf(stderr,"2048 daemon is not running.\n");
+        return 1;
+    }
+    
+    int fd=connect_daemon(socket_path);
+    if(fd<0){
         return 1;
     }
     
@@ -90,6 +208,165 @@ int do_stop_daemon(bool daemon_running,const char *socket_path){
     fprintf(stderr,"2048 daemon stopped.\n");
     return 0;
 }
+int do_resize_daemon(bool daemon_running,const char *socket_path,uint16_t thread_count){
+    if(!daemon_running){
+        fprintf(stderr,"2048 daemon is not running.\n");
+        return 1;
+    }
+    
+    int fd=connect_daemon(socket_path);
+    if(fd<0){
+        return 1;
+    }
+    
+    char buf[32];
+    snprintf(buf,sizeof(buf),"n%u\n",thread_count);
+    if(write(fd,buf,strlen(buf))<(ssize_t)strlen(buf)){
+        fprintf(stderr,"Failed to resize 2048 daemon.\n");
+        close(fd);
+        return 1;
+    }
+    
+    // Stopping games waits for their searches in progress
+    int rc=-1;
+    time_t t0=time(NULL);
+    do{
+        rc=read(fd,buf,sizeof(buf)-1);
+        if(rc<0 && errno==EAGAIN){
+            usleep(10000);
+        }
+    }while(rc<0 && errno==EAGAIN && time(NULL)-t0<60);
+    close(fd);
+    if(rc<=0){
+        fprintf(stderr,"Timeout.\n");
+        return 1;
+    }
+    buf[rc]='\0';
+    uint16_t result=strtoul(buf,NULL,10);
+    fprintf(stderr,"2048 daemon is running %u instances.\n",result);
+    return (result==thread_count) ? 0 : 1;
+}
+/* Play the game of `seed` again in the foreground, printing every move with
+ * its search counters and time. The moves are the same as in the daemon when
+ * given the same book, so a slow game from the log can be profiled on its own. */
+int do_replay_game(uint64_t seed,size_t trans_table_cap,const char *book_path){
+    table_data_t *table=alloc_node_tables(NULL,-1,true);
+    if(NULL==table){
+        fprintf(stderr,"Failed to allocate move tables.\n");
+        return 1;
+    }
+    set_trans_table_cap(trans_table_cap);
+    if(trans_table_cap>0){
+        fprintf(stderr,"Transposition tables capped at %llu bytes per search.\n",(unsigned long long)trans_table_cap);
+    }
+    book_t book;
+    memset(&book,0,sizeof(book));
+    if(NULL!=book_path && book_open(&book,book_path)!=E_OK){
+        fprintf(stderr,"Playing without opening book.\n");
+    }
+    rand_t rand;
+    initRandom(&rand,seed);
+    board_t board=new_board(&rand);
+    bool wide=false;
+    wide_board_t wide_board;
+    uint32_t moveno=0,scoreoffset=0;
+    printf("moveno,move,board,nodes,cachehits,maxdepth,usec,evictions\n");
+    while(true){
+        search_stats_t stats;
+        struct timespec t0,t1;
+        if(!wide && get_max_rank(board)>=WIDE_SWITCH_RANK){
+            wide=true;
+            wide_board=wide_from_board(board);
+        }
+        clock_gettime(CLOCK_MONOTONIC,&t0);
+        int move=wide ? -1 : book_lookup(&book,board);
+        if(move>=0 && execute_move(table,move,board)!=board){
+            memset(&stats,0,sizeof(stats));
+        }else if(wide){
+            move=find_best_move_wide(table,wide_board,&stats,NULL);
+        }else{
+            move=find_best_move(table,board,&stats);
+        }
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        if(move<0){
+            break;
+        }
+        board_t tile=draw_tile(&rand);
+        if(wide){
+            wide_board=wide_insert_tile_rand(&rand,wide_execute_move(table,move,wide_board),tile);
+            board=wide_to_board(wide_board);
+        }else{
+            board=insert_tile_rand(&rand,execute_move(table,move,board),tile);
+        }
+        moveno++;
+        if(tile==2){
+            scoreoffset+=4;
+        }
+        printf("%u,%d,%016llx,%lu,%u,%u,%llu,%lu\n",moveno,move,(unsigned long long)board,stats.moves_evaled,
+            stats.cachehits,stats.maxdepth,(unsigned long long)stats_elapsed_usec(&t0,&t1),stats.evictions);
+    }
+    fprintf(stderr,"%u,%u,%u,%016llx,%016llx\n",moveno,game_score(table,board,wide,wide_board,scoreoffset),
+        1U<<game_max_rank(board,wide,wide_board),(unsigned long long)board,(unsigned long long)seed);
+    book_close(&book);
+    free_node_tables(table);
+    return 0;
+}
+
+int do_analyze_log(const char *log_path,const char *window,uint16_t thread_count){
+    analyze_param_t param={
+        .log_path=log_path,
+        .from=0,
+        .to=UINT64_MAX,
+        .thread_count=thread_count
+    };
+    if(NULL!=window){
+        struct stat st;
+        if(stat(log_path,&st)!=0){
+            fprintf(stderr,"Failed to open %s.\n",log_path);
+            return 1;
+        }
+        if(!parse_window(window,st.st_size,&param.from,&param.to)){
+            fprintf(stderr,"Invalid window %s.\n",window);
+            return 1;
+        }
+    }
+    return (analyze_log(&param)==E_OK) ? 0 : 1;
+}
+
+// Shards by name, 0 when invalid
+uint16_t parse_shards(const char *str)
+{
+    if(strcmp(str,"numa")==0){
+        cpu_topology_t topology;
+        if(topology_read(&topology)!=E_OK){
+            return 0;
+        }
+        uint16_t count=topology.node_count;
+        topology_free(&topology);
+        return count;
+    }
+    unsigned long count=strtoul(str,NULL,10);
+    return (count<=MAX_SHARDS) ? count : 0;
+}
+
+volatile bool serve_stop=false;
+void do_stop_server(int signal)
+{
+    serve_stop=true;
+}
+/* Serve board evaluations in the foreground until SIGINT or SIGTERM. The
+ * searches run on a pool of `param->sched_threads` threads, all CPUs when
+ * not given. */
+int do_serve(eval_server_param_t *param)
+{
+    if(param->sched_threads==0){
+        param->sched_threads=get_cpu_count();
+    }
+    signal(SIGINT,do_stop_server);
+    signal(SIGTERM,do_stop_server);
+    signal(SIGPIPE,SIG_IGN);
+    return (eval_server_run(param,&serve_stop)==E_OK) ? 0 : 1;
+}
 
 worker_t *worker=NULL;
 void do_stop_worker(int signal)
@@ -99,22 +376,168 @@ void do_stop_worker(int signal)
     }
     worker->running=false;
 }
+/* A shard process of a sharded daemon, started by its coordinator with the
+ * channel on SHARD_FD. It plays the games handed out to it until told to stop
+ * or until the coordinator goes away. */
+int do_run_shard(worker_param_t *param)
+{
+    signal(SIGINT,SIG_IGN);
+    signal(SIGQUIT,SIG_IGN);
+    signal(SIGPIPE,SIG_IGN);
+    signal(SIGTERM,do_stop_worker);
+    worker=worker_start(param);
+    if(NULL==worker){
+        return 1;
+    }
+    time_t t0=time(NULL);
+    while(worker->running) {
+        shard_handler(worker);
+        stats_tick(&worker->stats);
+        time_t t=time(NULL);
+        if((t-t0)>=1){
+            t0=t;
+            write_snapshot(worker);
+        }
+    }
+    worker_stop(worker);
+    return 0;
+}
 int main(int argc, char *argv[]) {
     volatile uint16_t proc_cnt = 0;
     const char *filename_snapshot=getfromenv(ENV_SNAPSHOT_FILE,DEFAULT_SNAPSHOT_FILE);
     const char *filename_log=getfromenv(ENV_LOG_FILE,DEFAULT_LOG_FILE);
     const char *socket_path=getfromenv(ENV_SOCKET_PATH,DEFAULT_SOCKET_PATH);
+    char default_shm_name[SHM_NAME_MAX];
+    shm_state_default_name(socket_path,default_shm_name,sizeof(default_shm_name));
+    const char *shm_name=getfromenv(ENV_SHM_NAME,default_shm_name);
     bool viewer=true;
     bool stop_daemon=false;
+    uint16_t resize_cnt=0;
+    bool dashboard=false;
+    const char *metrics_endpoint=NULL;
+    int placement=PLACEMENT_NONE;
+    uint16_t sched_threads=0;
+    int sched_policy=SCHED_SJF;
+    bool huge_pages=true;
+    uint64_t replay_seed=0;
+    const char *book_path=getenv(ENV_BOOK_FILE);
+    size_t trans_table_search=0,trans_table_daemon=0;
+    const char *analyze_path=NULL,*window=NULL,*serve_path=NULL;
+    uint64_t log_rotate_size=0;
+    time_t log_rotate_period=0;
+    uint16_t shard_count=0;
+    bool shard=false;
+    static const struct option long_options[]={
+        {"analyze",required_argument,NULL,'a'},
+        {"window",required_argument,NULL,'w'},
+        {"shard",required_argument,NULL,'X'},
+        {"serve",required_argument,NULL,'E'},
+        {NULL,0,NULL,0}
+    };
     unsigned char opt;
-    while((opt=getopt(argc,argv,"hdsn:")) != 0xff){
+    while((opt=getopt_long(argc,argv,"hdsDn:r:m:p:j:S:4R:b:T:M:L:I:P:a:w:E:",long_options,NULL)) != 0xff){
         switch(opt){
+            case 'X':
+                // The index only tells the shards apart in the process list
+                shard=true;
+            break;
+            case 'P':
+                shard_count=parse_shards(optarg);
+                if(shard_count<1){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'a':
+                analyze_path=optarg;
+            break;
+            case 'w':
+                window=optarg;
+            break;
+            case 'E':
+                serve_path=optarg;
+            break;
             case 'd':
             	viewer=false;
             break;
             case 's':
             	stop_daemon=true;
             break;
+            case 'D':
+                dashboard=true;
+            break;
+            case 'r':
+                resize_cnt=strtoul(optarg,NULL,10);
+                if(resize_cnt<1 || resize_cnt>MAX_THREADS){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'm':
+                metrics_endpoint=optarg;
+            break;
+            case 'p':
+                placement=placement_parse(optarg);
+                if(placement<0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'b':
+                book_path=optarg;
+            break;
+            case 'R':
+                replay_seed=strtoull(optarg,NULL,16);
+                if(replay_seed==0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'T':
+                trans_table_search=parse_size(optarg);
+                if(trans_table_search<TRANS_TABLE_MIN_CAP){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'M':
+                trans_table_daemon=parse_size(optarg);
+                if(trans_table_daemon<TRANS_TABLE_MIN_CAP){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'L':
+                log_rotate_size=parse_size(optarg);
+                if(log_rotate_size==0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'I':
+                log_rotate_period=parse_period(optarg);
+                if(log_rotate_period==0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case '4':
+                huge_pages=false;
+            break;
+            case 'j':
+                sched_threads=strtoul(optarg,NULL,10);
+                if(sched_threads<1){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
+            case 'S':
+                sched_policy=sched_parse(optarg);
+                if(sched_policy<0){
+                    print_help(argv[0]);
+                    return 1;
+                }
+            break;
             case 'n':
                 proc_cnt=strtoul(optarg,NULL,10);
                 if(proc_cnt<1){
@@ -129,13 +552,52 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    if(replay_seed!=0){
+        // The cap of the daemon's searches, shared out as with the same -n and -j
+        uint16_t games=(proc_cnt>0) ? proc_cnt : max(get_cpu_count()/4,1);
+        size_t searches=(sched_threads>0) ? (size_t)sched_threads*SCHED_LIVE_SEARCHES : 4*(size_t)games;
+        size_t cap=trans_table_search_cap(trans_table_search,trans_table_daemon,searches);
+        return do_replay_game(replay_seed,cap,book_path);
+    }
+    if(NULL!=analyze_path){
+        return do_analyze_log(analyze_path,window,proc_cnt);
+    }
+    if(NULL!=serve_path){
+        eval_server_param_t param={
+            .socket_path=serve_path,
+            .sched_threads=sched_threads,
+            .sched_policy=sched_policy,
+            .huge_pages=huge_pages,
+            .book_path=book_path,
+            .trans_table_search=trans_table_search,
+            .trans_table_daemon=trans_table_daemon
+        };
+        return do_serve(&param);
+    }
+    if(shard){
+        worker_param_t param={
+            .thread_count=max(proc_cnt,1),
+            .placement=placement,
+            .sched_threads=sched_threads,
+            .sched_policy=sched_policy,
+            .huge_pages=huge_pages,
+            .book_path=book_path,
+            .trans_table_search=trans_table_search,
+            .trans_table_daemon=trans_table_daemon,
+            .shard=true
+        };
+        return do_run_shard(&param);
+    }
     bool daemon_running=test_running(filename_log,filename_snapshot);
     if(stop_daemon){
         return do_stop_daemon(daemon_running,socket_path);
     }
+    if(resize_cnt>0){
+        return do_resize_daemon(daemon_running,socket_path,resize_cnt);
+    }
     if(daemon_running){
         if(viewer){
-            return viewer2048(socket_path);
+            return viewer2048(socket_path,shm_name,dashboard);
         }else{
             fprintf(stderr,"2048 daemon is already running.\n");
             return 1;
@@ -148,7 +610,7 @@ int main(int argc, char *argv[]) {
             return 1;
         }
         if(viewer){
-            return viewer2048(socket_path);
+            return viewer2048(socket_path,shm_name,dashboard);
         }
         fprintf(stderr,"2048 daemon started.\n");
         return 0;
@@ -164,7 +626,19 @@ int main(int argc, char *argv[]) {
         .thread_count=proc_cnt,
         .log_path=filename_log,
         .snapshot_path=filename_snapshot,
-        .socket_path=socket_path
+        .socket_path=socket_path,
+        .shm_name=shm_name,
+        .metrics_endpoint=metrics_endpoint,
+        .placement=placement,
+        .sched_threads=sched_threads,
+        .sched_policy=sched_policy,
+        .huge_pages=huge_pages,
+        .book_path=book_path,
+        .trans_table_search=trans_table_search,
+        .trans_table_daemon=trans_table_daemon,
+        .log_rotate_size=log_rotate_size,
+        .log_rotate_period=log_rotate_period,
+        .shard_count=shard_count
     };
     worker=worker_start(&param);
     if(NULL==worker){
@@ -176,10 +650,14 @@ int main(int argc, char *argv[]) {
     time_t t0=time(NULL);
     while(worker->running) {
         socket_handler(worker);
+        metrics_handler(worker);
+        coordinator_handler(worker);
+        stats_tick(&worker->stats);
         time_t t=time(NULL);
         if((t-t0)>=1){
             t0=t;
             write_snapshot(worker);
+            log_rotation_handler(worker);
         }
         usleep(1000);
     }
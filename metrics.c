@@ -0,0 +1,282 @@
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "worker.h"
+#include "metrics.h"
+#include "coordinator.h"
+
+typedef struct{
+    char *data;
+    size_t len;
+    size_t size;
+}text_t;
+
+static void text_printf(text_t *text, const char *fmt, ...)
+{
+    va_list args;
+    while(true){
+        size_t avail=text->size-text->len;
+        va_start(args,fmt);
+        int n=vsnprintf(text->data+text->len,avail,fmt,args);
+        va_end(args);
+        if(n<0){
+            return;
+        }
+        if((size_t)n<avail){
+            text->len+=n;
+            return;
+        }
+        size_t size=max(text->size*2,text->len+n+4096);
+        char *data=(char*)realloc(text->data,size);
+        if(NULL==data){
+            return;
+        }
+        text->data=data;
+        text->size=size;
+    }
+}
+static void text_metric(text_t *text, const char *name, const char *type, const char *help)
+{
+    text_printf(text,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+// Histogram of log2 buckets, bucket i holding values in [2^i, 2^(i+1))
+static void text_log2_histogram(text_t *text, const char *name, const uint64_t *hist,
+    uint8_t buckets, uint64_t sum)
+{
+    uint64_t count=0;
+    uint8_t i;
+    for(i=0; i<buckets-1; i++){
+        count+=hist[i];
+        text_printf(text,"%s_bucket{le=\"%llu\"} %llu\n",name,
+            (unsigned long long)((2ULL<<i)-1),(unsigned long long)count);
+    }
+    count+=hist[buckets-1];
+    text_printf(text,"%s_bucket{le=\"+Inf\"} %llu\n",name,(unsigned long long)count);
+    text_printf(text,"%s_sum %llu\n",name,(unsigned long long)sum);
+    text_printf(text,"%s_count %llu\n",name,(unsigned long long)count);
+}
+static void format_metrics(worker_t *worker, text_t *text)
+{
+    stats_t *stats=&worker->stats;
+    uint16_t i;
+
+    text_metric(text,"game2048_uptime_seconds","gauge","Seconds since the daemon started.");
+    text_printf(text,"game2048_uptime_seconds %ld\n",(long)(time(NULL)-stats->start_time));
+    text_metric(text,"game2048_games_running","gauge","Number of games played concurrently.");
+    text_printf(text,"game2048_games_running %u\n",worker->thread_count);
+    text_metric(text,"game2048_moves_total","counter","Moves played by all games.");
+    text_printf(text,"game2048_moves_total %llu\n",
+        (unsigned long long)__atomic_load_n(&stats->moves_total,__ATOMIC_RELAXED));
+    text_metric(text,"game2048_search_nodes_total","counter","Search nodes evaluated by all games.");
+    text_printf(text,"game2048_search_nodes_total %llu\n",
+        (unsigned long long)__atomic_load_n(&stats->nodes_total,__ATOMIC_RELAXED));
+    text_metric(text,"game2048_book_moves_total","counter","Moves taken from the opening book without searching.");
+    text_printf(text,"game2048_book_moves_total %llu\n",
+        (unsigned long long)__atomic_load_n(&stats->book_moves_total,__ATOMIC_RELAXED));
+    text_metric(text,"game2048_trans_table_evictions_total","counter","Transposition table entries replaced because a search reached its byte cap.");
+    text_printf(text,"game2048_trans_table_evictions_total %llu\n",
+        (unsigned long long)__atomic_load_n(&stats->evictions_total,__ATOMIC_RELAXED));
+    text_metric(text,"game2048_trans_table_cap_bytes","gauge","Byte cap of the transposition table of each search, 0 when unlimited.");
+    text_printf(text,"game2048_trans_table_cap_bytes %llu\n",(unsigned long long)worker->trans_table_cap);
+    text_metric(text,"game2048_moves_per_second","gauge","Moves per second, averaged over about 10 seconds.");
+    text_printf(text,"game2048_moves_per_second %.3f\n",stats->moves_per_sec);
+    text_metric(text,"game2048_search_nodes_per_second","gauge","Search nodes per second, averaged over about 10 seconds.");
+    text_printf(text,"game2048_search_nodes_per_second %.0f\n",stats->nodes_per_sec);
+
+    text_metric(text,"game2048_current_max_tile_games","gauge","Running games by their current max tile.");
+    for(i=1; i<STATS_RANK_COUNT; i++){
+        text_printf(text,"game2048_current_max_tile_games{tile=\"%u\"} %u\n",1U<<i,
+            __atomic_load_n(&stats->current_rank[i],__ATOMIC_RELAXED));
+    }
+
+    pthread_mutex_lock(&stats->completed_mutex);
+    text_metric(text,"game2048_games_completed_total","counter","Games completed since the daemon started.");
+    text_printf(text,"game2048_games_completed_total %llu\n",(unsigned long long)stats->games_completed);
+    text_metric(text,"game2048_completed_score","histogram","Final score of completed games.");
+    text_log2_histogram(text,"game2048_completed_score",stats->completed_score_hist,
+        STATS_SCORE_BUCKETS,stats->completed_score_sum);
+    text_metric(text,"game2048_completed_moves","histogram","Move count of completed games.");
+    text_log2_histogram(text,"game2048_completed_moves",stats->completed_moves_hist,
+        STATS_MOVES_BUCKETS,stats->completed_moves_sum);
+    text_metric(text,"game2048_completed_max_tile","histogram","Max tile of completed games.");
+    uint64_t count=0,sum=0;
+    for(i=1; i<STATS_RANK_COUNT; i++){
+        count+=stats->completed_rank[i];
+        sum+=stats->completed_rank[i]<<i;
+        text_printf(text,"game2048_completed_max_tile_bucket{le=\"%u\"} %llu\n",1U<<i,(unsigned long long)count);
+    }
+    text_printf(text,"game2048_completed_max_tile_bucket{le=\"+Inf\"} %llu\n",(unsigned long long)count);
+    text_printf(text,"game2048_completed_max_tile_sum %llu\n",(unsigned long long)sum);
+    text_printf(text,"game2048_completed_max_tile_count %llu\n",(unsigned long long)count);
+    pthread_mutex_unlock(&stats->completed_mutex);
+
+    text_metric(text,"game2048_thread_busy_seconds_total","counter","Time each game thread spent searching.");
+    for(i=0; i<worker->thread_count; i++){
+        thread_data_t *thread_data=worker->thread_data[i];
+        text_printf(text,"game2048_thread_busy_seconds_total{thread=\"%u\"} %.6f\n",i,
+            __atomic_load_n(&thread_data->busy_usec,__ATOMIC_RELAXED)/1000000.0);
+    }
+
+    const coordinator_t *c=worker->coordinator;
+    if(NULL!=c){
+        uint16_t running=0;
+        for(i=0; i<c->shard_count; i++){
+            running+=(c->shards[i].pid>0);
+        }
+        text_metric(text,"game2048_shards","gauge","Shard processes of the daemon.");
+        text_printf(text,"game2048_shards %u\n",c->shard_count);
+        text_metric(text,"game2048_shards_running","gauge","Shard processes currently running.");
+        text_printf(text,"game2048_shards_running %u\n",running);
+        text_metric(text,"game2048_shard_restarts_total","counter","Times each shard process was started again after it exited.");
+        for(i=0; i<c->shard_count; i++){
+            text_printf(text,"game2048_shard_restarts_total{shard=\"%u\"} %u\n",i,c->shards[i].restarts);
+        }
+    }
+}
+
+int metrics_open(metrics_t *metrics, const char *endpoint)
+{
+    size_t i;
+    metrics->endpoint=endpoint;
+    metrics->fd=-1;
+    metrics->unix_created=false;
+    for(i=0; i<METRICS_MAX_CLIENTS; i++){
+        metrics->clients[i]=-1;
+    }
+    if(NULL==endpoint){
+        return E_OK;
+    }
+
+    // A plain number is a localhost TCP port, anything else a Unix socket path
+    char *end=NULL;
+    unsigned long port=strtoul(endpoint,&end,10);
+    bool is_port=(*endpoint!='\0' && *end=='\0');
+    int fd=socket(is_port ? AF_INET : AF_UNIX,SOCK_STREAM,0);
+    if(fd<0){
+        fprintf(stderr,"Failed to create metrics socket: %s.\n",strerror(errno));
+        return E_FILEIO;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    metrics->fd=fd;
+    int rc;
+    if(is_port){
+        int reuse=1;
+        setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+        struct sockaddr_in addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin_family=AF_INET;
+        addr.sin_port=htons((uint16_t)port);
+        addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        rc=bind(fd,(const struct sockaddr *)&addr,sizeof(addr));
+    }else{
+        struct sockaddr_un addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sun_family=AF_UNIX;
+        strncpy(addr.sun_path,endpoint,sizeof(addr.sun_path)-1);
+        rc=bind(fd,(const struct sockaddr *)&addr,sizeof(addr));
+        metrics->unix_created=(rc==0);
+    }
+    if(rc!=0){
+        fprintf(stderr,"Failed to bind metrics endpoint %s: %s.\n",endpoint,strerror(errno));
+        goto error_exit;
+    }
+    if(listen(fd,METRICS_MAX_CLIENTS)<0){
+        fprintf(stderr,"Listen failed: %s\n",strerror(errno));
+        goto error_exit;
+    }
+    return E_OK;
+error_exit:
+    metrics_close(metrics);
+    return E_FILEIO;
+}
+void metrics_close(metrics_t *metrics)
+{
+    size_t i;
+    for(i=0; i<METRICS_MAX_CLIENTS; i++){
+        if(metrics->clients[i]>=0){
+            close(metrics->clients[i]);
+            metrics->clients[i]=-1;
+        }
+    }
+    if(metrics->fd>=0){
+        close(metrics->fd);
+        metrics->fd=-1;
+    }
+    if(metrics->unix_created){
+        unlink(metrics->endpoint);
+        metrics->unix_created=false;
+    }
+}
+static void metrics_respond(worker_t *worker, int fd)
+{
+    // Any request gets the metrics, only the scraper is expected to connect
+    char request[1024];
+    while(read(fd,request,sizeof(request))==sizeof(request));
+    text_t body={NULL,0,0};
+    format_metrics(worker,&body);
+    text_t response={NULL,0,0};
+    text_printf(&response,"HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %lu\r\n"
+        "Connection: close\r\n\r\n",(unsigned long)body.len);
+
+    // The scraper has already sent its request, give it a short time to drain the reply
+    struct timeval timeout={1,0};
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+    if(write(fd,response.data,response.len)<0 || write(fd,body.data,body.len)<0){
+        fprintf(stderr,"Failed to write metrics %d\n",errno);
+    }
+    free(response.data);
+    free(body.data);
+}
+void metrics_handler(worker_t *worker)
+{
+    metrics_t *metrics=&worker->metrics;
+    size_t i;
+    if(metrics->fd<0){
+        return;
+    }
+    fd_set readset;
+    FD_ZERO(&readset);
+    FD_SET(metrics->fd,&readset);
+    int maxfd=metrics->fd;
+    for(i=0; i<METRICS_MAX_CLIENTS; i++){
+        int fd=metrics->clients[i];
+        if(fd>=0){
+            FD_SET(fd,&readset);
+            maxfd=max(maxfd,fd);
+        }
+    }
+    struct timeval tm={0,0};
+    if(select(maxfd+1,&readset,NULL,NULL,&tm)<=0){
+        return;
+    }
+    if(FD_ISSET(metrics->fd,&readset)){
+        int clientfd=accept(metrics->fd,NULL,NULL);
+        if(clientfd>=0){
+            fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) | O_NONBLOCK);
+            for(i=0; i<METRICS_MAX_CLIENTS && metrics->clients[i]>=0; i++);
+            if(i<METRICS_MAX_CLIENTS){
+                metrics->clients[i]=clientfd;
+            }else{
+                close(clientfd);
+            }
+        }
+    }
+    for(i=0; i<METRICS_MAX_CLIENTS; i++){
+        int fd=metrics->clients[i];
+        if(fd<0 || !FD_ISSET(fd,&readset)){
+            continue;
+        }
+        metrics_respond(worker,fd);
+        close(fd);
+        metrics->clients[i]=-1;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef __metrics_h__
+#define __metrics_h__
+
+#include <stdbool.h>
+
+/* Prometheus text exposition of the daemon statistics, served over HTTP on
+ * either a Unix socket or a localhost-only TCP port. */
+
+#define METRICS_MAX_CLIENTS (8)
+
+typedef struct{
+    const char *endpoint;
+    int fd;
+    bool unix_created;
+    int clients[METRICS_MAX_CLIENTS];
+}metrics_t;
+
+struct worker_s;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int metrics_open(metrics_t *metrics, const char *endpoint);
+void metrics_close(metrics_t *metrics);
+void metrics_handler(struct worker_s *worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
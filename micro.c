@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include "2048.h"
+#include "game.h"
+#include "affinity.h"
+#include "logseg.h"
+
+/* Micro-benchmark of the board primitives of 2048.h and wide.h. The boards
+ * are positions of real games: the final boards of a daemon log, and the
+ * positions met while replaying the logged seeds with a shallow search, or
+ * fresh seeds without a log. Every primitive runs over all boards a number of
+ * times, and the time per call is reported with its spread over the runs.
+ * Each variant of a primitive is measured on the same positions: the nibble
+ * board, the wide board of games past 32768, and for moves the batch kernel
+ * and expand_all_moves(). */
+
+#define MICRO_SEED (2048)
+#define MICRO_DEFAULT_BOARDS (65536)
+#define MICRO_DEFAULT_RUNS (20)
+#define MICRO_DEFAULT_DEPTH (1)
+
+typedef struct{
+    board_t *boards;
+    uint64_t count;
+    uint64_t size;
+}board_list_t;
+
+typedef struct{
+    table_data_t *table;
+    table_data_t *scratch;      // rebuilt by init_tables
+    const board_t *boards;
+    const wide_board_t *wide_boards;
+    board_t *results;
+    uint64_t count;
+}micro_data_t;
+
+typedef struct{
+    const char *name;
+    const char *variant;
+    uint64_t (*run)(const micro_data_t *data);
+    int ops_per_board;          // 0 for a single call per run
+}micro_case_t;
+
+static volatile uint64_t sink;
+
+static int add_board(board_list_t *list, board_t board)
+{
+    if(list->count>=list->size){
+        uint64_t size=max(list->size*2,4096);
+        board_t *boards=(board_t*)realloc(list->boards,size*sizeof(board_t));
+        if(NULL==boards){
+            return E_NOSPACE;
+        }
+        list->boards=boards;
+        list->size=size;
+    }
+    list->boards[list->count++]=board;
+    return E_OK;
+}
+// Final boards and seeds of the games in a text log or a rotated segment
+static int read_log(const char *path, board_list_t *finals, board_list_t *seeds)
+{
+    logseg_t seg;
+    int rc=logseg_open(&seg,path);
+    if(rc==E_OK){
+        const uint8_t *p=seg.records;
+        log_record_t rec;
+        while(p<seg.records_end && logseg_read(&p,seg.records_end,&rec)){
+            add_board(finals,rec.board);
+            if(rec.seed!=0){
+                add_board(seeds,rec.seed);
+            }
+        }
+        logseg_close(&seg);
+        return E_OK;
+    }
+    if(rc!=E_INVAL){
+        return rc;
+    }
+    FILE *fp=fopen(path,"r");
+    if(NULL==fp){
+        fprintf(stderr,"Failed to open %s.\n",path);
+        return E_FILEIO;
+    }
+    char line[256];
+    while(fgets(line,sizeof(line),fp)!=NULL){
+        unsigned int moveno,score,max_tile;
+        unsigned long long board,seed=0;
+        if(sscanf(line,"%u,%u,%u,%llx,%llx",&moveno,&score,&max_tile,&board,&seed)<4 || board==0){
+            continue;
+        }
+        add_board(finals,board);
+        if(seed!=0){
+            add_board(seeds,seed);
+        }
+    }
+    fclose(fp);
+    return E_OK;
+}
+/* Fill `sample` with `count` positions: at most half of them logged final
+ * boards, evenly spaced over the log, the rest from replayed games. The
+ * positions are shuffled so that consecutive calls do not see one game. */
+static int sample_boards(table_data_t *table, const char *log_path, int depth, uint64_t count, board_list_t *sample)
+{
+    board_list_t finals={NULL,0,0},seeds={NULL,0,0};
+    if(NULL!=log_path && read_log(log_path,&finals,&seeds)!=E_OK){
+        return E_FILEIO;
+    }
+    uint64_t i,taken=min(finals.count,count/2);
+    for(i=0; i<taken; i++){
+        add_board(sample,finals.boards[i*finals.count/taken]);
+    }
+    uint64_t game=0;
+    while(sample->count<count){
+        uint64_t seed=(game<seeds.count) ? seeds.boards[game] : MICRO_SEED+game;
+        rand_t rand;
+        initRandom(&rand,seed);
+        board_t board=new_board(&rand);
+        while(sample->count<count){
+            int move=find_best_move_depth(table,board,depth,NULL,NULL);
+            if(move<0){
+                break;
+            }
+            add_board(sample,board);
+            board=insert_tile_rand(&rand,execute_move(table,move,board),draw_tile(&rand));
+        }
+        game++;
+    }
+    rand_t rand;
+    initRandom(&rand,MICRO_SEED);
+    for(i=sample->count-1; i>0; i--){
+        uint64_t j=(((uint64_t)getRandom(&rand)<<32)|getRandom(&rand))%(i+1);
+        board_t tmp=sample->boards[i];
+        sample->boards[i]=sample->boards[j];
+        sample->boards[j]=tmp;
+    }
+    fprintf(stderr,"%llu boards: %llu logged final boards, %llu positions of %llu replayed games.\n",
+        (unsigned long long)sample->count,(unsigned long long)taken,(unsigned long long)(sample->count-taken),
+        (unsigned long long)game);
+    free(finals.boards);
+    free(seeds.boards);
+    return E_OK;
+}
+
+static uint64_t run_transpose(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=transpose(data->boards[i]);
+    }
+    return s;
+}
+static uint64_t run_transpose_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        wide_board_t t=wide_transpose(data->wide_boards[i]);
+        s+=t.half[0]^t.half[1];
+    }
+    return s;
+}
+static uint64_t run_count_empty(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=count_empty(data->boards[i]);
+    }
+    return s;
+}
+static uint64_t run_count_empty_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=wide_count_empty(data->wide_boards[i]);
+    }
+    return s;
+}
+static uint64_t run_execute_move(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    int move;
+    for(move=0; move<4; move++){
+        for(i=0; i<data->count; i++){
+            s+=execute_move(data->table,move,data->boards[i]);
+        }
+    }
+    return s;
+}
+static uint64_t run_execute_move_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    int move;
+    for(move=0; move<4; move++){
+        for(i=0; i<data->count; i++){
+            wide_board_t moved=wide_execute_move(data->table,move,data->wide_boards[i]);
+            s+=moved.half[0]^moved.half[1];
+        }
+    }
+    return s;
+}
+static uint64_t run_execute_move_batch(const micro_data_t *data)
+{
+    uint64_t s=0;
+    int move;
+    for(move=0; move<4; move++){
+        execute_move_batch(move,data->boards,data->results,data->count);
+        s+=data->results[0]^data->results[data->count-1];
+    }
+    return s;
+}
+static uint64_t run_expand_all_moves(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        board_t moves[4];
+        uint8_t legal=expand_all_moves(data->table,data->boards[i],moves);
+        s+=moves[0]^moves[1]^moves[2]^moves[3]^legal;
+    }
+    return s;
+}
+static uint64_t run_expand_all_moves_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        wide_board_t moves[4];
+        uint8_t legal=wide_expand_all_moves(data->table,data->wide_boards[i],moves);
+        s+=moves[0].half[0]^moves[1].half[0]^moves[2].half[0]^moves[3].half[0]^legal;
+    }
+    return s;
+}
+static uint64_t run_score_heur_board(const micro_data_t *data)
+{
+    double s=0;
+    uint64_t i;
+    for(i=0; i<data->count; i++){
+        s+=score_heur_board(data->table,data->boards[i]);
+    }
+    return (uint64_t)s;
+}
+static uint64_t run_score_heur_board_wide(const micro_data_t *data)
+{
+    double s=0;
+    uint64_t i;
+    for(i=0; i<data->count; i++){
+        s+=wide_score_heur_board(data->table,data->wide_boards[i]);
+    }
+    return (uint64_t)s;
+}
+static uint64_t run_count_distinct_tiles(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=count_distinct_tiles(data->boards[i]);
+    }
+    return s;
+}
+static uint64_t run_count_distinct_tiles_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=wide_count_distinct_tiles(data->wide_boards[i]);
+    }
+    return s;
+}
+static uint64_t run_get_max_rank(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=get_max_rank(data->boards[i]);
+    }
+    return s;
+}
+static uint64_t run_get_max_rank_wide(const micro_data_t *data)
+{
+    uint64_t s=0,i;
+    for(i=0; i<data->count; i++){
+        s+=wide_get_max_rank(data->wide_boards[i]);
+    }
+    return s;
+}
+static uint64_t run_init_tables(const micro_data_t *data)
+{
+    init_tables(data->scratch);
+    return data->scratch->row_left_table[0x1121];
+}
+
+static const micro_case_t cases[]={
+    {"transpose","nibble",run_transpose,1},
+    {"transpose","wide",run_transpose_wide,1},
+    {"count_empty","nibble",run_count_empty,1},
+    {"count_empty","wide",run_count_empty_wide,1},
+    {"execute_move","table",run_execute_move,4},
+    {"execute_move","batch",run_execute_move_batch,4},
+    {"execute_move","wide",run_execute_move_wide,4},
+    {"expand_all_moves","nibble",run_expand_all_moves,4},
+    {"expand_all_moves","wide",run_expand_all_moves_wide,4},
+    {"score_heur_board","nibble",run_score_heur_board,1},
+    {"score_heur_board","wide",run_score_heur_board_wide,1},
+    {"count_distinct_tiles","nibble",run_count_distinct_tiles,1},
+    {"count_distinct_tiles","wide",run_count_distinct_tiles_wide,1},
+    {"get_max_rank","nibble",run_get_max_rank,1},
+    {"get_max_rank","wide",run_get_max_rank_wide,1},
+    {"init_tables","table",run_init_tables,0},
+};
+
+static double elapsed_nsec(const struct timespec *t0, const struct timespec *t1)
+{
+    return (t1->tv_sec-t0->tv_sec)*1e9+(t1->tv_nsec-t0->tv_nsec);
+}
+// Time `runs` runs after a warm-up run, per call: mean, standard deviation and minimum
+static void run_case(const micro_case_t *c, const micro_data_t *data, int runs)
+{
+    double ops=(c->ops_per_board>0) ? (double)c->ops_per_board*data->count : 1;
+    double sum=0,sum_sq=0,best=0;
+    int r;
+    sink+=c->run(data);
+    for(r=0; r<runs; r++){
+        struct timespec t0,t1;
+        clock_gettime(CLOCK_MONOTONIC,&t0);
+        sink+=c->run(data);
+        clock_gettime(CLOCK_MONOTONIC,&t1);
+        double ns=elapsed_nsec(&t0,&t1)/ops;
+        sum+=ns;
+        sum_sq+=ns*ns;
+        best=(r==0) ? ns : min(best,ns);
+    }
+    double mean=sum/runs;
+    double stddev=sqrt(max(sum_sq/runs-mean*mean,0.0));
+    printf("%-22s %-8s %12.3f %12.3f %8.2f%% %12.6g\n",c->name,c->variant,mean,best,
+        (mean>0) ? 100*stddev/mean : 0.0,(mean>0) ? 1e3/mean : 0.0);
+    fflush(stdout);
+}
+
+static void print_help(const char *app_name)
+{
+    fprintf(stderr,"Usage: %s [-h] [-l log] [-b boards] [-d depth] [-r runs] [-f primitive[,primitive...]]\n",app_name);
+    fprintf(stderr,"       -h            Print help.\n");
+    fprintf(stderr,"       -l log        Take the positions from a daemon log or log segment.\n");
+    fprintf(stderr,"       -b boards     Number of positions, defaults to %u.\n",MICRO_DEFAULT_BOARDS);
+    fprintf(stderr,"       -d depth      Search depth of replayed games, defaults to %u.\n",MICRO_DEFAULT_DEPTH);
+    fprintf(stderr,"       -r runs       Timed runs of each primitive, defaults to %u.\n",MICRO_DEFAULT_RUNS);
+    fprintf(stderr,"       -f primitive  Only these primitives, e.g. execute_move,get_max_rank.\n");
+}
+int main(int argc, char *argv[])
+{
+    const char *log_path=NULL,*filter=NULL;
+    uint64_t count=MICRO_DEFAULT_BOARDS;
+    int depth=MICRO_DEFAULT_DEPTH,runs=MICRO_DEFAULT_RUNS;
+    int opt;
+    while((opt=getopt(argc,argv,"hl:b:d:r:f:"))!=-1){
+        switch(opt){
+            case 'l':
+                log_path=optarg;
+            break;
+            case 'b':
+                count=strtoull(optarg,NULL,10);
+            break;
+            case 'd':
+                depth=strtol(optarg,NULL,10);
+            break;
+            case 'r':
+                runs=strtol(optarg,NULL,10);
+            break;
+            case 'f':
+                filter=optarg;
+            break;
+            default:
+                print_help(argv[0]);
+                return 1;
+        }
+    }
+    if(count<1 || depth<1 || runs<1){
+        print_help(argv[0]);
+        return 1;
+    }
+
+    micro_data_t data;
+    memset(&data,0,sizeof(data));
+    data.table=alloc_node_tables(NULL,-1,true);
+    data.scratch=(table_data_t*)malloc(sizeof(table_data_t));
+    if(NULL==data.table || NULL==data.scratch){
+        fprintf(stderr,"Failed to allocate move tables.\n");
+        return 1;
+    }
+    board_list_t sample={NULL,0,0};
+    if(sample_boards(data.table,log_path,depth,count,&sample)!=E_OK){
+        return 1;
+    }
+    wide_board_t *wide_boards=(wide_board_t*)malloc(sample.count*sizeof(wide_board_t));
+    data.results=(board_t*)malloc(sample.count*sizeof(board_t));
+    if(NULL==wide_boards || NULL==data.results){
+        fprintf(stderr,"Failed to allocate boards.\n");
+        return 1;
+    }
+    uint64_t i;
+    for(i=0; i<sample.count; i++){
+        wide_boards[i]=wide_from_board(sample.boards[i]);
+    }
+    data.boards=sample.boards;
+    data.wide_boards=wide_boards;
+    data.count=sample.count;
+
+    printf("# batch kernel: %s\n",execute_move_batch_isa());
+    printf("%-22s %-8s %12s %12s %9s %12s\n","primitive","variant","ns/op","min ns/op","stddev","Mops/s");
+    for(i=0; i<sizeof(cases)/sizeof(cases[0]); i++){
+        if(NULL!=filter){
+            // Whole names of a comma separated list
+            size_t len=strlen(cases[i].name);
+            const char *p=filter;
+            bool found=false;
+            while(!found && NULL!=(p=strstr(p,cases[i].name))){
+                found=(p==filter || p[-1]==',') && (p[len]==',' || p[len]=='\0');
+                p+=len;
+            }
+            if(!found){
+                continue;
+            }
+        }
+        run_case(&cases[i],&data,runs);
+    }
+    free(sample.boards);
+    free(wide_boards);
+    free(data.results);
+    free(data.scratch);
+    free_node_tables(data.table);
+    return 0;
+}
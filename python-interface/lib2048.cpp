@@ -22,6 +22,8 @@
 #include <unordered_map>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 extern "C" {
 	int nprocs();
 }
@@ -428,8 +430,69 @@ float score_toplevel_move(table_data_t *table, board_t board, int move) {
     return res;
 }
 
+/* Opening book built by the daemon's 2048book, in the format of its book.h:
+ * a header followed by entries sorted by board. The file is mapped read-only,
+ * so the daemon and every library using the same book share its pages. */
+static const uint64_t BOOK_MAGIC = 0x4b4f4f4238343032ULL;
+static const uint32_t BOOK_VERSION = 1;
+struct book_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+    uint64_t reserved;
+};
+struct book_entry_t {
+    board_t board;
+    uint8_t move;
+    uint8_t depth;
+    uint8_t reserved[6];
+};
+static void *book_map = NULL;
+static size_t book_size = 0;
+static const book_entry_t *book_entries = NULL;
+static uint64_t book_count = 0;
+
+static int book_lookup(board_t board) {
+    const book_entry_t *end = book_entries + book_count;
+    const book_entry_t *i = std::lower_bound(book_entries, end, board,
+        [](const book_entry_t &entry, board_t key) { return entry.board < key; });
+    return (i != end && i->board == board) ? i->move : -1;
+}
+
 /* Find the best move for a given board. */
 extern "C" {
+	// Use the opening book at `path`, returns 1 on success
+	int open_book(const char *path) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return 0;
+		}
+		struct stat st;
+		void *map = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(book_header_t)) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (map == MAP_FAILED) {
+			return 0;
+		}
+		const book_header_t *header = (const book_header_t *)map;
+		if (header->magic != BOOK_MAGIC || header->version != BOOK_VERSION ||
+			header->entry_size != sizeof(book_entry_t) ||
+			header->count > (st.st_size - sizeof(book_header_t)) / sizeof(book_entry_t)) {
+			munmap(map, st.st_size);
+			return 0;
+		}
+		if (book_map != NULL) {
+			munmap(book_map, book_size);
+		}
+		book_map = map;
+		book_size = st.st_size;
+		book_entries = (const book_entry_t *)(header + 1);
+		book_count = header->count;
+		return 1;
+	}
 	int find_best_move(board_t board) {
 		static table_data_t table;
 		static bool active = false;
@@ -439,7 +502,10 @@ extern "C" {
 			active = true;
 		}
 
-		int move;
+		int move = book_lookup(board);
+		if (move >= 0 && execute_move(&table, move, board) != board) {
+			return move;
+		}
 		float best = 0;
 		int bestmove = -1;
 
@@ -1,8 +1,30 @@
 #!/usr/bin/env python3
 
-import ctypes;
+import os, socket, ctypes;
 lib2048 = ctypes.CDLL('./lib2048.so');
 lib2048.find_best_move.argtypes = [ctypes.c_uint64];
+lib2048.open_book.argtypes = [ctypes.c_char_p];
+
+# Same opening book as the daemon
+if os.environ.get('RUN2048_BOOK_FILE'):
+    lib2048.open_book(os.environ['RUN2048_BOOK_FILE'].encode());
+
+# With RUN2048_EVAL_SOCKET set, moves are asked of a shared `2048ai --serve`
+evalFile = None;
+if os.environ.get('RUN2048_EVAL_SOCKET'):
+    evalConn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM);
+    evalConn.connect(os.environ['RUN2048_EVAL_SOCKET']);
+    evalFile = evalConn.makefile('rwb');
+
+# Best move and the scores of up, down, left and right from the server
+def evaluate(boardHex):
+    evalFile.write(b'%016x\n' % boardHex);
+    evalFile.flush();
+    line = evalFile.readline().decode().strip();
+    if line == 'E':
+        raise ValueError('eval server rejected board %016x' % boardHex);
+    fields = line.split(',');
+    return int(fields[0]), [float(s) for s in fields[1:]];
 
 def __trailingZeros(num):
     if (num == 0):
@@ -21,12 +43,13 @@ def findBestMove(board):
             n = __trailingZeros(board[row*4+col]);
             boardHex |= (int(n) << (i*4));
             i += 1;
+    move = evaluate(boardHex)[0] if evalFile else lib2048.find_best_move(boardHex);
     return {
         '0': 'UP',
         '1': 'DOWN',
         '2': 'LEFT',
         '3': 'RIGHT',
-    }.get(str(lib2048.find_best_move(boardHex)));
+    }.get(str(move));
 
 if '__main__' == __name__:
     print(findBestMove([
@@ -1,70 +1,156 @@
-#ifndef random_h
-#define random_h
-
+#ifndef random_h
+#define random_h
+
+#include <stdio.h>
 #include <stdint.h>
-#include <stdbool.h>
-
-#define RAND_N 624
-#define RANDOM_MAX (0xffffffff)
-
-typedef struct {
-    uint32_t mt[RAND_N];
-    uint16_t index;
+#include <stdbool.h>
+#include <inttypes.h>
+
+/* Tile generator of a game. A game is fully determined by its 64-bit seed, so
+ * any game, a slow one in particular, can be replayed from the seed written to
+ * the log. The generator state is saved in the snapshot as a short string so
+ * resumed games continue the same sequence.
+ *
+ * The default is xoshiro128**, with 16 bytes of state. Build with
+ * -DRANDOM_MT19937 for the Mersenne Twister used before; its state is saved as
+ * the number of numbers drawn since seeding and restored by drawing again. */
+
+#define RANDOM_MAX (0xffffffff)
+#define RANDOM_STATE_SIZE (40)
+
+#ifdef RANDOM_MT19937
+
+#define RAND_N 624
+
+typedef struct {
+    uint32_t mt[RAND_N];
+    uint16_t index;
+    uint64_t draws;
 } rand_t;
 
-enum {
-    N = RAND_N,
-    M = 397,
-    R = 31,
-    A = 0x9908B0DF,
-    F = 1812433253,
-    U = 11,
-    S = 7,
-    B = 0x9D2C5680,
-    T = 15,
-    C = 0xEFC60000,
-    L = 18,
-    MASK_LOWER = (1ull << R) - 1,
-    MASK_UPPER = (1ull << R)
-};
-
-static inline void initRandom(rand_t* rand, uint32_t seed)
-{
-    uint16_t i;
-    rand->mt[0] = seed;
-    for (i = 1; i < N; i++) {
-        rand->mt[i] = (F * (rand->mt[i - 1] ^ (rand->mt[i - 1] >> 30)) + i);
-    }
-    rand->index = N;
-};
-static inline void twist(rand_t* rand)
-{
-    uint32_t  i, x, xA;
-    for (i = 0; i < N; i++) {
-        x = (rand->mt[i] & MASK_UPPER) + (rand->mt[(i + 1) % N] & MASK_LOWER);
-        xA = x >> 1;
-        if (x & 0x1) {
-            xA ^= A;
-        }
-        rand->mt[i] = rand->mt[(i + M) % N] ^ xA;
-    }
-    rand->index = 0;
-}
-static inline uint32_t getRandom(rand_t* rand)
-{
-    uint32_t y;
-    int i = rand->index;
-    if (rand->index >= N) {
-        twist(rand);
-        i = rand->index;
-    }
-    y = rand->mt[i];
-    rand->index = i + 1;
-    y ^= (y >> U);
-    y ^= (y << S) & B;
-    y ^= (y << T) & C;
-    y ^= (y >> L);
-    return y;
-}
-
-#endif
+enum {
+    N = RAND_N,
+    M = 397,
+    R = 31,
+    A = 0x9908B0DF,
+    F = 1812433253,
+    U = 11,
+    S = 7,
+    B = 0x9D2C5680,
+    T = 15,
+    C = 0xEFC60000,
+    L = 18,
+    MASK_LOWER = (1ull << R) - 1,
+    MASK_UPPER = (1ull << R)
+};
+
+static inline void initRandom(rand_t* rand, uint64_t seed)
+{
+    uint16_t i;
+    rand->mt[0] = (uint32_t)(seed ^ (seed >> 32));
+    for (i = 1; i < N; i++) {
+        rand->mt[i] = (F * (rand->mt[i - 1] ^ (rand->mt[i - 1] >> 30)) + i);
+    }
+    rand->index = N;
+    rand->draws = 0;
+};
+static inline void twist(rand_t* rand)
+{
+    uint32_t  i, x, xA;
+    for (i = 0; i < N; i++) {
+        x = (rand->mt[i] & MASK_UPPER) + (rand->mt[(i + 1) % N] & MASK_LOWER);
+        xA = x >> 1;
+        if (x & 0x1) {
+            xA ^= A;
+        }
+        rand->mt[i] = rand->mt[(i + M) % N] ^ xA;
+    }
+    rand->index = 0;
+}
+static inline uint32_t getRandom(rand_t* rand)
+{
+    uint32_t y;
+    int i = rand->index;
+    if (rand->index >= N) {
+        twist(rand);
+        i = rand->index;
+    }
+    y = rand->mt[i];
+    rand->index = i + 1;
+    rand->draws++;
+    y ^= (y >> U);
+    y ^= (y << S) & B;
+    y ^= (y << T) & C;
+    y ^= (y >> L);
+    return y;
+}
+static inline void saveRandom(const rand_t* rand, char *state, size_t size)
+{
+    snprintf(state, size, "%" PRIu64, rand->draws);
+}
+static inline bool loadRandom(rand_t* rand, uint64_t seed, const char *state)
+{
+    uint64_t draws;
+    if (sscanf(state, "%" SCNu64, &draws) != 1) {
+        return false;
+    }
+    initRandom(rand, seed);
+    while (rand->draws < draws) {
+        getRandom(rand);
+    }
+    return true;
+}
+
+#else
+
+typedef struct {
+    uint32_t s[4];
+} rand_t;
+
+static inline uint32_t rotlRandom(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+// SplitMix64 spreads the seed over the state, it never yields an all-zero state
+static inline uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+static inline void initRandom(rand_t* rand, uint64_t seed)
+{
+    uint64_t a = splitmix64(&seed), b = splitmix64(&seed);
+    rand->s[0] = (uint32_t)a;
+    rand->s[1] = (uint32_t)(a >> 32);
+    rand->s[2] = (uint32_t)b;
+    rand->s[3] = (uint32_t)(b >> 32);
+}
+static inline uint32_t getRandom(rand_t* rand)
+{
+    uint32_t *s = rand->s;
+    uint32_t result = rotlRandom(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotlRandom(s[3], 11);
+    return result;
+}
+static inline void saveRandom(const rand_t* rand, char *state, size_t size)
+{
+    snprintf(state, size, "%08x%08x%08x%08x", rand->s[0], rand->s[1], rand->s[2], rand->s[3]);
+}
+static inline bool loadRandom(rand_t* rand, uint64_t seed, const char *state)
+{
+    (void)seed;
+    return sscanf(state, "%8x%8x%8x%8x", &rand->s[0], &rand->s[1], &rand->s[2], &rand->s[3]) == 4 &&
+        (rand->s[0] | rand->s[1] | rand->s[2] | rand->s[3]) != 0;
+}
+
+#endif
+
+#endif
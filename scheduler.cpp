@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "scheduler.h"
+
+static const char *sched_names[SCHED_COUNT]={"sjf","fair"};
+
+// One game move waiting for its top-level move searches
+struct search_request_t{
+    std::mutex mutex;
+    std::condition_variable done;
+    int remaining;
+    bool cancelled;
+    float results[4];
+    search_stats_t stats[4];
+};
+
+struct search_task_t{
+    uint64_t key;   // lower runs first
+    uint64_t seq;   // submission order breaks ties
+    uint32_t game;
+    int move;
+    table_data_t *table;
+    board_t board;
+    search_request_t *request;
+    const volatile bool *cancel;
+    search_t *search;   // NULL until the first slice
+    uint64_t charged;   // nodes already counted for fair share
+
+    bool operator<(const search_task_t &other) const {
+        // std::priority_queue pops the largest element
+        if(key!=other.key){
+            return key>other.key;
+        }
+        return seq>other.seq;
+    }
+};
+
+// Tasks not started yet and paused ones are kept apart, see pop_task()
+struct search_queue_t{
+    std::mutex mutex;
+    std::priority_queue<search_task_t> fresh;
+    std::priority_queue<search_task_t> paused;
+};
+
+struct search_sched_s{
+    int policy;
+    std::vector<std::unique_ptr<search_queue_t>> queues;
+    std::vector<std::thread> threads;
+
+    // Node and CPUs of each search thread, node -1 when not pinned
+    std::vector<int> nodes;
+    std::vector<cpu_set_t> cpusets;
+    // Queues of the threads on each node, and the queues each thread takes
+    // from: its own, then those of its node, then the others
+    std::vector<std::vector<size_t>> node_queues;
+    std::vector<std::vector<size_t>> steal_order;
+    std::atomic<bool> running;
+    std::atomic<uint64_t> seq;
+    std::atomic<unsigned int> next_queue;
+
+    // Search threads without work sleep here until tasks are submitted, a
+    // search is paused or a started one finishes
+    std::mutex idle_mutex;
+    std::condition_variable idle;
+    std::atomic<int> fresh;
+    std::atomic<int> paused;
+    // Started searches, each holding its transposition table
+    std::atomic<int> live;
+    int max_live;
+
+    // Search nodes consumed by each game, for fair share
+    std::mutex share_mutex;
+    std::unordered_map<uint32_t, uint64_t> consumed;
+};
+
+int sched_parse(const char *name)
+{
+    int i;
+    for(i=0; i<SCHED_COUNT; i++){
+        if(strcmp(name,sched_names[i])==0){
+            return i;
+        }
+    }
+    return -1;
+}
+const char *sched_name(int policy)
+{
+    if(policy<0 || policy>=SCHED_COUNT){
+        return "unknown";
+    }
+    return sched_names[policy];
+}
+
+/* Take the best task of a queue. A task not started yet is only taken when
+ * `may_start`, otherwise the best paused one is resumed. */
+static bool pop_task(search_queue_t *queue, search_task_t *task, bool may_start)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    bool start=may_start && !queue->fresh.empty() &&
+        (queue->paused.empty() || queue->paused.top()<queue->fresh.top());
+    std::priority_queue<search_task_t> &tasks=start ? queue->fresh : queue->paused;
+    if(tasks.empty()){
+        return false;
+    }
+    *task=tasks.top();
+    tasks.pop();
+    return true;
+}
+static bool runnable(search_sched_t *sched)
+{
+    return sched->paused>0 || (sched->fresh>0 && sched->live<sched->max_live);
+}
+static void release_live(search_sched_t *sched)
+{
+    std::lock_guard<std::mutex> lock(sched->idle_mutex);
+    sched->live--;
+    sched->idle.notify_all();
+}
+/* Take the best task of the own queue, or steal the best one of another
+ * queue, on the same node first so the tables the task reads stay local. A
+ * search is only started while fewer than max_live are, so the started ones
+ * are resumed rather than all holding their tables at once. */
+static bool next_task(search_sched_t *sched, size_t self, search_task_t *task)
+{
+    bool may_start=sched->live++<sched->max_live;
+    if(!may_start){
+        sched->live--;
+    }
+    for(size_t queue : sched->steal_order[self]){
+        if(pop_task(sched->queues[queue].get(),task,may_start)){
+            if(NULL==task->search){
+                sched->fresh--;
+            }else{
+                sched->paused--;
+                if(may_start){
+                    release_live(sched);
+                }
+            }
+            return true;
+        }
+    }
+    if(may_start){
+        release_live(sched);
+    }
+    return false;
+}
+// Run one slice of a task, then queue it again unless it finished or was cancelled
+static void run_task(search_sched_t *sched, size_t self, search_task_t &task)
+{
+    search_request_t *request=task.request;
+    search_stats_t stats;
+    if(NULL==task.search){
+        task.search=search_new(task.table,task.board,task.move,0);
+    }
+    int rc=search_run(task.search,SCHED_SLICE_NODES,task.cancel);
+    float res=search_result(task.search,&stats);
+    if(sched->policy==SCHED_FAIR){
+        std::lock_guard<std::mutex> lock(sched->share_mutex);
+        uint64_t &consumed=sched->consumed[task.game];
+        consumed+=stats.moves_evaled-task.charged;
+        task.charged=stats.moves_evaled;
+        task.key=consumed;
+    }
+    if(rc==SEARCH_PAUSED){
+        task.seq=sched->seq++;
+        search_queue_t *queue=sched->queues[self].get();
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->paused.push(task);
+        sched->paused++;
+        return;
+    }
+    search_free(task.search);
+    release_live(sched);
+    std::lock_guard<std::mutex> lock(request->mutex);
+    if(rc==SEARCH_CANCELLED){
+        request->cancelled=true;
+    }
+    request->results[task.move]=res;
+    request->stats[task.move]=stats;
+    if(--request->remaining==0){
+        request->done.notify_one();
+    }
+}
+static void sched_main(search_sched_t *sched, size_t self)
+{
+    search_task_t task;
+    if(sched->nodes[self]>=0){
+        pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&sched->cpusets[self]);
+    }
+    while(sched->running){
+        if(next_task(sched,self,&task)){
+            run_task(sched,self,task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sched->idle_mutex);
+        sched->idle.wait(lock,[sched](){
+            return runnable(sched) || !sched->running;
+        });
+    }
+}
+
+/* Start `thread_count` search threads. With a placement policy they are
+ * pinned like games would be (see placement_cpuset()), and tasks are queued
+ * on the node of their game. */
+search_sched_t *sched_start(uint16_t thread_count, int policy, const cpu_topology_t *topology, int placement)
+{
+    search_sched_t *sched=new search_sched_t;
+    uint16_t i,j;
+    sched->policy=policy;
+    sched->running=true;
+    sched->seq=0;
+    sched->next_queue=0;
+    sched->fresh=0;
+    sched->paused=0;
+    sched->live=0;
+    sched->max_live=thread_count*SCHED_LIVE_SEARCHES;
+    sched->nodes.resize(thread_count,-1);
+    sched->cpusets.resize(thread_count);
+    sched->node_queues.resize(MAX_NUMA_NODES);
+    for(i=0; i<thread_count; i++){
+        sched->queues.emplace_back(new search_queue_t);
+        if(NULL!=topology && placement!=PLACEMENT_NONE){
+            sched->nodes[i]=placement_cpuset(topology,placement,i,thread_count,&sched->cpusets[i]);
+        }
+        if(sched->nodes[i]>=0){
+            sched->node_queues[sched->nodes[i]].push_back(i);
+        }
+    }
+    sched->steal_order.resize(thread_count);
+    for(i=0; i<thread_count; i++){
+        std::vector<size_t> &order=sched->steal_order[i];
+        for(j=0; j<thread_count; j++){
+            uint16_t other=(i+j)%thread_count;
+            if(j==0 || (sched->nodes[i]>=0 && sched->nodes[other]==sched->nodes[i])){
+                order.push_back(other);
+            }
+        }
+        for(j=1; j<thread_count; j++){
+            uint16_t other=(i+j)%thread_count;
+            if(sched->nodes[i]<0 || sched->nodes[other]!=sched->nodes[i]){
+                order.push_back(other);
+            }
+        }
+    }
+    for(i=0; i<thread_count; i++){
+        sched->threads.emplace_back(sched_main,sched,i);
+    }
+    return sched;
+}
+void sched_stop(search_sched_t *sched)
+{
+    if(NULL==sched){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sched->idle_mutex);
+        sched->running=false;
+    }
+    sched->idle.notify_all();
+    for(auto &thread : sched->threads){
+        thread.join();
+    }
+    delete sched;
+}
+
+/* Expected cost of searching a move. The search depth grows with the number
+ * of distinct tiles and each level branches on every empty cell, so both are
+ * used, deepest first. */
+static uint64_t expected_cost(board_t newboard)
+{
+    uint64_t depth_limit=max(3, count_distinct_tiles(newboard) - 2);
+    return (depth_limit<<8) | count_empty(newboard);
+}
+
+/* Find the best move for a given board, the searches running on the shared
+ * search threads. `game` identifies the submitting game for fair share, and
+ * its searches are queued on the threads of `node` when there are any. The
+ * score of every move is stored in `scores` unless it is NULL, 0 for illegal
+ * moves. */
+int sched_score_moves(search_sched_t *sched, uint32_t game, int node, table_data_t *table, board_t board,
+    float *scores, search_stats_t *stats, const volatile bool *cancel)
+{
+    search_request_t request;
+    search_task_t tasks[4];
+    int move,count=0;
+    request.remaining=0;
+    request.cancelled=false;
+    uint64_t share=0;
+    if(sched->policy==SCHED_FAIR){
+        std::lock_guard<std::mutex> lock(sched->share_mutex);
+        share=sched->consumed[game];
+    }
+    board_t moves[4];
+    uint8_t legal=expand_all_moves(table,board,moves);
+    for(move=0; move<4; move++){
+        request.results[move]=0;
+        memset(&request.stats[move],0,sizeof(search_stats_t));
+        if(!(legal&(1<<move))){
+            continue;
+        }
+        search_task_t &task=tasks[count++];
+        task.key=(sched->policy==SCHED_FAIR) ? share : expected_cost(moves[move]);
+        task.seq=sched->seq++;
+        task.game=game;
+        task.move=move;
+        task.table=table;
+        task.board=board;
+        task.request=&request;
+        task.cancel=cancel;
+        task.search=NULL;
+        task.charged=0;
+    }
+    if(stats!=NULL){
+        memset(stats,0,sizeof(search_stats_t));
+    }
+    if(scores!=NULL){
+        memset(scores,0,4*sizeof(float));
+    }
+    if(count==0){
+        return -1;
+    }
+
+    request.remaining=count;
+    const std::vector<size_t> *local=NULL;
+    if(node>=0 && node<MAX_NUMA_NODES && !sched->node_queues[node].empty()){
+        local=&sched->node_queues[node];
+    }
+    for(move=0; move<count; move++){
+        unsigned int next=sched->next_queue++;
+        size_t index=(NULL!=local) ? (*local)[next%local->size()] : next%sched->queues.size();
+        search_queue_t *queue=sched->queues[index].get();
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->fresh.push(tasks[move]);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sched->idle_mutex);
+        sched->fresh+=count;
+    }
+    sched->idle.notify_all();
+
+    std::unique_lock<std::mutex> lock(request.mutex);
+    request.done.wait(lock,[&request](){
+        return request.remaining==0;
+    });
+
+    float best=0;
+    int bestmove=-1;
+    for(move=0; move<4; move++){
+        if(scores!=NULL){
+            scores[move]=request.results[move];
+        }
+        if(request.results[move]>best){
+            best=request.results[move];
+            bestmove=move;
+        }
+        if(stats!=NULL){
+            stats->moves_evaled+=request.stats[move].moves_evaled;
+            stats->cachehits+=request.stats[move].cachehits;
+            stats->maxdepth=max(stats->maxdepth,request.stats[move].maxdepth);
+            stats->evictions+=request.stats[move].evictions;
+        }
+    }
+    return request.cancelled ? -1 : bestmove;
+}
+int sched_find_best_move(search_sched_t *sched, uint32_t game, int node, table_data_t *table, board_t board,
+    search_stats_t *stats, const volatile bool *cancel)
+{
+    return sched_score_moves(sched,game,node,table,board,NULL,stats,cancel);
+}
@@ -0,0 +1,56 @@
+#ifndef __scheduler_h__
+#define __scheduler_h__
+
+#include <stdint.h>
+#include "2048.h"
+#include "affinity.h"
+
+/* Search scheduler shared by all games. Instead of every game starting its own
+ * helper threads for each move, games submit their top-level move searches as
+ * tasks to one pool of search threads. Each search thread has its own queue and
+ * steals from the others when it runs dry, so the number of games played
+ * concurrently is independent of the number of cores.
+ *
+ *  sjf   Shortest expected job first, cheap early-game searches are run before
+ *        deep late-game ones so their games can move on.
+ *  fair  Tasks of the game that consumed the fewest search nodes run first.
+ *
+ * Searches run in slices of SCHED_SLICE_NODES nodes and go back to the queue
+ * between slices, so a task submitted later with a higher priority does not
+ * wait for a long search to finish, and a cancelled move stops within one
+ * slice. At most SCHED_LIVE_SEARCHES searches per thread are started at a
+ * time, since a paused search keeps its transposition table; the others wait
+ * to be started until one finishes.
+ *
+ * With a placement policy the search threads are pinned like the games, and
+ * the searches of a game are queued on the threads of its node, which steal
+ * within the node before stealing from other nodes. */
+#define SCHED_SLICE_NODES (1UL << 16)
+#define SCHED_LIVE_SEARCHES (2)
+
+enum{
+    SCHED_SJF,
+    SCHED_FAIR,
+    SCHED_COUNT
+};
+
+typedef struct search_sched_s search_sched_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int sched_parse(const char *name);
+const char *sched_name(int policy);
+search_sched_t *sched_start(uint16_t thread_count, int policy, const cpu_topology_t *topology, int placement);
+void sched_stop(search_sched_t *sched);
+int sched_find_best_move(search_sched_t *sched, uint32_t game, int node, table_data_t *table, board_t board,
+    search_stats_t *stats, const volatile bool *cancel);
+int sched_score_moves(search_sched_t *sched, uint32_t game, int node, table_data_t *table, board_t board,
+    float *scores, search_stats_t *stats, const volatile bool *cancel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
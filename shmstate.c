@@ -0,0 +1,158 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "shmstate.h"
+
+void shm_state_default_name(const char *socket_path, char *name, size_t size)
+{
+    // Daemons started from different directories must not share a segment,
+    // so the name is derived from the absolute socket path.
+    char cwd[4096]="";
+    if(socket_path[0]!='/' && getcwd(cwd,sizeof(cwd))==NULL){
+        cwd[0]='\0';
+    }
+    uint32_t hash=2166136261U;
+    const char *parts[3]={cwd,"/",socket_path};
+    int i;
+    for(i=(socket_path[0]=='/' ? 2 : 0); i<3; i++){
+        const char *p;
+        for(p=parts[i]; *p!='\0'; p++){
+            hash=(hash^(uint8_t)(*p))*16777619U;
+        }
+    }
+    snprintf(name,size,"/2048ai-%u-%08x",(unsigned)getuid(),hash);
+}
+int shm_state_create(shm_state_t *shm, const char *name, uint32_t capacity)
+{
+    shm->header=NULL;
+    shm->writable=true;
+    shm->size=sizeof(shm_header_t)+sizeof(shm_record_t)*capacity;
+    strncpy(shm->name,name,sizeof(shm->name)-1);
+    shm->name[sizeof(shm->name)-1]='\0';
+    shm->fd=shm_open(shm->name,O_RDWR|O_CREAT,0644);
+    if(shm->fd<0){
+        fprintf(stderr,"Failed to create shared memory %s: %s.\n",shm->name,strerror(errno));
+        return E_FILEIO;
+    }
+    if(ftruncate(shm->fd,0)!=0 || ftruncate(shm->fd,shm->size)!=0){
+        fprintf(stderr,"Failed to resize shared memory %s: %s.\n",shm->name,strerror(errno));
+        goto error_exit;
+    }
+    void *addr=mmap(NULL,shm->size,PROT_READ|PROT_WRITE,MAP_SHARED,shm->fd,0);
+    if(MAP_FAILED==addr){
+        fprintf(stderr,"Failed to map shared memory %s: %s.\n",shm->name,strerror(errno));
+        goto error_exit;
+    }
+    shm->header=(shm_header_t*)addr;
+    shm->header->version=SHM_STATE_VERSION;
+    shm->header->record_size=sizeof(shm_record_t);
+    shm->header->thread_count=capacity;
+    shm->header->capacity=capacity;
+    shm->header->active=1;
+    __atomic_store_n(&shm->header->magic,SHM_STATE_MAGIC,__ATOMIC_RELEASE);
+    return E_OK;
+error_exit:
+    shm_state_close(shm);
+    return E_FILEIO;
+}
+int shm_state_open(shm_state_t *shm, const char *name)
+{
+    shm->header=NULL;
+    shm->writable=false;
+    strncpy(shm->name,name,sizeof(shm->name)-1);
+    shm->name[sizeof(shm->name)-1]='\0';
+    shm->fd=shm_open(shm->name,O_RDONLY,0);
+    if(shm->fd<0){
+        return E_FILEIO;
+    }
+    struct stat stat_in;
+    if(fstat(shm->fd,&stat_in)!=0 || (size_t)stat_in.st_size<sizeof(shm_header_t)){
+        goto error_exit;
+    }
+    shm->size=stat_in.st_size;
+    void *addr=mmap(NULL,shm->size,PROT_READ,MAP_SHARED,shm->fd,0);
+    if(MAP_FAILED==addr){
+        goto error_exit;
+    }
+    shm->header=(shm_header_t*)addr;
+    if(__atomic_load_n(&shm->header->magic,__ATOMIC_ACQUIRE)!=SHM_STATE_MAGIC ||
+        shm->header->version!=SHM_STATE_VERSION ||
+        shm->header->record_size!=sizeof(shm_record_t) ||
+        shm->size<sizeof(shm_header_t)+sizeof(shm_record_t)*shm->header->capacity){
+        goto error_exit;
+    }
+    return E_OK;
+error_exit:
+    shm_state_close(shm);
+    return E_INVAL;
+}
+void shm_state_close(shm_state_t *shm)
+{
+    if(NULL!=shm->header){
+        if(shm->writable){
+            __atomic_store_n(&shm->header->active,0,__ATOMIC_RELEASE);
+        }
+        munmap(shm->header,shm->size);
+        shm->header=NULL;
+    }
+    if(shm->fd>=0){
+        close(shm->fd);
+        shm->fd=-1;
+        if(shm->writable){
+            shm_unlink(shm->name);
+        }
+    }
+}
+// The number of games changes at runtime, records past it are stale
+void shm_state_set_count(shm_state_t *shm, uint32_t thread_count)
+{
+    if(NULL!=shm->header){
+        __atomic_store_n(&shm->header->thread_count,min(thread_count,shm->header->capacity),__ATOMIC_RELEASE);
+    }
+}
+void shm_state_update(shm_state_t *shm, uint32_t idx, const shm_snapshot_t *snapshot)
+{
+    shm_record_t *record=&(shm->header->records[idx]);
+    uint32_t seq=__atomic_load_n(&record->seq,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->seq,seq+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&record->moveno,snapshot->moveno,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->scoreoffset,snapshot->scoreoffset,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->score,snapshot->score,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->maxdepth,snapshot->maxdepth,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->board,snapshot->board,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->moves_evaled,snapshot->moves_evaled,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->moves_evaled_total,snapshot->moves_evaled_total,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->cachehits,snapshot->cachehits,__ATOMIC_RELAXED);
+    __atomic_store_n(&record->seq,seq+2,__ATOMIC_RELEASE);
+}
+/* Read a consistent copy of a record. False when `idx` is out of range, or
+ * when the record stays mid-update, e.g. because the daemon died while
+ * writing it. */
+bool shm_state_read(const shm_state_t *shm, uint32_t idx, shm_snapshot_t *snapshot)
+{
+    if(idx>=__atomic_load_n(&shm->header->thread_count,__ATOMIC_ACQUIRE)){
+        return false;
+    }
+    shm_record_t *record=&(shm->header->records[idx]);
+    uint32_t seq0,seq1,tries=0;
+    do{
+        if(tries++>=SHM_READ_RETRIES){
+            return false;
+        }
+        seq0=__atomic_load_n(&record->seq,__ATOMIC_ACQUIRE);
+        snapshot->moveno=__atomic_load_n(&record->moveno,__ATOMIC_RELAXED);
+        snapshot->scoreoffset=__atomic_load_n(&record->scoreoffset,__ATOMIC_RELAXED);
+        snapshot->score=__atomic_load_n(&record->score,__ATOMIC_RELAXED);
+        snapshot->maxdepth=__atomic_load_n(&record->maxdepth,__ATOMIC_RELAXED);
+        snapshot->board=__atomic_load_n(&record->board,__ATOMIC_RELAXED);
+        snapshot->moves_evaled=__atomic_load_n(&record->moves_evaled,__ATOMIC_RELAXED);
+        snapshot->moves_evaled_total=__atomic_load_n(&record->moves_evaled_total,__ATOMIC_RELAXED);
+        snapshot->cachehits=__atomic_load_n(&record->cachehits,__ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1=__atomic_load_n(&record->seq,__ATOMIC_RELAXED);
+    }while((seq0&1) || seq0!=seq1);
+    return true;
+}
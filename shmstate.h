@@ -0,0 +1,80 @@
+#ifndef __shmstate_h__
+#define __shmstate_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "2048.h"
+
+/* Live state of every game, published by the daemon in a POSIX shared-memory
+ * segment which local viewers map read-only.
+ *
+ * Each record is guarded by a sequence counter: the writer makes it odd before
+ * updating the record and even afterwards, readers retry until they see the
+ * same even value before and after copying the record. */
+
+#define SHM_STATE_MAGIC (0x32303438U)
+#define SHM_STATE_VERSION (1)
+#define SHM_NAME_MAX (64)
+#define SHM_READ_RETRIES (1000)
+
+typedef struct{
+    uint32_t seq;
+    uint32_t moveno;
+    uint32_t scoreoffset;
+    uint32_t score;
+    uint8_t maxdepth;
+    uint8_t reserved[7];
+    board_t board;
+    uint64_t moves_evaled;
+    uint64_t moves_evaled_total;
+    uint32_t cachehits;
+    uint8_t padding[12];
+}shm_record_t;
+
+typedef struct{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t thread_count;
+    uint32_t active;
+    uint32_t capacity;
+    uint8_t padding[44];
+    shm_record_t records[0];
+}shm_header_t;
+
+typedef struct{
+    uint32_t moveno;
+    uint32_t scoreoffset;
+    uint32_t score;
+    board_t board;
+    uint64_t moves_evaled;
+    uint64_t moves_evaled_total;
+    uint32_t cachehits;
+    uint8_t maxdepth;
+}shm_snapshot_t;
+
+typedef struct{
+    char name[SHM_NAME_MAX];
+    int fd;
+    size_t size;
+    bool writable;
+    shm_header_t *header;
+}shm_state_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void shm_state_default_name(const char *socket_path, char *name, size_t size);
+int shm_state_create(shm_state_t *shm, const char *name, uint32_t capacity);
+int shm_state_open(shm_state_t *shm, const char *name);
+void shm_state_close(shm_state_t *shm);
+void shm_state_set_count(shm_state_t *shm, uint32_t thread_count);
+void shm_state_update(shm_state_t *shm, uint32_t idx, const shm_snapshot_t *snapshot);
+bool shm_state_read(const shm_state_t *shm, uint32_t idx, shm_snapshot_t *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __square_h__
+#define __square_h__
+
+#include <stdint.h>
+#include "2048.h"
+
+/* Boards of other sizes, for the 3x3 and 5x5 research variants. Cells are
+ * nibbles row by row as on board_t, cell (r,c) of a size x size board at
+ * shift 4*(size*r + c), so a 3x3 board takes the low 36 bits and a 5x5 board
+ * 100. The search is the one of 2048.cpp, specialized for each size with its
+ * own row tables and cell masks; 4x4 games keep board_t and its tables. As on
+ * board_t, 32768 is the largest tile. */
+
+#define SQUARE_MIN_SIZE (3)
+#define SQUARE_MAX_SIZE (5)
+
+typedef unsigned __int128 square_board_t;
+
+/* Row tables of one board size, 16^size entries each. Like the move tables of
+ * table_data_t, the moves hold oldrow^newrow. */
+typedef struct {
+    int size;
+    uint32_t *row_left;
+    uint32_t *row_right;
+    float *heur_score;
+    float *score;
+} square_tables_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+square_tables_t *alloc_square_tables(int size);
+void free_square_tables(square_tables_t *tables);
+int find_best_move_square(int size, square_board_t board, search_stats_t *stats, const volatile bool *cancel);
+square_board_t execute_move_square(int size, int move, square_board_t board);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline unsigned square_get(square_board_t board, int i) {
+    return (unsigned)(board >> (4 * i)) & 0xf;
+}
+static inline square_board_t square_set(square_board_t board, int i, unsigned rank) {
+    return (board & ~((square_board_t)0xf << (4 * i))) | ((square_board_t)rank << (4 * i));
+}
+static inline uint8_t square_count_empty(int size, square_board_t board) {
+    uint8_t count = 0;
+    int i;
+    for (i = 0; i < size * size; i++) {
+        count += (square_get(board, i) == 0);
+    }
+    return count;
+}
+static inline uint8_t square_get_max_rank(int size, square_board_t board) {
+    uint8_t maxrank = 0;
+    int i;
+    for (i = 0; i < size * size; i++) {
+        maxrank = max(maxrank, (uint8_t)square_get(board, i));
+    }
+    return maxrank;
+}
+// Same as score_board()
+static inline uint32_t square_score_board(int size, square_board_t board) {
+    uint32_t score = 0;
+    int i;
+    for (i = 0; i < size * size; i++) {
+        unsigned rank = square_get(board, i);
+        if (rank >= 2) {
+            score += (rank - 1) << rank;
+        }
+    }
+    return score;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "stats.h"
+
+void stats_init(stats_t *stats)
+{
+    memset(stats,0,sizeof(*stats));
+    stats->start_time=time(NULL);
+    clock_gettime(CLOCK_MONOTONIC,&stats->tick_time);
+    pthread_mutex_init(&stats->completed_mutex,NULL);
+}
+void stats_destroy(stats_t *stats)
+{
+    pthread_mutex_destroy(&stats->completed_mutex);
+}
+// Bucket i holds values in [2^i, 2^(i+1)), the last bucket is open-ended
+uint8_t stats_log2_bucket(uint32_t value, uint8_t buckets)
+{
+    uint8_t bucket=0;
+    while(value>1 && bucket<buckets-1){
+        value>>=1;
+        bucket++;
+    }
+    return bucket;
+}
+uint64_t stats_elapsed_usec(const struct timespec *t0, const struct timespec *t1)
+{
+    return (uint64_t)(t1->tv_sec-t0->tv_sec)*1000000+(t1->tv_nsec-t0->tv_nsec)/1000;
+}
+void stats_track_board(stats_t *stats, stats_track_t *track, uint8_t rank, uint32_t score)
+{
+    rank=min(rank,STATS_RANK_COUNT-1);
+    uint8_t bucket=stats_log2_bucket(score,STATS_SCORE_BUCKETS);
+    if(track->tracked && track->rank==rank && track->score_bucket==bucket){
+        return;
+    }
+    if(track->tracked){
+        __atomic_fetch_sub(&stats->current_rank[track->rank],1,__ATOMIC_RELAXED);
+        __atomic_fetch_sub(&stats->current_score[track->score_bucket],1,__ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&stats->current_rank[rank],1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->current_score[bucket],1,__ATOMIC_RELAXED);
+    track->tracked=true;
+    track->rank=rank;
+    track->score_bucket=bucket;
+}
+void stats_untrack_board(stats_t *stats, stats_track_t *track)
+{
+    if(!track->tracked){
+        return;
+    }
+    __atomic_fetch_sub(&stats->current_rank[track->rank],1,__ATOMIC_RELAXED);
+    __atomic_fetch_sub(&stats->current_score[track->score_bucket],1,__ATOMIC_RELAXED);
+    track->tracked=false;
+}
+void stats_move_done(stats_t *stats, uint64_t nodes, uint64_t evictions)
+{
+    __atomic_fetch_add(&stats->moves_total,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->nodes_total,nodes,__ATOMIC_RELAXED);
+    if(evictions>0){
+        __atomic_fetch_add(&stats->evictions_total,evictions,__ATOMIC_RELAXED);
+    }
+}
+void stats_book_move(stats_t *stats)
+{
+    __atomic_fetch_add(&stats->moves_total,1,__ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->book_moves_total,1,__ATOMIC_RELAXED);
+}
+void stats_game_completed(stats_t *stats, uint32_t moveno, uint32_t score, uint8_t max_rank)
+{
+    pthread_mutex_lock(&stats->completed_mutex);
+    stats->games_completed++;
+    stats->completed_score_sum+=score;
+    stats->completed_moves_sum+=moveno;
+    stats->completed_score_max=max(stats->completed_score_max,score);
+    stats->completed_moves_max=max(stats->completed_moves_max,moveno);
+    stats->completed_rank[min(max_rank,STATS_RANK_COUNT-1)]++;
+    stats->completed_score_hist[stats_log2_bucket(score,STATS_SCORE_BUCKETS)]++;
+    stats->completed_moves_hist[stats_log2_bucket(moveno,STATS_MOVES_BUCKETS)]++;
+    pthread_mutex_unlock(&stats->completed_mutex);
+}
+void stats_tick(stats_t *stats)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    uint64_t usec=stats_elapsed_usec(&stats->tick_time,&now);
+    if(usec<1000000){
+        return;
+    }
+    uint64_t moves=__atomic_load_n(&stats->moves_total,__ATOMIC_RELAXED);
+    uint64_t nodes=__atomic_load_n(&stats->nodes_total,__ATOMIC_RELAXED);
+    double moves_rate=(moves-stats->tick_moves)*1000000.0/usec;
+    double nodes_rate=(nodes-stats->tick_nodes)*1000000.0/usec;
+    // Exponential moving average over roughly the last 10 seconds
+    if(stats->tick_moves==0){
+        stats->moves_per_sec=moves_rate;
+        stats->nodes_per_sec=nodes_rate;
+    }else{
+        stats->moves_per_sec=stats->moves_per_sec*0.9+moves_rate*0.1;
+        stats->nodes_per_sec=stats->nodes_per_sec*0.9+nodes_rate*0.1;
+    }
+    stats->tick_moves=moves;
+    stats->tick_nodes=nodes;
+    stats->tick_time=now;
+}
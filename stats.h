@@ -0,0 +1,68 @@
+#ifndef __stats_h__
+#define __stats_h__
+
+#include <stdint.h>
+#include <time.h>
+#include "2048.h"
+
+/* Fleet-level figures, maintained incrementally by the game threads so that
+ * queries never have to visit every board. */
+
+#define STATS_RANK_COUNT (18)   // up to 131072, the largest tile a game can make
+#define STATS_SCORE_BUCKETS (24)
+#define STATS_MOVES_BUCKETS (20)
+
+// Per-game position in the live histograms
+typedef struct{
+    bool tracked;
+    uint8_t rank;
+    uint8_t score_bucket;
+}stats_track_t;
+
+typedef struct{
+    time_t start_time;
+    uint64_t moves_total;
+    uint64_t nodes_total;
+    uint64_t book_moves_total;
+    uint64_t evictions_total;
+    uint32_t current_rank[STATS_RANK_COUNT];
+    uint32_t current_score[STATS_SCORE_BUCKETS];
+
+    pthread_mutex_t completed_mutex;
+    uint64_t games_completed;
+    uint64_t completed_score_sum;
+    uint64_t completed_moves_sum;
+    uint32_t completed_score_max;
+    uint32_t completed_moves_max;
+    uint64_t completed_rank[STATS_RANK_COUNT];
+    uint64_t completed_score_hist[STATS_SCORE_BUCKETS];
+    uint64_t completed_moves_hist[STATS_MOVES_BUCKETS];
+
+    // Sampled by stats_tick()
+    struct timespec tick_time;
+    uint64_t tick_moves;
+    uint64_t tick_nodes;
+    double moves_per_sec;
+    double nodes_per_sec;
+}stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void stats_init(stats_t *stats);
+void stats_destroy(stats_t *stats);
+void stats_track_board(stats_t *stats, stats_track_t *track, uint8_t rank, uint32_t score);
+void stats_untrack_board(stats_t *stats, stats_track_t *track);
+void stats_move_done(stats_t *stats, uint64_t nodes, uint64_t evictions);
+void stats_book_move(stats_t *stats);
+void stats_game_completed(stats_t *stats, uint32_t moveno, uint32_t score, uint8_t max_rank);
+void stats_tick(stats_t *stats);
+uint8_t stats_log2_bucket(uint32_t value, uint8_t buckets);
+uint64_t stats_elapsed_usec(const struct timespec *t0, const struct timespec *t1);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
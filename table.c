@@ -1,5 +1,7 @@
 #include <math.h>
 #include "2048.h"
+#include "wide.h"
+#include "square.h"
 
 /* We can perform state lookups one row at a time by using arrays with 65536 entries. */
 
@@ -12,90 +14,119 @@ static const float SCORE_SUM_WEIGHT = 11.0f;
 static const float SCORE_MERGES_WEIGHT = 700.0f;
 static const float SCORE_EMPTY_WEIGHT = 270.0f;
 
-void init_tables(table_data_t *table) {
+/* Heuristic powers of every rank a wide board can hold. Tabulating them keeps
+ * the heuristic of wide rows cheap and gives the same values as pow(). */
+static double rank_sum_pow[WIDE_MAX_RANK + 1];
+static double rank_monotonicity_pow[WIDE_MAX_RANK + 1];
+static pthread_once_t rank_pow_once = PTHREAD_ONCE_INIT;
+
+static void init_rank_pow(void) {
+    int rank;
+    for (rank = 0; rank <= WIDE_MAX_RANK; ++rank) {
+        rank_sum_pow[rank] = pow(rank, SCORE_SUM_POWER);
+        rank_monotonicity_pow[rank] = pow(rank, SCORE_MONOTONICITY_POWER);
+    }
+}
+
+// Score of a row of ranks, the total sum of its tiles and all intermediate merged tiles
+float line_score(const unsigned *line, int len) {
     int i;
-    unsigned int row;
-    for (row = 0; row < 65536; ++row) {
-        unsigned line[4] = {
-                (row >>  0) & 0xf,
-                (row >>  4) & 0xf,
-                (row >>  8) & 0xf,
-                (row >> 12) & 0xf
-        };
+    float score = 0.0f;
+    for (i = 0; i < len; ++i) {
+        int rank = line[i];
+        if (rank >= 2) {
+            score += (rank - 1) * (float)(1U << rank);
+        }
+    }
+    return score;
+}
 
-        // Score
-        float score = 0.0f;
-        for (i = 0; i < 4; ++i) {
-            int rank = line[i];
-            if (rank >= 2) {
-                // the score is the total sum of the tile and all intermediate merged tiles
-                score += (rank - 1) * (1 << rank);
+// Heuristic score of a row of ranks. init_tables() must have run.
+float line_heur_score(const unsigned *line, int len) {
+    int i;
+    float sum = 0;
+    int empty = 0;
+    int merges = 0;
+
+    int prev = 0;
+    int counter = 0;
+    for (i = 0; i < len; ++i) {
+        int rank = line[i];
+        sum += rank_sum_pow[rank];
+        if (rank == 0) {
+            empty++;
+        } else {
+            if (prev == rank) {
+                counter++;
+            } else if (counter > 0) {
+                merges += 1 + counter;
+                counter = 0;
             }
+            prev = rank;
         }
-        (table->score_table)[row] = score;
-
-        // Heuristic score
-        float sum = 0;
-        int empty = 0;
-        int merges = 0;
-
-        int prev = 0;
-        int counter = 0;
-        for (i = 0; i < 4; ++i) {
-            int rank = line[i];
-            sum += pow(rank, SCORE_SUM_POWER);
-            if (rank == 0) {
-                empty++;
-            } else {
-                if (prev == rank) {
-                    counter++;
-                } else if (counter > 0) {
-                    merges += 1 + counter;
-                    counter = 0;
-                }
-                prev = rank;
-            }
+    }
+    if (counter > 0) {
+        merges += 1 + counter;
+    }
+
+    float monotonicity_left = 0;
+    float monotonicity_right = 0;
+    for (i = 1; i < len; ++i) {
+        if (line[i-1] > line[i]) {
+            monotonicity_left += rank_monotonicity_pow[line[i-1]] - rank_monotonicity_pow[line[i]];
+        } else {
+            monotonicity_right += rank_monotonicity_pow[line[i]] - rank_monotonicity_pow[line[i-1]];
         }
-        if (counter > 0) {
-            merges += 1 + counter;
+    }
+
+    return SCORE_LOST_PENALTY +
+        SCORE_EMPTY_WEIGHT * empty +
+        SCORE_MERGES_WEIGHT * merges -
+        SCORE_MONOTONICITY_WEIGHT * min(monotonicity_left, monotonicity_right) -
+        SCORE_SUM_WEIGHT * sum;
+}
+
+// Move a row of ranks to the left. Merging two tiles of `max_rank` keeps `max_rank`.
+void line_move_left(unsigned *line, int len, unsigned max_rank) {
+    int i;
+    for (i = 0; i < len - 1; ++i) {
+        int j;
+        for (j = i + 1; j < len; ++j) {
+            if (line[j] != 0) break;
         }
+        if (j == len) break; // no more tiles to the right
 
-        float monotonicity_left = 0;
-        float monotonicity_right = 0;
-        for (i = 1; i < 4; ++i) {
-            if (line[i-1] > line[i]) {
-                monotonicity_left += pow(line[i-1], SCORE_MONOTONICITY_POWER) - pow(line[i], SCORE_MONOTONICITY_POWER);
-            } else {
-                monotonicity_right += pow(line[i], SCORE_MONOTONICITY_POWER) - pow(line[i-1], SCORE_MONOTONICITY_POWER);
+        if (line[i] == 0) {
+            line[i] = line[j];
+            line[j] = 0;
+            i--; // retry this entry
+        } else if (line[i] == line[j]) {
+            if(line[i] != max_rank) {
+                line[i]++;
             }
+            line[j] = 0;
         }
+    }
+}
+
+void init_tables(table_data_t *table) {
+    unsigned int row;
+    pthread_once(&rank_pow_once, init_rank_pow);
+    for (row = 0; row < 65536; ++row) {
+        unsigned line[4] = {
+                (row >>  0) & 0xf,
+                (row >>  4) & 0xf,
+                (row >>  8) & 0xf,
+                (row >> 12) & 0xf
+        };
 
-        (table->heur_score_table)[row] = SCORE_LOST_PENALTY +
-            SCORE_EMPTY_WEIGHT * empty +
-            SCORE_MERGES_WEIGHT * merges -
-            SCORE_MONOTONICITY_WEIGHT * min(monotonicity_left, monotonicity_right) -
-            SCORE_SUM_WEIGHT * sum;
+        (table->score_table)[row] = line_score(line, 4);
+        (table->heur_score_table)[row] = line_heur_score(line, 4);
 
         // execute a move to the left
-        for (i = 0; i < 3; ++i) {
-            int j;
-            for (j = i + 1; j < 4; ++j) {
-                if (line[j] != 0) break;
-            }
-            if (j == 4) break; // no more tiles to the right
-
-            if (line[i] == 0) {
-                line[i] = line[j];
-                line[j] = 0;
-                i--; // retry this entry
-            } else if (line[i] == line[j]) {
-                if(line[i] != 0xf) {
-                    /* Pretend that 32768 + 32768 = 32768 (representational limit). */
-                    line[i]++;
-                }
-                line[j] = 0;
-            }
-        }
+        /* Pretend that 32768 + 32768 = 32768 (representational limit); games
+         * switch to the wide board before that can happen. */
+        line_move_left(line, 4, 0xf);
 
         row_t result = (line[0] <<  0) |
                        (line[1] <<  4) |
@@ -110,3 +141,52 @@ void init_tables(table_data_t *table) {
         (table->col_down_table)[rev_row] = unpack_col(rev_row) ^ unpack_col(rev_result);
     }
 }
+
+// Row tables of a size x size board, built the same way as those of init_tables()
+square_tables_t *alloc_square_tables(int size) {
+    size_t rows = (size_t)1 << (4 * size), row;
+    square_tables_t *tables = (square_tables_t*)calloc(1, sizeof(square_tables_t));
+    if (tables == NULL) {
+        return NULL;
+    }
+    tables->size = size;
+    tables->row_left = (uint32_t*)malloc(rows * sizeof(uint32_t));
+    tables->row_right = (uint32_t*)malloc(rows * sizeof(uint32_t));
+    tables->heur_score = (float*)malloc(rows * sizeof(float));
+    tables->score = (float*)malloc(rows * sizeof(float));
+    if (tables->row_left == NULL || tables->row_right == NULL || tables->heur_score == NULL || tables->score == NULL) {
+        free_square_tables(tables);
+        return NULL;
+    }
+    pthread_once(&rank_pow_once, init_rank_pow);
+    for (row = 0; row < rows; ++row) {
+        unsigned line[SQUARE_MAX_SIZE], rev_line[SQUARE_MAX_SIZE];
+        uint32_t result = 0, rev_row = 0, rev_result = 0;
+        int i;
+        for (i = 0; i < size; ++i) {
+            line[i] = (row >> (4 * i)) & 0xf;
+            rev_row |= line[i] << (4 * (size - 1 - i));
+        }
+        tables->score[row] = line_score(line, size);
+        tables->heur_score[row] = line_heur_score(line, size);
+
+        line_move_left(line, size, 0xf);
+        for (i = 0; i < size; ++i) {
+            result |= line[i] << (4 * i);
+            rev_line[i] = line[size - 1 - i];
+            rev_result |= rev_line[i] << (4 * i);
+        }
+        tables->row_left[row] = row ^ result;
+        tables->row_right[rev_row] = rev_row ^ rev_result;
+    }
+    return tables;
+}
+void free_square_tables(square_tables_t *tables) {
+    if (tables != NULL) {
+        free(tables->row_left);
+        free(tables->row_right);
+        free(tables->heur_score);
+        free(tables->score);
+        free(tables);
+    }
+}
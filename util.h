@@ -47,5 +47,10 @@ static inline uint32_t unif_random(uint32_t n) {
     pthread_mutex_unlock(&rand_mutex);
     return (uint32_t)(rand_val * n);
 }
+// Seed of a new game. Never 0, which marks games whose seed is unknown.
+static inline uint64_t new_game_seed(void) {
+    uint64_t seed = ((uint64_t)unif_random(0xffffffff) << 32) | unif_random(0xffffffff);
+    return (seed == 0) ? 1 : seed;
+}
 
 #endif
@@ -13,42 +13,180 @@
 #include <termios.h>
 #include "util.h"
 #include "viewer.h"
+#include "shmstate.h"
+
+/* Terminal frame. The next frame is composed in `cells`, compared against
+ * `shown` (what the terminal currently displays) and only the differing runs
+ * are sent, assembled into one buffer and written with a single write(). */
+typedef struct{
+    uint16_t rows;
+    uint16_t cols;
+    char *cells;
+    char *shown;
+    bool valid;
+    char *out;
+    size_t out_len;
+    size_t out_size;
+}frame_t;
 
-typedef uint64_t board_t;
 typedef struct{
     int fd_socket;
+    shm_state_t shm;
     volatile bool running;
     volatile bool refresh;
+    uint16_t rows;
     uint16_t cols;
+    bool dashboard;
+    frame_t frame;
+    char *reply;
+    size_t reply_size;
     bool term_init;
     struct termios flags_orig;
 }viewer_t;
 
-static inline void _clrscr()
-{
-    printf("\033[2J");
-}
-static inline void goto_rowcol(uint8_t row, uint8_t col)
-{
-    printf("\033[%u;%uH",row+1,col+1);
-}
 static inline int _kbhit() {
     int bytesWaiting;
     ioctl(STDIN_FILENO, FIONREAD, &bytesWaiting);
     return bytesWaiting;
 }
-static inline uint16_t get_columns()
+static inline void get_winsize(uint16_t *rows, uint16_t *cols)
 {
     struct winsize size;
-    ioctl(STDIN_FILENO,TIOCGWINSZ,&size);
-    return size.ws_col;
+    if(ioctl(STDIN_FILENO,TIOCGWINSZ,&size)!=0 || size.ws_row==0 || size.ws_col==0){
+        size.ws_row=24;
+        size.ws_col=80;
+    }
+    *rows=size.ws_row;
+    *cols=size.ws_col;
+}
+
+static void frame_free(frame_t *frame)
+{
+    free(frame->cells);
+    free(frame->shown);
+    free(frame->out);
+    memset(frame,0,sizeof(*frame));
+}
+static int frame_resize(frame_t *frame, uint16_t rows, uint16_t cols)
+{
+    size_t count=(size_t)rows*cols;
+    char *cells=(char*)malloc(count);
+    char *shown=(char*)malloc(count);
+    if(NULL==cells || NULL==shown){
+        free(cells);
+        free(shown);
+        return E_NOSPACE;
+    }
+    free(frame->cells);
+    free(frame->shown);
+    frame->cells=cells;
+    frame->shown=shown;
+    frame->rows=rows;
+    frame->cols=cols;
+    frame->valid=false;
+    memset(frame->cells,' ',count);
+    return E_OK;
+}
+static inline void frame_clear(frame_t *frame)
+{
+    memset(frame->cells,' ',(size_t)frame->rows*frame->cols);
+}
+static void frame_puts(frame_t *frame, uint16_t row, uint16_t col, const char *str)
+{
+    if(row>=frame->rows){
+        return;
+    }
+    char *p=&(frame->cells[(size_t)row*frame->cols]);
+    for(; *str!='\0' && col<frame->cols; str++, col++){
+        p[col]=*str;
+    }
+}
+static bool frame_append(frame_t *frame, const char *data, size_t len)
+{
+    if(frame->out_len+len > frame->out_size){
+        size_t size=max(frame->out_size*2, frame->out_len+len+4096);
+        char *out=(char*)realloc(frame->out,size);
+        if(NULL==out){
+            return false;
+        }
+        frame->out=out;
+        frame->out_size=size;
+    }
+    memcpy(frame->out+frame->out_len,data,len);
+    frame->out_len+=len;
+    return true;
+}
+static inline bool frame_goto(frame_t *frame, uint16_t row, uint16_t col)
+{
+    char buf[32];
+    int len=snprintf(buf,sizeof(buf),"\033[%u;%uH",row+1,col+1);
+    return frame_append(frame,buf,len);
+}
+// Unchanged cells shorter than a cursor movement are rewritten rather than skipped
+#define FRAME_GAP_MAX 8
+static int frame_flush(frame_t *frame)
+{
+    uint16_t row,col;
+    frame->out_len=0;
+    if(!frame->valid){
+        frame_append(frame,"\033[H\033[2J",7);
+        memset(frame->shown,' ',(size_t)frame->rows*frame->cols);
+        frame->valid=true;
+    }
+    for(row=0; row<frame->rows; row++){
+        const char *cur=&(frame->cells[(size_t)row*frame->cols]);
+        char *shown=&(frame->shown[(size_t)row*frame->cols]);
+        col=0;
+        while(col<frame->cols){
+            if(cur[col]==shown[col]){
+                col++;
+                continue;
+            }
+            uint16_t run_start=col,run_end=col+1,gap=0;
+            for(col++; col<frame->cols && gap<FRAME_GAP_MAX; col++){
+                if(cur[col]!=shown[col]){
+                    run_end=col+1;
+                    gap=0;
+                }else{
+                    gap++;
+                }
+            }
+            if(!frame_goto(frame,row,run_start) ||
+                !frame_append(frame,cur+run_start,run_end-run_start)){
+                return E_NOSPACE;
+            }
+            memcpy(shown+run_start,cur+run_start,run_end-run_start);
+            col=run_end;
+        }
+    }
+    if(frame->out_len==0){
+        return E_OK;
+    }
+    frame_goto(frame,frame->rows-1,0);
+    size_t written=0;
+    while(written<frame->out_len){
+        ssize_t rc=write(STDOUT_FILENO,frame->out+written,frame->out_len-written);
+        if(rc<0 && errno==EINTR){
+            continue;
+        }else if(rc<=0){
+            frame->valid=false;
+            return E_FILEIO;
+        }
+        written+=rc;
+    }
+    return E_OK;
 }
 
 void close_viewer(viewer_t *viewer);
-int init_viewer(viewer_t *viewer, const char *socket_path)
+int init_viewer(viewer_t *viewer, const char *socket_path, const char *shm_name)
 {
     int rc=E_OK;
     viewer->term_init=false;
+    viewer->shm.fd=-1;
+    viewer->shm.header=NULL;
+    memset(&viewer->frame,0,sizeof(viewer->frame));
+    viewer->reply=NULL;
+    viewer->reply_size=0;
     viewer->fd_socket=socket(PF_UNIX,SOCK_STREAM,0);
     if(viewer->fd_socket<0){
         fprintf(stderr,"Failed to init socket.\n");
@@ -66,9 +204,14 @@ int init_viewer(viewer_t *viewer, const char *socket_path)
         goto error_exit;
     }
     
+    // Fall back to socket queries when the live state segment is unavailable
+    if(shm_state_open(&viewer->shm,shm_name)!=E_OK){
+        viewer->shm.header=NULL;
+    }
+    
     viewer->running=true;
     viewer->refresh=true;
-    viewer->cols=get_columns();
+    get_winsize(&viewer->rows,&viewer->cols);
     
     // Disable echo, set stdin non-blocking for kbhit works
     struct termios flags;
@@ -90,48 +233,134 @@ void close_viewer(viewer_t *viewer)
     if(viewer->term_init){
         tcsetattr(STDIN_FILENO, TCSANOW, &viewer->flags_orig);
     }
+    shm_state_close(&viewer->shm);
     if(viewer->fd_socket>=0){
         close(viewer->fd_socket);
     }
+    frame_free(&viewer->frame);
+    free(viewer->reply);
 }
 
-static inline void print_board(board_t board,uint8_t row,uint8_t col) {
+static inline void print_board(frame_t *frame, board_t board, uint16_t row, uint16_t col) {
     int i,j;
+    char line[32],*p;
     for(i=0; i<4; i++) {
-        goto_rowcol(row+i,col);
+        p=line;
         for(j=0; j<4; j++) {
             uint8_t powerVal = (board) & 0xf;
             if(powerVal == 0){
-                printf("    . ");
+                p+=sprintf(p,"    . ");
             }else{
-                printf("%5u ", ((uint16_t)1)<<powerVal);
+                p+=sprintf(p,"%5u ", ((uint16_t)1)<<powerVal);
             }
             board >>= 4;
         }
+        frame_puts(frame,row+i,col,line);
     }
 }
 #define BOARD_WIDTH 25
 #define BOARD_HEIGHT 6
-static inline int print_boards_all(viewer_t *viewer)
+static inline void print_game(viewer_t *viewer, uint32_t moveno, uint32_t score, board_t board,
+    uint16_t *row, uint16_t *col)
 {
-    char cmd='b',buf[1024];
-    int i;
-    while(read(viewer->fd_socket,buf,sizeof(buf))>0);
+    char buf[64];
+    snprintf(buf,sizeof(buf),"Move:%-5u Score:%-6u",moveno,score);
+    frame_puts(&viewer->frame,*row,*col,buf);
+    print_board(&viewer->frame,board,(*row)+1,*col);
+    (*col)+=BOARD_WIDTH;
+    if(((*col)+BOARD_WIDTH)>=viewer->cols){
+        (*col)=0;
+        (*row)+=BOARD_HEIGHT;
+    }
+}
+static inline int print_boards_shm(viewer_t *viewer)
+{
+    const shm_header_t *header=viewer->shm.header;
+    if(!__atomic_load_n(&header->active,__ATOMIC_ACQUIRE)){
+        return E_FILEIO;
+    }
+    uint32_t i,thread_count=__atomic_load_n(&header->thread_count,__ATOMIC_ACQUIRE);
+    uint16_t row=0,col=0;
+    for(i=0; i<thread_count && row<viewer->rows; i++){
+        shm_snapshot_t snapshot;
+        // A record left mid-update by a dead daemon is skipped
+        if(!shm_state_read(&viewer->shm,i,&snapshot)){
+            continue;
+        }
+        print_game(viewer,snapshot.moveno,snapshot.score,snapshot.board,&row,&col);
+    }
+    return E_OK;
+}
+/* Send a command and read the reply, which starts with the number of lines
+ * following it. The reply buffer grows until the whole reply is received. */
+static int query_daemon(viewer_t *viewer, char cmd, char **lines)
+{
+    char discard[256];
+    while(read(viewer->fd_socket,discard,sizeof(discard))>0);
     int rc=write(viewer->fd_socket,&cmd,sizeof(cmd));
     if(rc<=0){
         return E_FILEIO;
     }
+    size_t len=0;
+    long expected=-1,received=0;
     uint16_t retry=200;
-    do{
-        usleep(1000);
-        rc=read(viewer->fd_socket,buf,sizeof(buf)-1);
-    }while(viewer->running && rc<0 && errno==EAGAIN && retry--);
-    if(rc<=0 && errno==EAGAIN){
-        return E_TIMEOUT;
-    }else if(rc<=0){
-        return E_FILEIO;
+    while(viewer->running){
+        if(len+1>=viewer->reply_size){
+            size_t size=max(viewer->reply_size*2,4096);
+            char *reply=(char*)realloc(viewer->reply,size);
+            if(NULL==reply){
+                return E_NOSPACE;
+            }
+            viewer->reply=reply;
+            viewer->reply_size=size;
+        }
+        rc=read(viewer->fd_socket,viewer->reply+len,viewer->reply_size-len-1);
+        if(rc<0 && errno==EAGAIN){
+            if(retry--==0){
+                return E_TIMEOUT;
+            }
+            usleep(1000);
+            continue;
+        }else if(rc<=0){
+            return E_FILEIO;
+        }
+        char *p=viewer->reply+len;
+        len+=rc;
+        viewer->reply[len]='\0';
+        for(; (p=strchr(p,'\n'))!=NULL; p++){
+            received++;
+        }
+        if(expected<0 && received>0){
+            expected=strtol(viewer->reply,NULL,10)+1;
+        }
+        if(expected>=0 && received>=expected){
+            break;
+        }
+    }
+    if(!viewer->running){
+        return E_AGAIN;
+    }
+    *lines=viewer->reply;
+    return E_OK;
+}
+static inline int print_boards_all(viewer_t *viewer)
+{
+    frame_clear(&viewer->frame);
+    if(NULL!=viewer->shm.header){
+        int rc=print_boards_shm(viewer);
+        if(rc!=E_OK){
+            return rc;
+        }
+        return frame_flush(&viewer->frame);
+    }
+    char *buf=NULL;
+    int i;
+    int rc=query_daemon(viewer,'b',&buf);
+    if(rc==E_AGAIN){
+        return E_OK;
+    }else if(rc!=E_OK){
+        return rc;
     }
-    buf[rc]='\0';
     
     // Get thread count
     char *p_start=buf,*p_end=strchr(p_start,'\n');
@@ -139,13 +368,12 @@ static inline int print_boards_all(viewer_t *viewer)
         return E_INVAL;
     }
     *p_end='\0';
-    uint16_t thread_count=strtoul(p_start,NULL,0);
+    uint32_t thread_count=strtoul(p_start,NULL,0);
     p_start=p_end+1;
     
     // Display boards
-    goto_rowcol(0,0);
     uint16_t row=0,col=0;
-    for(i=0; i<thread_count; i++){
+    for(i=0; i<thread_count && row<viewer->rows; i++){
         p_end=strchr(p_start,'\n');
         if(p_end!=NULL){
             *p_end='\0';
@@ -153,22 +381,129 @@ static inline int print_boards_all(viewer_t *viewer)
         uint32_t moveno,score,idx;
         board_t board;
         sscanf(p_start,"%u,%u,%u,%llx",&idx,&moveno,&score,&board);
-        goto_rowcol(row,col);
-        printf("Move:%-5u Score:%-6u",moveno,score);
-        print_board(board,row+1,col);
-        col+=BOARD_WIDTH;
-        if((col+BOARD_WIDTH)>=viewer->cols){
-            col=0;
-            row+=BOARD_HEIGHT;
-        }
+        print_game(viewer,moveno,score,board,&row,&col);
         if(p_end!=NULL){
             p_start=p_end+1;
         }else{
             break;
         }
     }
-    fflush(stdout);
-    return E_OK;
+    return frame_flush(&viewer->frame);
+}
+/* Dashboard mode, showing the fleet-level figures aggregated by the daemon
+ * instead of every board. */
+#define HIST_BAR_WIDTH 30
+#define STATS_LINES_MAX 32
+typedef struct{
+    int count;
+    const char *keys[STATS_LINES_MAX];
+    const char *values[STATS_LINES_MAX];
+}stat_lines_t;
+// Split "key value" lines in place
+static void parse_stats(char *lines, stat_lines_t *stats)
+{
+    char *p=strchr(lines,'\n');
+    stats->count=0;
+    while(p!=NULL && stats->count<STATS_LINES_MAX){
+        char *line=p+1,*value;
+        p=strchr(line,'\n');
+        if(p==NULL){
+            break;
+        }
+        *p='\0';
+        value=strchr(line,' ');
+        if(value!=NULL){
+            *value++='\0';
+        }
+        stats->keys[stats->count]=line;
+        stats->values[stats->count]=(value!=NULL) ? value : "";
+        stats->count++;
+    }
+}
+static const char *find_stat(const stat_lines_t *stats, const char *key)
+{
+    int i;
+    for(i=0; i<stats->count; i++){
+        if(strcmp(stats->keys[i],key)==0){
+            return stats->values[i];
+        }
+    }
+    return "";
+}
+// Draw a histogram given as "label:count label:count ..."
+static uint16_t print_histogram(frame_t *frame, uint16_t row, uint16_t col, const char *title,
+    const char *values)
+{
+    char buf[128];
+    unsigned long long label,count,max_count=0;
+    const char *p;
+    int n;
+    for(p=values; sscanf(p," %llu:%llu%n",&label,&count,&n)==2; p+=n){
+        max_count=max(max_count,count);
+    }
+    frame_puts(frame,row++,col,title);
+    for(p=values; sscanf(p," %llu:%llu%n",&label,&count,&n)==2; p+=n){
+        int width=(max_count>0) ? (int)((count*HIST_BAR_WIDTH+max_count-1)/max_count) : 0;
+        int len=snprintf(buf,sizeof(buf),"%8llu |",label);
+        memset(buf+len,'#',width);
+        snprintf(buf+len+width,sizeof(buf)-len-width," %llu",count);
+        frame_puts(frame,row++,col,buf);
+    }
+    return row;
+}
+static inline int print_dashboard(viewer_t *viewer)
+{
+    char *reply=NULL,buf[256];
+    int rc=query_daemon(viewer,'s',&reply);
+    if(rc==E_AGAIN){
+        return E_OK;
+    }else if(rc!=E_OK){
+        return rc;
+    }
+    stat_lines_t stats;
+    parse_stats(reply,&stats);
+    const stat_lines_t *lines=&stats;
+    frame_t *frame=&viewer->frame;
+    frame_clear(frame);
+
+    long uptime=strtol(find_stat(lines,"uptime"),NULL,10);
+    snprintf(buf,sizeof(buf),"2048 dashboard    uptime %ldd %02ld:%02ld:%02ld",
+        uptime/86400,(uptime/3600)%24,(uptime/60)%60,uptime%60);
+    frame_puts(frame,0,0,buf);
+    snprintf(buf,sizeof(buf),"Games running: %s    Moves: %s    Moves/sec: %s",
+        find_stat(lines,"games"),find_stat(lines,"moves"),find_stat(lines,"moves_per_sec"));
+    frame_puts(frame,1,0,buf);
+
+    unsigned long score_mean=0,score_max=0,moves_mean=0,moves_max=0;
+    sscanf(find_stat(lines,"completed_score"),"%lu %lu",&score_mean,&score_max);
+    sscanf(find_stat(lines,"completed_moves"),"%lu %lu",&moves_mean,&moves_max);
+    snprintf(buf,sizeof(buf),"Completed: %s    Games/hour: %s    Score: avg %lu max %lu    Moves: avg %lu max %lu",
+        find_stat(lines,"games_completed"),find_stat(lines,"games_per_hour"),
+        score_mean,score_max,moves_mean,moves_max);
+    frame_puts(frame,2,0,buf);
+
+    uint16_t half=max(viewer->cols/2,HIST_BAR_WIDTH+20);
+    uint16_t row=print_histogram(frame,4,0,"Current max tile",find_stat(lines,"current_tile"));
+    uint16_t row_right=print_histogram(frame,4,half,"Current score",find_stat(lines,"current_score"));
+    row=max(row,row_right)+1;
+    print_histogram(frame,row,half,"Completed max tile",find_stat(lines,"completed_tile"));
+
+    frame_puts(frame,row++,0,"Slowest games (last move)");
+    unsigned int idx,usec;
+    int n;
+    const char *p;
+    for(p=find_stat(lines,"slowest"); sscanf(p," %u:%u%n",&idx,&usec,&n)==2; p+=n){
+        snprintf(buf,sizeof(buf),"  #%-5u %10.1f ms",idx,usec/1000.0);
+        frame_puts(frame,row++,0,buf);
+    }
+    return frame_flush(frame);
+}
+static inline int print_view(viewer_t *viewer)
+{
+    if(viewer->dashboard){
+        return print_dashboard(viewer);
+    }
+    return print_boards_all(viewer);
 }
 viewer_t viewer;
 void do_stop_viewer(int signal)
@@ -179,11 +514,12 @@ void do_refresh_viewer(int signal)
 {
     viewer.refresh=true;
 }
-int viewer2048(const char *socket_path)
+int viewer2048(const char *socket_path, const char *shm_name, bool dashboard)
 {
-    if(init_viewer(&viewer,socket_path)!=E_OK){
+    if(init_viewer(&viewer,socket_path,shm_name)!=E_OK){
         return 1;
     }
+    viewer.dashboard=dashboard;
     signal(SIGINT,do_stop_viewer);
     signal(SIGQUIT,do_stop_viewer);
     signal(SIGTERM,do_stop_viewer);
@@ -193,15 +529,17 @@ int viewer2048(const char *socket_path)
     while(viewer.running) {
         if(viewer.refresh){
             viewer.refresh=false;
-            viewer.cols=get_columns();
-            _clrscr();
-            rc_print=print_boards_all(&viewer);
+            get_winsize(&viewer.rows,&viewer.cols);
+            if(frame_resize(&viewer.frame,viewer.rows,viewer.cols)!=E_OK){
+                break;
+            }
+            rc_print=print_view(&viewer);
             t0=time(NULL);
         }else{
             time_t t=time(NULL);
             if((t-t0)>=1){
                 t0=t;
-                rc_print=print_boards_all(&viewer);
+                rc_print=print_view(&viewer);
             }
         }
         if(rc_print!=E_OK){
@@ -218,11 +556,16 @@ int viewer2048(const char *socket_path)
             case 'Q':
                 viewer.running=false;
             break;
+            case 'd':
+            case 'D':
+                viewer.dashboard=!viewer.dashboard;
+                viewer.refresh=true;
+            break;
         }
 	    usleep(1000);
     }
-    _clrscr();
-    goto_rowcol(0,0);
+    printf("\033[H\033[2J");
+    fflush(stdout);
     close_viewer(&viewer);
     return 0;
 }
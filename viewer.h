@@ -1,11 +1,13 @@
 #ifndef __viewer_h__
 #define __viewer_h__
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-int viewer2048(const char *socket_path);
+int viewer2048(const char *socket_path, const char *shm_name, bool dashboard);
 
 #ifdef __cplusplus
 }
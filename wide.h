@@ -0,0 +1,217 @@
+#ifndef __wide_h__
+#define __wide_h__
+
+#include <stdint.h>
+#include "2048.h"
+
+/* Board for games past the 32768 tile. board_t holds ranks up to 15 only and
+ * its move tables pretend that 32768 + 32768 = 32768, so a game switches to
+ * this board once it makes a 32768 tile and plays on with a byte per cell.
+ * Rows whose ranks all fit a nibble still move and score through the nibble
+ * tables; only the rows holding the big tiles are worked out cell by cell.
+ * Cell i is byte i, in the same order as the nibbles of board_t. */
+
+#define WIDE_MAX_RANK (20)
+// Games switch to the wide board once they hold a tile of this rank
+#define WIDE_SWITCH_RANK (15)
+
+typedef struct{
+    uint64_t half[2];   // rows 0-1, rows 2-3
+}wide_board_t;
+
+typedef uint32_t wide_row_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int find_best_move_wide(table_data_t *table, wide_board_t board, search_stats_t *stats,
+    const volatile bool *cancel);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline unsigned wide_get(wide_board_t board, int i) {
+    return (board.half[i >> 3] >> (8 * (i & 7))) & 0xff;
+}
+static inline wide_board_t wide_set(wide_board_t board, int i, unsigned rank) {
+    uint64_t mask = 0xffULL << (8 * (i & 7));
+    board.half[i >> 3] = (board.half[i >> 3] & ~mask) | ((uint64_t)rank << (8 * (i & 7)));
+    return board;
+}
+static inline bool wide_equal(wide_board_t a, wide_board_t b) {
+    return a.half[0] == b.half[0] && a.half[1] == b.half[1];
+}
+static inline wide_row_t wide_get_row(wide_board_t board, int row) {
+    return (wide_row_t)(board.half[row >> 1] >> (32 * (row & 1)));
+}
+static inline wide_board_t wide_from_rows(const wide_row_t rows[4]) {
+    wide_board_t board;
+    board.half[0] = rows[0] | ((uint64_t)rows[1] << 32);
+    board.half[1] = rows[2] | ((uint64_t)rows[3] << 32);
+    return board;
+}
+
+// Spread eight nibbles over eight bytes and back
+static inline uint64_t wide_spread(uint64_t x) {
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x <<  8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return x;
+}
+static inline uint64_t wide_gather(uint64_t x) {
+    x &= 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >>  4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >>  8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return x;
+}
+static inline wide_board_t wide_from_board(board_t board) {
+    wide_board_t wide;
+    wide.half[0] = wide_spread(board & 0xFFFFFFFFULL);
+    wide.half[1] = wide_spread(board >> 32);
+    return wide;
+}
+// The board with every rank above 15 shown as 15, for display and statistics
+static inline board_t wide_to_board(wide_board_t wide) {
+    int i;
+    for (i = 0; i < 16; i++) {
+        if (wide_get(wide, i) > 0xf) {
+            wide = wide_set(wide, i, 0xf);
+        }
+    }
+    return wide_gather(wide.half[0]) | (wide_gather(wide.half[1]) << 32);
+}
+
+// Rows whose ranks all fit a nibble, and below 15 for moves, use the nibble tables
+static inline bool wide_row_fits(wide_row_t row) {
+    return (row & 0xF0F0F0F0U) == 0;
+}
+static inline bool wide_row_fits_move(wide_row_t row) {
+    return ((row + 0x01010101U) & 0xF0F0F0F0U) == 0;
+}
+static inline void wide_row_line(wide_row_t row, unsigned line[4]) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        line[i] = (row >> (8 * i)) & 0xff;
+    }
+}
+static inline wide_row_t wide_row_left(table_data_t *table, wide_row_t row) {
+    if (wide_row_fits_move(row)) {
+        row_t r = (row_t)wide_gather(row);
+        return (wide_row_t)wide_spread(r ^ table->row_left_table[r]);
+    }
+    unsigned line[4];
+    wide_row_line(row, line);
+    line_move_left(line, 4, WIDE_MAX_RANK);
+    return line[0] | (line[1] << 8) | (line[2] << 16) | (line[3] << 24);
+}
+static inline wide_row_t wide_row_right(table_data_t *table, wide_row_t row) {
+    return __builtin_bswap32(wide_row_left(table, __builtin_bswap32(row)));
+}
+static inline float wide_row_heur(table_data_t *table, wide_row_t row) {
+    if (wide_row_fits(row)) {
+        return table->heur_score_table[wide_gather(row)];
+    }
+    unsigned line[4];
+    wide_row_line(row, line);
+    return line_heur_score(line, 4);
+}
+
+// Same as transpose(), on bytes
+static inline wide_board_t wide_transpose(wide_board_t board) {
+    uint64_t h0 = board.half[0], h1 = board.half[1], t;
+    // Transpose the 2x2 blocks
+    t = ((h0 >> 24) ^ h0) & 0x00000000FF00FF00ULL;
+    h0 ^= t ^ (t << 24);
+    t = ((h1 >> 24) ^ h1) & 0x00000000FF00FF00ULL;
+    h1 ^= t ^ (t << 24);
+    // Swap the top right and bottom left blocks
+    t = ((h0 >> 16) ^ h1) & 0x0000FFFF0000FFFFULL;
+    h1 ^= t;
+    h0 ^= t << 16;
+    board.half[0] = h0;
+    board.half[1] = h1;
+    return board;
+}
+
+static inline uint8_t wide_count_empty(wide_board_t board) {
+    uint8_t count = 0;
+    int i;
+    for (i = 0; i < 2; i++) {
+        uint64_t x = board.half[i];
+        uint64_t y = (x & 0x7F7F7F7F7F7F7F7FULL) + 0x7F7F7F7F7F7F7F7FULL;
+        count += __builtin_popcountll(~(y | x | 0x7F7F7F7F7F7F7F7FULL));
+    }
+    return count;
+}
+
+static inline wide_board_t wide_execute_move(table_data_t *table, int move, wide_board_t board) {
+    wide_row_t rows[4];
+    int i;
+    wide_board_t t = (move < 2) ? wide_transpose(board) : board;
+    for (i = 0; i < 4; i++) {
+        wide_row_t row = wide_get_row(t, i);
+        rows[i] = (move & 1) ? wide_row_right(table, row) : wide_row_left(table, row);
+    }
+    t = wide_from_rows(rows);
+    return (move < 2) ? wide_transpose(t) : t;
+}
+// Same as expand_all_moves()
+static inline uint8_t wide_expand_all_moves(table_data_t *table, wide_board_t board, wide_board_t moves[4]) {
+    uint8_t legal = 0;
+    int move;
+    for (move = 0; move < 4; move++) {
+        moves[move] = wide_execute_move(table, move, board);
+        if (!wide_equal(moves[move], board)) {
+            legal |= 1 << move;
+        }
+    }
+    return legal;
+}
+
+static inline float wide_score_heur_board(table_data_t *table, wide_board_t board) {
+    wide_board_t t = wide_transpose(board);
+    return (wide_row_heur(table, wide_get_row(board, 0)) +
+            wide_row_heur(table, wide_get_row(board, 1)) +
+            wide_row_heur(table, wide_get_row(board, 2)) +
+            wide_row_heur(table, wide_get_row(board, 3))) +
+           (wide_row_heur(table, wide_get_row(t, 0)) +
+            wide_row_heur(table, wide_get_row(t, 1)) +
+            wide_row_heur(table, wide_get_row(t, 2)) +
+            wide_row_heur(table, wide_get_row(t, 3)));
+}
+// Same as score_board()
+static inline uint32_t wide_score_board(wide_board_t board) {
+    uint32_t score = 0;
+    int i;
+    for (i = 0; i < 16; i++) {
+        unsigned rank = wide_get(board, i);
+        if (rank >= 2) {
+            score += (rank - 1) << rank;
+        }
+    }
+    return score;
+}
+
+static inline uint8_t wide_get_max_rank(wide_board_t board) {
+    uint8_t maxrank = 0;
+    int i;
+    for (i = 0; i < 16; i++) {
+        maxrank = max(maxrank, (uint8_t)wide_get(board, i));
+    }
+    return maxrank;
+}
+
+static inline uint8_t wide_count_distinct_tiles(wide_board_t board) {
+    uint32_t bitset = 0;
+    int i;
+    for (i = 0; i < 16; i++) {
+        bitset |= 1U << wide_get(board, i);
+    }
+    // Don't count empty tiles.
+    return __builtin_popcount(bitset >> 1);
+}
+
+#endif
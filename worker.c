@@ -1,59 +1,128 @@
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
 #include "worker.h"
 #include "fileio.h"
+#include "game.h"
+#include "coordinator.h"
 
-static table_data_t table_data;
 
-// For game play
-static inline board_t draw_tile(rand_t *rand) {
-    return (getRandom(rand) & 1) ? 2 : 1;
+// Publish the game state to the live state segment and the fleet statistics
+static void publish_state(thread_data_t *thread_data)
+{
+    worker_t *worker=thread_data->worker;
+    shm_snapshot_t snapshot;
+    pthread_rwlock_rdlock(&thread_data->rwlock);
+    snapshot.moveno=thread_data->moveno;
+    snapshot.scoreoffset=thread_data->scoreoffset;
+    snapshot.board=thread_data->board;
+    bool wide=thread_data->wide;
+    wide_board_t wide_board=thread_data->wide_board;
+    snapshot.moves_evaled=thread_data->last_search.moves_evaled;
+    snapshot.cachehits=thread_data->last_search.cachehits;
+    snapshot.maxdepth=thread_data->last_search.maxdepth;
+    snapshot.moves_evaled_total=thread_data->moves_evaled_total;
+    pthread_rwlock_unlock(&thread_data->rwlock);
+    snapshot.score=game_score(worker->table_data,snapshot.board,wide,wide_board,snapshot.scoreoffset);
+    stats_track_board(&worker->stats,&thread_data->track,game_max_rank(snapshot.board,wide,wide_board),
+        snapshot.score);
+    if(NULL!=worker->shm.header){
+        shm_state_update(&worker->shm,thread_data->index,&snapshot);
+    }
 }
-static inline board_t insert_tile_rand(rand_t *rand, board_t board, board_t tile) {
-    int index = getRandom(rand) % (count_empty(board));
-    board_t tmp = board;
-    while (true) {
-        while ((tmp & 0xf) != 0) {
-            tmp >>= 4;
-            tile <<= 4;
-        }
-        if (index == 0) break;
-        --index;
-        tmp >>= 4;
-        tile <<= 4;
+static void complete_game(thread_data_t *thread_data)
+{
+    worker_t *worker=thread_data->worker;
+    pthread_rwlock_rdlock(&thread_data->rwlock);
+    board_t board=thread_data->board;
+    bool wide=thread_data->wide;
+    wide_board_t wide_board=thread_data->wide_board;
+    uint32_t score_offset=thread_data->scoreoffset;
+    uint32_t moveno=thread_data->moveno;
+    pthread_rwlock_unlock(&thread_data->rwlock);
+    if(moveno==0 || board==0){
+        return;
     }
-    return board | tile;
+    uint32_t score=game_score(worker->table_data,board,wide,wide_board,score_offset);
+    stats_game_completed(&worker->stats,moveno,score,game_max_rank(board,wide,wide_board));
 }
 void init_game(thread_data_t *thread_data)
 {
-    rand_t *rand=&thread_data->rand;
-    board_t board = (draw_tile(rand) << (4 * (getRandom(rand) % 16)));
-    board = insert_tile_rand(rand, board, draw_tile(rand));
+    uint64_t seed = new_game_seed();
+    rand_t rand;
+    initRandom(&rand, seed);
+    board_t board = new_board(&rand);
     pthread_rwlock_wrlock(&thread_data->rwlock);
+    thread_data->seed = seed;
+    thread_data->rand = rand;
     thread_data->moveno = 0;
     thread_data->scoreoffset = 0;
     thread_data->board = board;
+    thread_data->wide = false;
+    memset(&thread_data->last_search, 0, sizeof(thread_data->last_search));
+    thread_data->moves_evaled_total = 0;
+    thread_data->last_move_usec = 0;
     pthread_rwlock_unlock(&thread_data->rwlock);
+    publish_state(thread_data);
 }
-int play_game(table_data_t *table, thread_data_t *thread_data)
+int play_game(thread_data_t *thread_data)
 {
     pthread_rwlock_rdlock(&thread_data->rwlock);
+    // A resize may move the game to another node between two moves
+    table_data_t *table = thread_data->table;
+    int node = thread_data->node;
     board_t board = thread_data->board;
+    bool wide = thread_data->wide;
+    wide_board_t wide_board = thread_data->wide_board;
+    rand_t rand = thread_data->rand;
     pthread_rwlock_unlock(&thread_data->rwlock);
     bool playing=true;
-    while(thread_data->worker->running && playing) {
-        int move = find_best_move(table, board);
-        if(move < 0){
+    while(thread_data->worker->running && !thread_data->stop && playing) {
+        search_stats_t stats;
+        struct timespec t0, t1;
+        board_t moves[4];
+        wide_board_t wide_moves[4];
+        if(!wide && get_max_rank(board) >= WIDE_SWITCH_RANK){
+            wide = true;
+            wide_board = wide_from_board(board);
+        }
+        uint8_t legal = wide ? wide_expand_all_moves(table, wide_board, wide_moves) :
+            expand_all_moves(table, board, moves);
+        if(legal == 0){
             playing=false;
             break;
         }
-        board_t newboard = execute_move(table, move, board);
-        if(newboard == board) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int move = wide ? -1 : book_lookup(&thread_data->worker->book, board);
+        bool from_book = (move >= 0 && (legal & (1 << move)));
+        if(from_book){
+            memset(&stats, 0, sizeof(stats));
+        }else if(wide){
+            // Rare and long games, searched on their own thread
+            move = find_best_move_wide(table, wide_board, &stats, &thread_data->stop);
+        }else if(NULL!=thread_data->worker->sched){
+            move = sched_find_best_move(thread_data->worker->sched, thread_data->index, node, table,
+                board, &stats, &thread_data->stop);
+        }else{
+            move = find_best_move_depth(table, board, 0, &stats, &thread_data->stop);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if(move < 0){
+            // An abandoned search leaves the game as it was for the snapshot
+            playing=thread_data->stop;
+            break;
+        }
+        if(!(legal & (1 << move))) {
             fprintf(stderr, "Illegal move!\n");
             abort();
         }
-        board_t tile=draw_tile(&thread_data->rand);
-        board=insert_tile_rand(&thread_data->rand,newboard,tile);
+        board_t tile=draw_tile(&rand);
+        if(wide){
+            wide_board=wide_insert_tile_rand(&rand,wide_moves[move],tile);
+            board=wide_to_board(wide_board);
+        }else{
+            board=insert_tile_rand(&rand,moves[move],tile);
+        }
         
         pthread_rwlock_wrlock(&thread_data->rwlock);
         (thread_data->moveno)++;
@@ -61,14 +130,30 @@ int play_game(table_data_t *table, thread_data_t *thread_data)
             (thread_data->scoreoffset) += 4;
         }
         thread_data->board = board;
+        thread_data->wide = wide;
+        thread_data->wide_board = wide_board;
+        thread_data->rand = rand;
+        thread_data->last_search = stats;
+        thread_data->moves_evaled_total += stats.moves_evaled;
+        thread_data->last_move_usec = stats_elapsed_usec(&t0, &t1);
+        table = thread_data->table;
+        node = thread_data->node;
         pthread_rwlock_unlock(&thread_data->rwlock);
+        __atomic_fetch_add(&thread_data->busy_usec, stats_elapsed_usec(&t0, &t1), __ATOMIC_RELAXED);
+        if(from_book){
+            stats_book_move(&thread_data->worker->stats);
+        }else{
+            stats_move_done(&thread_data->worker->stats, stats.moves_evaled, stats.evictions);
+        }
+        publish_state(thread_data);
     }
     return playing;
 }
 void* thread_main(void *data){
     thread_data_t *thread_data = (thread_data_t*)data;
-    while (thread_data->worker->running) {
-        if (!play_game(thread_data->worker->table_data, thread_data)) {
+    while (thread_data->worker->running && !thread_data->stop) {
+        if (!play_game(thread_data)) {
+            complete_game(thread_data);
             write_log(thread_data);
             init_game(thread_data);
         }
@@ -76,56 +161,346 @@ void* thread_main(void *data){
     return NULL;
 }
 
+// Pin the game to its CPUs and give it the move tables of its node
+static void place_thread(worker_t *worker, thread_data_t *thread_data)
+{
+    thread_data->table=worker->table_data;
+    thread_data->node=-1;
+    if(worker->placement==PLACEMENT_NONE){
+        return;
+    }
+    int node=placement_cpuset(&worker->topology, worker->placement, thread_data->index,
+        worker->thread_count, &thread_data->cpuset);
+    if(node<0){
+        return;
+    }
+    thread_data->node=node;
+    if(NULL==worker->node_tables[node]){
+        worker->node_tables[node]=alloc_node_tables(&worker->topology, node, worker->huge_pages);
+    }
+    if(NULL!=worker->node_tables[node]){
+        thread_data->table=worker->node_tables[node];
+    }
+}
+/* Place the games that keep running after a resize like games started with
+ * the new count, so no CPU carries more games than another. */
+static void replace_threads(worker_t *worker, uint16_t count)
+{
+    uint16_t i;
+    if(worker->placement==PLACEMENT_NONE){
+        return;
+    }
+    for(i=0; i<count; i++){
+        thread_data_t *thread_data=worker->thread_data[i];
+        pthread_rwlock_wrlock(&thread_data->rwlock);
+        place_thread(worker,thread_data);
+        pthread_rwlock_unlock(&thread_data->rwlock);
+        if(thread_data->node>=0){
+            pthread_setaffinity_np(thread_data->tid, sizeof(thread_data->cpuset), &thread_data->cpuset);
+        }
+    }
+}
+static thread_data_t *new_thread(worker_t *worker, uint16_t index)
+{
+    thread_data_t *thread_data=(thread_data_t*)calloc(1,sizeof(thread_data_t));
+    if(NULL==thread_data){
+        fprintf(stderr,"malloc failed\n");
+        return NULL;
+    }
+    thread_data->worker=worker;
+    thread_data->index=index;
+    place_thread(worker,thread_data);
+    pthread_rwlock_init(&thread_data->rwlock, NULL);
+    return thread_data;
+}
+static void free_thread(thread_data_t *thread_data)
+{
+    pthread_rwlock_destroy(&thread_data->rwlock);
+    free(thread_data);
+}
+static int start_thread(thread_data_t *thread_data)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(thread_data->node>=0){
+        pthread_attr_setaffinity_np(&attr, sizeof(thread_data->cpuset), &thread_data->cpuset);
+    }
+    int rc=pthread_create(&(thread_data->tid), &attr, thread_main, thread_data);
+    pthread_attr_destroy(&attr);
+    return (rc==0) ? E_OK : E_AGAIN;
+}
+int worker_park_game(worker_t *worker, const saved_game_t *game)
+{
+    if(worker->parked_count>=worker->parked_size){
+        uint32_t size=max(worker->parked_size*2,16);
+        saved_game_t *parked=(saved_game_t*)realloc(worker->parked,sizeof(saved_game_t)*size);
+        if(NULL==parked){
+            return E_NOSPACE;
+        }
+        worker->parked=parked;
+        worker->parked_size=size;
+    }
+    worker->parked[worker->parked_count++]=*game;
+    return E_OK;
+}
+static void park_thread(worker_t *worker, thread_data_t *thread_data)
+{
+    saved_game_t game;
+    pthread_rwlock_rdlock(&thread_data->rwlock);
+    game.moveno=thread_data->moveno;
+    game.scoreoffset=thread_data->scoreoffset;
+    game.board=thread_data->board;
+    game.wide=thread_data->wide;
+    game.wide_board=thread_data->wide_board;
+    game.seed=thread_data->seed;
+    game.rand=thread_data->rand;
+    pthread_rwlock_unlock(&thread_data->rwlock);
+    stats_untrack_board(&worker->stats,&thread_data->track);
+    if(game.moveno>0 && worker_park_game(worker,&game)!=E_OK){
+        fprintf(stderr,"Failed to park game, it will be lost\n");
+    }
+}
+// Continue the most recently parked game, or start a new one
+static void resume_game(worker_t *worker, thread_data_t *thread_data)
+{
+    if(worker->parked_count==0){
+        init_game(thread_data);
+        return;
+    }
+    saved_game_t *game=&(worker->parked[--(worker->parked_count)]);
+    pthread_rwlock_wrlock(&thread_data->rwlock);
+    thread_data->moveno=game->moveno;
+    thread_data->scoreoffset=game->scoreoffset;
+    thread_data->board=game->board;
+    thread_data->wide=game->wide;
+    thread_data->wide_board=game->wide_board;
+    thread_data->seed=game->seed;
+    thread_data->rand=game->rand;
+    pthread_rwlock_unlock(&thread_data->rwlock);
+    publish_state(thread_data);
+}
+/* Byte cap of each search: `search_cap`, or the share of `daemon_cap` of each
+ * of `searches` searches at once when smaller, 0 for no cap. The share is
+ * never below the smallest table. */
+size_t trans_table_search_cap(size_t search_cap, size_t daemon_cap, size_t searches)
+{
+    size_t cap=search_cap;
+    if(daemon_cap>0){
+        size_t share=daemon_cap/max(searches,1);
+        cap=(cap>0) ? min(cap,share) : share;
+        cap=max(cap,TRANS_TABLE_MIN_CAP);
+    }
+    return cap;
+}
+/* Spread the daemon's transposition table budget over the searches that can
+ * hold a table at once: four per game, or the searches the shared pool keeps
+ * started. A coordinator computes the cap of its shards the same way. */
+void update_trans_table_cap(worker_t *worker)
+{
+    size_t searches=(worker->sched_threads>0) ? (size_t)worker->sched_threads*SCHED_LIVE_SEARCHES :
+        4*(size_t)worker->thread_count;
+    size_t cap=trans_table_search_cap(worker->trans_table_search,worker->trans_table_daemon,searches);
+    worker->trans_table_cap=cap;
+    set_trans_table_cap(cap);
+}
+/* Change the number of concurrent games. Called from the main loop, which is
+ * also the only reader of the thread list apart from the games themselves. */
+int worker_resize(worker_t *worker, uint16_t thread_count)
+{
+    uint16_t i,old_count=worker->thread_count;
+    if(thread_count<1 || thread_count>MAX_THREADS){
+        return E_INVAL;
+    }
+    if(NULL!=worker->coordinator){
+        return coordinator_resize(worker,thread_count);
+    }
+    if(thread_count<old_count){
+        worker->thread_count=thread_count;
+        shm_state_set_count(&worker->shm,thread_count);
+        for(i=thread_count; i<old_count; i++){
+            worker->thread_data[i]->stop=true;
+        }
+        for(i=thread_count; i<old_count; i++){
+            thread_data_t *thread_data=worker->thread_data[i];
+            pthread_join(thread_data->tid, NULL);
+            park_thread(worker,thread_data);
+            free_thread(thread_data);
+            worker->thread_data[i]=NULL;
+        }
+        replace_threads(worker,thread_count);
+        update_trans_table_cap(worker);
+        return E_OK;
+    }
+    worker->thread_count=thread_count;
+    update_trans_table_cap(worker);
+    replace_threads(worker,old_count);
+    for(i=old_count; i<thread_count; i++){
+        thread_data_t *thread_data=new_thread(worker,i);
+        if(NULL==thread_data){
+            break;
+        }
+        resume_game(worker,thread_data);
+        if(start_thread(thread_data)!=E_OK){
+            park_thread(worker,thread_data);
+            free_thread(thread_data);
+            break;
+        }
+        worker->thread_data[i]=thread_data;
+    }
+    worker->thread_count=i;
+    if(i<thread_count){
+        replace_threads(worker,i);
+    }
+    shm_state_set_count(&worker->shm,i);
+    return (i==thread_count) ? E_OK : E_NOSPACE;
+}
+
 worker_t *worker_start(worker_param_t *param)
 {
-    worker_t *worker = (worker_t*)calloc(1,sizeof(worker_t)+sizeof(thread_data_t)*param->thread_count);
+    worker_t *worker = (worker_t*)calloc(1,sizeof(worker_t));
     if(NULL==worker){
         fprintf(stderr,"malloc failed\n");
         return NULL;
     }
+    if(param->thread_count<1 || param->thread_count>MAX_THREADS){
+        fprintf(stderr,"Invalid instance count %u, up to %u supported.\n",param->thread_count,MAX_THREADS);
+        free(worker);
+        return NULL;
+    }
+    worker->huge_pages=param->huge_pages;
+    worker->table_data=alloc_node_tables(NULL,-1,worker->huge_pages);
+    if(NULL==worker->table_data){
+        fprintf(stderr,"Failed to allocate move tables.\n");
+        free(worker);
+        return NULL;
+    }
     worker->fileinfo.log_path=param->log_path;
     worker->fileinfo.snapshot_path=param->snapshot_path;
     worker->fileinfo.socket_path=param->socket_path;
+    worker->fileinfo.shm_name=param->shm_name;
+    worker->fileinfo.rotate_size=param->log_rotate_size;
+    worker->fileinfo.rotate_period=param->log_rotate_period;
+    worker->fileinfo.coordinator.fd=param->shard ? SHARD_FD : -1;
     int rc=init_files(&worker->fileinfo);
     if(rc!=E_OK){
+        free_node_tables(worker->table_data);
         free(worker);
         return NULL;
     }
-    init_tables(&table_data);
+    // Shards are seen through the live state of their coordinator
+    worker->shm.fd=-1;
+    rc=param->shard ? E_OK : shm_state_create(&worker->shm,worker->fileinfo.shm_name,MAX_THREADS);
+    if(rc!=E_OK){
+        close_files(&worker->fileinfo);
+        free_node_tables(worker->table_data);
+        free(worker);
+        return NULL;
+    }
+    shm_state_set_count(&worker->shm,param->thread_count);
+    rc=metrics_open(&worker->metrics,param->metrics_endpoint);
+    if(rc!=E_OK){
+        shm_state_close(&worker->shm);
+        close_files(&worker->fileinfo);
+        free_node_tables(worker->table_data);
+        free(worker);
+        return NULL;
+    }
+    stats_init(&worker->stats);
     worker->thread_count=param->thread_count;
-    worker->table_data=&table_data;
+    worker->placement=param->placement;
+    if(worker->placement!=PLACEMENT_NONE && topology_read(&worker->topology)!=E_OK){
+        worker->placement=PLACEMENT_NONE;
+    }
+    if(param->sched_threads>0 && param->shard_count==0){
+        worker->sched=sched_start(param->sched_threads,param->sched_policy,&worker->topology,worker->placement);
+    }
+    worker->sched_threads=param->sched_threads;
+    worker->trans_table_search=param->trans_table_search;
+    worker->trans_table_daemon=param->trans_table_daemon;
+    update_trans_table_cap(worker);
+    if(NULL!=param->book_path && param->shard_count==0 && book_open(&worker->book,param->book_path)!=E_OK){
+        fprintf(stderr,"Playing without opening book.\n");
+    }
     pthread_mutex_init(&(worker->log_mutex), NULL);
+    // Segments left over from a daemon stopped while encoding
+    encode_log_segments(worker);
+    if(param->shard_count>0){
+        // The snapshot is handed out to the shard processes
+        worker->thread_count=0;
+        read_snapshot(worker);
+        worker->running=true;
+        if(coordinator_start(worker,param)!=E_OK){
+            worker_stop(worker);
+            return NULL;
+        }
+        return worker;
+    }
     int i;
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
-        thread_data->worker=worker;
-        initRandom(&thread_data->rand, unif_random(RANDOM_MAX));
-        pthread_rwlock_init(&thread_data->rwlock, NULL);
+        thread_data_t *thread_data=new_thread(worker,i);
+        if(NULL==thread_data){
+            worker->thread_count=i;
+            shm_state_set_count(&worker->shm,i);
+            break;
+        }
+        worker->thread_data[i]=thread_data;
         init_game(thread_data);
     }
     
-    read_snapshot(worker);
+    if(param->shard){
+        rc=shard_read_games(worker);
+    }else{
+        rc=read_snapshot(worker);
+    }
+    if(rc!=E_OK){
+        worker_stop(worker);
+        return NULL;
+    }
+    for (i = 0; i < worker->thread_count; i++) {
+        publish_state(worker->thread_data[i]);
+    }
     worker->running=true;
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
-        pthread_create(&(thread_data->tid), NULL, thread_main, thread_data);
+        start_thread(worker->thread_data[i]);
     }
     return worker;
 }
 void worker_stop(worker_t *worker)
 {
     worker->running=false;
+    // Collects the last snapshot of every shard
+    coordinator_stop(worker);
     int i;
+    // Cancels the searches in progress
+    for (i = 0; i < worker->thread_count; i++) {
+        worker->thread_data[i]->stop=true;
+    }
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
-        pthread_join(thread_data->tid, NULL);
+        thread_data_t *thread_data=worker->thread_data[i];
+        if(thread_data->tid!=0){
+            pthread_join(thread_data->tid, NULL);
+        }
     }
+    sched_stop(worker->sched);
+    worker->sched=NULL;
     write_snapshot(worker);
+    coordinator_close(worker);
+    stop_log_encoder(worker);
     for (i = 0; i < worker->thread_count; i++) {
-        thread_data_t *thread_data=&(worker->thread_data[i]);
-        pthread_rwlock_destroy(&thread_data->rwlock);
+        free_thread(worker->thread_data[i]);
+        worker->thread_data[i]=NULL;
     }
+    free(worker->parked);
     pthread_mutex_destroy(&(worker->log_mutex));
+    for (i = 0; i < MAX_NUMA_NODES; i++) {
+        free_node_tables(worker->node_tables[i]);
+    }
+    book_close(&worker->book);
+    free_node_tables(worker->table_data);
+    topology_free(&worker->topology);
+    metrics_close(&worker->metrics);
+    shm_state_close(&worker->shm);
+    stats_destroy(&worker->stats);
     close_files(&worker->fileinfo);
     free(worker);
 }
@@ -5,38 +5,106 @@
 #include <pthread.h>
 #include "2048.h"
 #include "random.h"
+#include "shmstate.h"
+#include "stats.h"
+#include "metrics.h"
+#include "affinity.h"
+#include "scheduler.h"
+#include "book.h"
+#include "wide.h"
 
 #define MAX_CONNECTIONS (16)
+#define MAX_THREADS (1024)
 
 struct worker_s;
 typedef struct {
     pthread_t tid;
     struct worker_s *worker;
     pthread_rwlock_t rwlock;
+    volatile bool stop;
+    table_data_t *table;
+    int node;
+    cpu_set_t cpuset;
+    uint64_t seed;
     rand_t rand;
+    uint32_t index;
     uint32_t moveno;
     uint32_t scoreoffset;
     board_t board;
+    bool wide;                  // past 32768, playing on wide_board
+    wide_board_t wide_board;
+    search_stats_t last_search;
+    uint64_t moves_evaled_total;
+    uint32_t last_move_usec;
+    uint64_t busy_usec;
+    stats_track_t track;
 } thread_data_t;
 
+// A game without a thread, kept until the thread count grows again
+typedef struct{
+    uint32_t moveno;
+    uint32_t scoreoffset;
+    board_t board;
+    bool wide;
+    wide_board_t wide_board;
+    uint64_t seed;
+    rand_t rand;
+}saved_game_t;
+
+// Line-based channel between a sharded daemon and its shard processes
+#define CHANNEL_BUF_SIZE (4096)
+typedef struct{
+    int fd;
+    size_t len;
+    char buf[CHANNEL_BUF_SIZE];
+}channel_t;
+
 typedef struct{
     const char *log_path;
     const char *snapshot_path;
     const char *socket_path;
+    const char *shm_name;
     FILE *fp_log;
     FILE *fp_snapshot;
     int fd_socket;
     bool socket_created;
     int clients[MAX_CONNECTIONS];
+    uint64_t rotate_size;       // rotate the log at this size, or 0
+    time_t rotate_period;       // rotate the log every period, or 0
+    time_t log_period;          // the period the current log started in
+    uint32_t log_segment;       // number of the last rotated segment
+    pthread_t encoder;
+    bool encoder_running;
+    volatile bool encoder_stop;
+    channel_t coordinator;      // of a shard process, fd -1 otherwise
 }fileinfo_t;
 
+struct coordinator_s;
+
 struct worker_s {
     pthread_mutex_t log_mutex;
     volatile bool running;
     table_data_t *table_data;
     fileinfo_t fileinfo;
+    shm_state_t shm;
+    stats_t stats;
+    metrics_t metrics;
+    int placement;
+    cpu_topology_t topology;
+    table_data_t *node_tables[MAX_NUMA_NODES];
+    bool huge_pages;
+    search_sched_t *sched;
+    uint16_t sched_threads;
+    book_t book;
+    size_t trans_table_search;  // byte cap of each search, or 0
+    size_t trans_table_daemon;  // byte cap of all searches together, or 0
+    size_t trans_table_cap;     // cap in effect for each search
     uint16_t thread_count;
-    thread_data_t thread_data[0];
+    thread_data_t *thread_data[MAX_THREADS];
+    saved_game_t *parked;
+    uint32_t parked_count;
+    uint32_t parked_size;
+    struct coordinator_s *coordinator;  // of a sharded daemon, whose games are mirrors
 };
 typedef struct worker_s worker_t;
 
@@ -45,6 +113,19 @@ typedef struct{
     const char *log_path;
     const char *snapshot_path;
     const char *socket_path;
+    const char *shm_name;
+    const char *metrics_endpoint;
+    int placement;
+    uint16_t sched_threads;
+    int sched_policy;
+    bool huge_pages;
+    const char *book_path;
+    size_t trans_table_search;
+    size_t trans_table_daemon;
+    uint64_t log_rotate_size;
+    time_t log_rotate_period;
+    uint16_t shard_count;       // run the games in this many shard processes
+    bool shard;                 // this is a shard process
 }worker_param_t;
 
 #ifdef __cplusplus
@@ -53,7 +134,10 @@ extern "C" {
 
 worker_t *worker_start(worker_param_t *param);
 void worker_stop(worker_t *worker);
-int worker_pipe_handler(worker_t *worker);
+int worker_resize(worker_t *worker, uint16_t thread_count);
+int worker_park_game(worker_t *worker, const saved_game_t *game);
+size_t trans_table_search_cap(size_t search_cap, size_t daemon_cap, size_t searches);
+void update_trans_table_cap(worker_t *worker);
 
 #ifdef __cplusplus
 }